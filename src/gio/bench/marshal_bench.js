@@ -0,0 +1,55 @@
+// Measures the per entry cost of turning a directory listing into JavaScript values.
+// Usage: node bench/marshal_bench.js [dir] [rounds]
+// Run it on the parent commit and on this one to compare before / after.
+
+const path = require('path');
+const fs = require('fs');
+const os = require('os');
+const gio = require('../build/Release/gio');
+
+const dir = process.argv[2] || path.join(os.tmpdir(), 'gio-marshal-bench');
+const rounds = parseInt(process.argv[3] || '20', 10);
+
+if (!process.argv[2] && !fs.existsSync(dir)) {
+    fs.mkdirSync(dir);
+    for (let i = 0; i < 10000; i++) {
+        fs.writeFileSync(path.join(dir, `file_${i}.txt`), '');
+    }
+}
+
+function ls(options) {
+    return new Promise((resolve, reject) => {
+        gio.ls(dir, options, (err, files) => err ? reject(new Error(err)) : resolve(files));
+    });
+}
+
+function count(result) {
+    return Array.isArray(result) ? result.length : result.count;
+}
+
+async function bench(label, options) {
+
+    // warm up caches and templates
+    await ls(options);
+
+    let entries = 0;
+    let elapsed = 0n;
+    for (let i = 0; i < rounds; i++) {
+        const start = process.hrtime.bigint();
+        const result = await ls(options);
+        elapsed += process.hrtime.bigint() - start;
+        entries += count(result);
+    }
+
+    const ns = Number(elapsed) / entries;
+    console.log(`${label.padEnd(24)} ${entries / rounds} entries  ${ns.toFixed(1)} ns/entry`);
+
+}
+
+(async () => {
+    console.log(`${dir}, ${rounds} rounds`);
+    await bench('objects (default)', {});
+    await bench('objects (name,is_dir)', { fields: ['name', 'is_dir'] });
+    await bench('columns (default)', { format: 'columns' });
+    await bench('columns (name,is_dir)', { fields: ['name', 'is_dir'], format: 'columns' });
+})();
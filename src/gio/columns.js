@@ -0,0 +1,89 @@
+// Lazy row accessor for listings returned with gio.ls(path, { format: 'columns' }, callback).
+// Rows are only turned into objects when they are read.
+
+const FLAG_IS_DIR = 1;
+const FLAG_IS_HIDDEN = 2;
+const FLAG_IS_SYMLINK = 4;
+const FLAG_IS_READABLE = 8;
+const FLAG_IS_WRITABLE = 16;
+
+const decoder = new TextDecoder('utf-8');
+
+class FileColumns {
+
+    constructor(columns) {
+        this.columns = columns;
+        this.length = columns.count;
+        this.location = columns.location;
+        this.fields = new Set(columns.fields);
+        this.rows = new Array(columns.count);
+    }
+
+    read_string(data, offsets, i) {
+        return decoder.decode(data.subarray(offsets[i], offsets[i + 1]));
+    }
+
+    name(i) {
+        return this.read_string(this.columns.names, this.columns.name_offsets, i);
+    }
+
+    href(i) {
+        return this.location.endsWith('/') ? this.location + this.name(i) : `${this.location}/${this.name(i)}`;
+    }
+
+    is_dir(i) {
+        return (this.columns.flags[i] & FLAG_IS_DIR) !== 0;
+    }
+
+    // Returns row i as a plain object with the same keys as the object format
+    row(i) {
+
+        if (this.rows[i]) {
+            return this.rows[i];
+        }
+
+        const c = this.columns;
+        const flags = c.flags[i];
+        const row = {};
+
+        if (this.fields.has('name')) row.name = this.name(i);
+        if (this.fields.has('display_name')) row.display_name = this.read_string(c.display_names, c.display_name_offsets, i);
+        if (this.fields.has('href')) row.href = this.href(i);
+        if (this.fields.has('location')) row.location = this.location;
+        if (this.fields.has('is_dir')) row.is_dir = (flags & FLAG_IS_DIR) !== 0;
+        if (this.fields.has('is_hidden')) row.is_hidden = (flags & FLAG_IS_HIDDEN) !== 0;
+        if (this.fields.has('is_readable')) row.is_readable = (flags & FLAG_IS_READABLE) !== 0;
+        if (this.fields.has('is_writable')) row.is_writable = (flags & FLAG_IS_WRITABLE) !== 0;
+        if (this.fields.has('is_symlink')) row.is_symlink = (flags & FLAG_IS_SYMLINK) !== 0;
+        if (this.fields.has('filesystem')) row.filesystem = c.filesystems[c.filesystem_index[i]];
+        if (this.fields.has('content_type')) row.content_type = c.content_types[c.content_type_index[i]];
+        if (this.fields.has('size')) row.size = c.size[i];
+        if (this.fields.has('mtime')) row.mtime = c.mtime[i];
+        if (this.fields.has('atime')) row.atime = c.atime[i];
+        if (this.fields.has('ctime')) row.ctime = c.ctime[i];
+
+        this.rows[i] = row;
+        return row;
+
+    }
+
+    *[Symbol.iterator]() {
+        for (let i = 0; i < this.length; i++) {
+            yield this.row(i);
+        }
+    }
+
+    to_array() {
+        return Array.from(this);
+    }
+
+}
+
+module.exports = {
+    FileColumns,
+    FLAG_IS_DIR,
+    FLAG_IS_HIDDEN,
+    FLAG_IS_SYMLINK,
+    FLAG_IS_READABLE,
+    FLAG_IS_WRITABLE
+};
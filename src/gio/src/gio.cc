@@ -7,6 +7,14 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/syscall.h>
+#include <dirent.h>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -15,6 +23,23 @@
 #include <mutex>
 #include <chrono>
 #include <vector>
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <climits>
+#include <set>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <iterator>
+#include <cmath>
 
 #include <archive.h>
 #include <archive_entry.h>
@@ -38,170 +63,6303 @@
 
 using namespace std;
 
-static const char* FILE_INFO_ATTRIBUTES =
-    G_FILE_ATTRIBUTE_STANDARD_NAME ","
-    G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME ","
-    G_FILE_ATTRIBUTE_STANDARD_TYPE ","
-    G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN ","
-    G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
-    G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK ","
-    G_FILE_ATTRIBUTE_STANDARD_SIZE ","
-    G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE ","
-    G_FILE_ATTRIBUTE_ACCESS_CAN_READ ","
-    G_FILE_ATTRIBUTE_FILESYSTEM_TYPE ","
-    G_FILE_ATTRIBUTE_TIME_MODIFIED ","
-    G_FILE_ATTRIBUTE_TIME_ACCESS ","
-    G_FILE_ATTRIBUTE_TIME_CREATED;
+// Fields that can be requested with options.fields. Each field maps to the
+// GIO attributes it needs so only those are queried from the backend.
+enum FileField : guint32 {
+    FIELD_NAME          = 1 << 0,
+    FIELD_DISPLAY_NAME  = 1 << 1,
+    FIELD_HREF          = 1 << 2,
+    FIELD_LOCATION      = 1 << 3,
+    FIELD_IS_DIR        = 1 << 4,
+    FIELD_IS_HIDDEN     = 1 << 5,
+    FIELD_IS_READABLE   = 1 << 6,
+    FIELD_IS_WRITABLE   = 1 << 7,
+    FIELD_IS_SYMLINK    = 1 << 8,
+    FIELD_FILESYSTEM    = 1 << 9,
+    FIELD_CONTENT_TYPE  = 1 << 10,
+    FIELD_SIZE          = 1 << 11,
+    FIELD_MTIME         = 1 << 12,
+    FIELD_ATIME         = 1 << 13,
+    FIELD_CTIME         = 1 << 14,
+    FIELD_OWNER         = 1 << 15,
+    FIELD_GROUP         = 1 << 16,
+    FIELD_PERMISSIONS   = 1 << 17,
+    FIELD_IS_EXECUTE    = 1 << 18,
+    FIELD_DEPTH         = 1 << 19
+};
+
+struct FileFieldInfo {
+    const char* name;
+    guint32 field;
+    const char* attributes;
+};
+
+static const FileFieldInfo FILE_FIELDS[] = {
+    { "name",           FIELD_NAME,         G_FILE_ATTRIBUTE_STANDARD_NAME },
+    { "display_name",   FIELD_DISPLAY_NAME, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME },
+    { "href",           FIELD_HREF,         G_FILE_ATTRIBUTE_STANDARD_NAME },
+    { "location",       FIELD_LOCATION,     G_FILE_ATTRIBUTE_STANDARD_NAME },
+    { "is_dir",         FIELD_IS_DIR,       G_FILE_ATTRIBUTE_STANDARD_TYPE },
+    { "is_hidden",      FIELD_IS_HIDDEN,    G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN },
+    { "is_readable",    FIELD_IS_READABLE,  G_FILE_ATTRIBUTE_ACCESS_CAN_READ },
+    { "is_writable",    FIELD_IS_WRITABLE,  G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE },
+    { "is_symlink",     FIELD_IS_SYMLINK,   G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK },
+    { "filesystem",     FIELD_FILESYSTEM,   G_FILE_ATTRIBUTE_FILESYSTEM_TYPE },
+    { "content_type",   FIELD_CONTENT_TYPE, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE },
+    { "size",           FIELD_SIZE,         G_FILE_ATTRIBUTE_STANDARD_SIZE },
+    { "mtime",          FIELD_MTIME,        G_FILE_ATTRIBUTE_TIME_MODIFIED },
+    { "atime",          FIELD_ATIME,        G_FILE_ATTRIBUTE_TIME_ACCESS },
+    { "ctime",          FIELD_CTIME,        G_FILE_ATTRIBUTE_TIME_CREATED },
+    { "owner",          FIELD_OWNER,        G_FILE_ATTRIBUTE_OWNER_USER },
+    { "group",          FIELD_GROUP,        G_FILE_ATTRIBUTE_OWNER_GROUP },
+    { "permissions",    FIELD_PERMISSIONS,  G_FILE_ATTRIBUTE_UNIX_MODE },
+    { "is_execute",     FIELD_IS_EXECUTE,   G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE },
+    { "depth",          FIELD_DEPTH,        G_FILE_ATTRIBUTE_STANDARD_NAME }
+};
+
+// Fields returned by ls when no options are given
+static const guint32 LS_FIELDS = FIELD_NAME | FIELD_DISPLAY_NAME | FIELD_HREF | FIELD_LOCATION |
+                                 FIELD_IS_DIR | FIELD_IS_HIDDEN | FIELD_IS_READABLE | FIELD_IS_WRITABLE |
+                                 FIELD_IS_SYMLINK | FIELD_FILESYSTEM | FIELD_CONTENT_TYPE | FIELD_SIZE |
+                                 FIELD_MTIME | FIELD_ATIME | FIELD_CTIME;
+
+// Fields returned by get_file when no options are given
+static const guint32 GET_FILE_FIELDS = LS_FIELDS | FIELD_OWNER | FIELD_GROUP | FIELD_PERMISSIONS | FIELD_IS_EXECUTE;
+
+// Fields returned by walk when no options are given
+static const guint32 WALK_FIELDS = LS_FIELDS | FIELD_DEPTH;
+
+// Builds the GIO attribute string for a set of fields
+static std::string fields_to_attributes(guint32 fields) {
+    std::string attributes = G_FILE_ATTRIBUTE_STANDARD_NAME;
+    for (const FileFieldInfo& field : FILE_FIELDS) {
+        if ((fields & field.field) && attributes.find(field.attributes) == std::string::npos) {
+            attributes += ",";
+            attributes += field.attributes;
+        }
+    }
+    return attributes;
+}
+
+// Reads options.fields into a field mask. Returns false and sets error for unknown names.
+static bool get_fields_option(v8::Local<v8::Value> options, guint32 default_fields, guint32& fields, std::string& error) {
+
+    fields = default_fields;
+    if (!options->IsObject()) {
+        return true;
+    }
+
+    v8::Local<v8::Value> value = Nan::Get(options.As<v8::Object>(), Nan::New("fields").ToLocalChecked()).ToLocalChecked();
+    if (!value->IsArray()) {
+        return true;
+    }
+
+    v8::Local<v8::Array> names = value.As<v8::Array>();
+    fields = 0;
+    for (uint32_t i = 0; i < names->Length(); i++) {
+        Nan::Utf8String name(Nan::Get(names, i).ToLocalChecked());
+        guint32 field = 0;
+        for (const FileFieldInfo& field_info : FILE_FIELDS) {
+            if (*name != NULL && strcmp(*name, field_info.name) == 0) {
+                field = field_info.field;
+                break;
+            }
+        }
+        if (field == 0) {
+            error = std::string("Unknown field: ") + (*name ? *name : "");
+            return false;
+        }
+        fields |= field;
+    }
+    return true;
+
+}
+
+// Reads options[name] as an integer, returns default_value when it is not a number
+static int get_int_option(v8::Local<v8::Value> options, const char* name, int default_value) {
+    if (!options->IsObject()) {
+        return default_value;
+    }
+    v8::Local<v8::Value> value = Nan::Get(options.As<v8::Object>(), Nan::New(name).ToLocalChecked()).ToLocalChecked();
+    return value->IsNumber() ? Nan::To<int>(value).FromJust() : default_value;
+}
+
+// Reads options[name] as a 64 bit integer, returns default_value when it is not a number
+static gint64 get_int64_option(v8::Local<v8::Value> options, const char* name, gint64 default_value) {
+    if (!options->IsObject()) {
+        return default_value;
+    }
+    v8::Local<v8::Value> value = Nan::Get(options.As<v8::Object>(), Nan::New(name).ToLocalChecked()).ToLocalChecked();
+    return value->IsNumber() ? (gint64)Nan::To<double>(value).FromJust() : default_value;
+}
+
+// Reads options[name] as a boolean, returns default_value when it is not set
+static bool get_bool_option(v8::Local<v8::Value> options, const char* name, bool default_value) {
+    if (!options->IsObject()) {
+        return default_value;
+    }
+    v8::Local<v8::Value> value = Nan::Get(options.As<v8::Object>(), Nan::New(name).ToLocalChecked()).ToLocalChecked();
+    return value->IsUndefined() ? default_value : Nan::To<bool>(value).FromJust();
+}
+
+// Reads options[name] as a string, returns default_value when it is not a string
+static std::string get_string_option(v8::Local<v8::Value> options, const char* name, const std::string& default_value) {
+    if (!options->IsObject()) {
+        return default_value;
+    }
+    v8::Local<v8::Value> value = Nan::Get(options.As<v8::Object>(), Nan::New(name).ToLocalChecked()).ToLocalChecked();
+    if (!value->IsString()) {
+        return default_value;
+    }
+    Nan::Utf8String str(value);
+    return std::string(*str);
+}
+
+// Keys of the result objects. The first entries follow the order of FILE_FIELDS
+// so a field's index in FILE_FIELDS is also its key.
+enum Key {
+    KEY_NAME, KEY_DISPLAY_NAME, KEY_HREF, KEY_LOCATION, KEY_IS_DIR, KEY_IS_HIDDEN,
+    KEY_IS_READABLE, KEY_IS_WRITABLE, KEY_IS_SYMLINK, KEY_FILESYSTEM, KEY_CONTENT_TYPE,
+    KEY_SIZE, KEY_MTIME, KEY_ATIME, KEY_CTIME, KEY_OWNER, KEY_GROUP, KEY_PERMISSIONS,
+    KEY_IS_EXECUTE, KEY_DEPTH,
+    KEY_PATH, KEY_TYPE, KEY_UUID, KEY_ROOT,
+    KEY_DISPLAY, KEY_EXEC, KEY_CMD, KEY_MIMETYPE, KEY_APPID,
+    KEY_CURRENT_NUM_BYTES, KEY_BYTES_COPIED, KEY_TOTAL_BYTES,
+    KEY_SOURCE, KEY_DESTINATION, KEY_DESTINATION_IS_DIR, KEY_MESSAGE,
+    KEY_BYTES, KEY_FILES, KEY_TOTAL_FILES, KEY_DIRS, KEY_ITEMS, KEY_TOTAL_ITEMS, KEY_ERRORS,
+    KEY_RATE, KEY_SMOOTHED_RATE, KEY_ETA,
+    KEY_CONFLICTS, KEY_FREE, KEY_READONLY, KEY_ENOUGH_SPACE, KEY_JOBS, KEY_ERROR_LIST, KEY_CANCELLED, KEY_MOVED,
+    KEY_FILE, KEY_COUNT, KEY_ADDED, KEY_REMOVED, KEY_NEEDS_SAVE, KEY_BUILT,
+    KEY_TOTAL, KEY_USED,
+    KEY_MAX
+};
+
+static const char* KEY_NAMES[] = {
+    "name", "display_name", "href", "location", "is_dir", "is_hidden",
+    "is_readable", "is_writable", "is_symlink", "filesystem", "content_type",
+    "size", "mtime", "atime", "ctime", "owner", "group", "permissions",
+    "is_execute", "depth",
+    "path", "type", "uuid", "root",
+    "display", "exec", "cmd", "mimetype", "appid",
+    "current_num_bytes", "bytes_copied", "total_bytes",
+    "source", "destination", "destination_is_dir", "message",
+    "bytes", "files", "total_files", "dirs", "items", "total_items", "errors",
+    "rate", "smoothed_rate", "eta",
+    "conflicts", "free", "readonly", "enough_space", "jobs", "error_list", "cancelled", "moved",
+    "file", "count", "added", "removed", "needs_save", "built",
+    "total", "used"
+};
+
+static_assert(sizeof(FILE_FIELDS) / sizeof(FILE_FIELDS[0]) == KEY_DEPTH + 1, "FILE_FIELDS and Key are out of sync");
+static_assert(sizeof(KEY_NAMES) / sizeof(KEY_NAMES[0]) == KEY_MAX, "KEY_NAMES and Key are out of sync");
+
+// Per isolate cache of internalized key strings and of one object template per
+// field mask. Objects created from the same template share a hidden class, so
+// filling in their properties does not transition maps or fall back to
+// dictionary mode. The addon is worker enabled so each isolate gets its own
+// cache, released by an environment cleanup hook.
+class KeyCache {
+public:
+
+    static KeyCache& get() {
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        if (instance == NULL || instance->isolate != isolate) {
+            instance = new KeyCache(isolate);
+            node::AddEnvironmentCleanupHook(isolate, cleanup, instance);
+        }
+        return *instance;
+    }
+
+    v8::Local<v8::String> key(Key k) {
+        return keys[k].Get(isolate);
+    }
+
+    // New object with a property slot for every field in fields
+    v8::Local<v8::Object> new_file_object(guint32 fields) {
+        auto it = templates.find(fields);
+        if (it == templates.end()) {
+            v8::Local<v8::ObjectTemplate> tmpl = v8::ObjectTemplate::New(isolate);
+            for (size_t i = 0; i < sizeof(FILE_FIELDS) / sizeof(FILE_FIELDS[0]); i++) {
+                if (fields & FILE_FIELDS[i].field) {
+                    tmpl->Set(key(static_cast<Key>(i)), v8::Undefined(isolate));
+                }
+            }
+            it = templates.emplace(fields, v8::Eternal<v8::ObjectTemplate>(isolate, tmpl)).first;
+        }
+        return it->second.Get(isolate)->NewInstance(isolate->GetCurrentContext()).ToLocalChecked();
+    }
+
+private:
+
+    explicit KeyCache(v8::Isolate* isolate) : isolate(isolate) {
+        for (int i = 0; i < KEY_MAX; i++) {
+            keys[i].Set(isolate, v8::String::NewFromUtf8(isolate, KEY_NAMES[i], v8::NewStringType::kInternalized).ToLocalChecked());
+        }
+    }
+
+    static void cleanup(void* arg) {
+        KeyCache* cache = static_cast<KeyCache*>(arg);
+        if (instance == cache) {
+            instance = NULL;
+        }
+        delete cache;
+    }
+
+    static thread_local KeyCache* instance;
+    v8::Isolate* isolate;
+    v8::Eternal<v8::String> keys[KEY_MAX];
+    std::unordered_map<guint32, v8::Eternal<v8::ObjectTemplate>> templates;
+};
+
+thread_local KeyCache* KeyCache::instance = NULL;
+
+static inline v8::Local<v8::String> key(Key k) {
+    return KeyCache::get().key(k);
+}
+
+// Returns a GFile for either a local path or a uri
+static GFile* new_file_for(const char* source) {
+    char* scheme = g_uri_parse_scheme(source);
+    GFile* file = scheme != NULL ? g_file_new_for_uri(source) : g_file_new_for_path(source);
+    g_free(scheme);
+    return file;
+}
+
+// Local path of a file, or its uri when it has no local path
+static std::string file_location(GFile* file) {
+    char* location = g_file_get_path(file);
+    if (location == NULL) {
+        location = g_file_get_uri(file);
+    }
+    std::string result = location ? location : "";
+    g_free(location);
+    return result;
+}
+
+// Throughput of a transfer in bytes per second, eta in seconds or -1 while unknown
+struct ProgressRate {
+    double rate = 0;
+    double smoothed_rate = 0;
+    double eta = -1;
+};
+
+// Decides when a transfer reports its progress and measures its throughput. A report is
+// due once interval has passed or threshold bytes were moved since the last one. rate is
+// measured between reports, smoothed_rate averages it with a time constant of SMOOTHING
+// so the eta does not jump around with every burst of the device. Thread safe.
+class ProgressMeter {
+public:
+    static const gint64 DEFAULT_INTERVAL = 50 * 1000;
+    static constexpr double SMOOTHING = 3.0;
+
+    void configure(gint64 interval, guint64 threshold) {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->interval = interval;
+        this->threshold = threshold;
+    }
+
+    // Records the position, returns true and fills rate when a report is due
+    bool update(guint64 bytes, guint64 total_bytes, ProgressRate& rate) {
+        std::lock_guard<std::mutex> lock(mutex);
+        gint64 now = g_get_monotonic_time();
+        if (last_time == 0 || bytes < last_bytes) {
+            last_time = now;
+            last_bytes = bytes;
+        }
+        bool due = now - last_time >= interval ||
+                   (threshold > 0 && bytes - last_bytes >= threshold) ||
+                   (total_bytes > 0 && bytes >= total_bytes && bytes != last_bytes);
+        if (!due) {
+            return false;
+        }
+
+        double seconds = (now - last_time) / 1e6;
+        if (seconds > 0) {
+            current.rate = (bytes - last_bytes) / seconds;
+            double weight = measured ? 1 - exp(-seconds / SMOOTHING) : 1;
+            current.smoothed_rate += weight * (current.rate - current.smoothed_rate);
+            measured = true;
+        }
+        current.eta = current.smoothed_rate > 0 && total_bytes >= bytes
+                      ? (total_bytes - bytes) / current.smoothed_rate
+                      : -1;
+        last_time = now;
+        last_bytes = bytes;
+        rate = current;
+        return true;
+    }
+
+    ProgressRate get_rate() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return current;
+    }
+
+private:
+    mutable std::mutex mutex;
+    gint64 interval = DEFAULT_INTERVAL;
+    guint64 threshold = 0;
+    gint64 last_time = 0;
+    guint64 last_bytes = 0;
+    bool measured = false;
+    ProgressRate current;
+};
+
+// Reads options.progress_interval (milliseconds) and options.progress_bytes into a meter
+static void get_progress_options(v8::Local<v8::Value> options, ProgressMeter& meter) {
+    gint64 interval = std::max<gint64>(1, get_int64_option(options, "progress_interval", ProgressMeter::DEFAULT_INTERVAL / 1000));
+    gint64 threshold = std::max<gint64>(0, get_int64_option(options, "progress_bytes", 0));
+    meter.configure(interval * 1000, threshold);
+}
+
+static void set_rate_properties(v8::Local<v8::Object> obj, const ProgressRate& rate) {
+    Nan::Set(obj, key(KEY_RATE), Nan::New<v8::Number>(rate.rate));
+    Nan::Set(obj, key(KEY_SMOOTHED_RATE), Nan::New<v8::Number>(rate.smoothed_rate));
+    Nan::Set(obj, key(KEY_ETA), Nan::New<v8::Number>(rate.eta));
+}
+
+// A long running job started from JS, a copy, move, walk or search. The worker doing the
+// job calls checkpoint() between units of work, it blocks while the operation is paused
+// and returns false once it is cancelled. Counters are updated by the worker for status().
+class Operation {
+public:
+    enum State { RUNNING, PAUSED, CANCELLED, DONE, FAILED };
+
+    const guint32 id;
+    const std::string type;
+    const std::string source;
+    const gint64 started;
+    GCancellable* cancellable;
+
+    std::atomic<guint64> items{0};
+    std::atomic<guint64> bytes{0};
+    std::atomic<guint64> total_bytes{0};
+    ProgressMeter meter;
+
+    Operation(guint32 id, const std::string& type, const std::string& source)
+        : id(id), type(type), source(source), started(g_get_monotonic_time()) {
+        cancellable = g_cancellable_new();
+    }
+
+    ~Operation() {
+        g_object_unref(cancellable);
+    }
+
+    Operation(const Operation&) = delete;
+    Operation& operator=(const Operation&) = delete;
+
+    void cancel() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (state == DONE || state == FAILED) {
+                return;
+            }
+            state = CANCELLED;
+        }
+        resumed.notify_all();
+        g_cancellable_cancel(cancellable);
+    }
+
+    bool pause() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state != RUNNING) {
+            return false;
+        }
+        state = PAUSED;
+        return true;
+    }
+
+    bool resume() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (state != PAUSED) {
+                return false;
+            }
+            state = RUNNING;
+        }
+        resumed.notify_all();
+        return true;
+    }
+
+    bool checkpoint() {
+        if (state == RUNNING) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        resumed.wait(lock, [this] { return state != PAUSED; });
+        return state != CANCELLED;
+    }
+
+    // Records the position of a transfer, returns true and fills rate when a report is due
+    bool progress(guint64 bytes, guint64 total_bytes, ProgressRate& rate) {
+        this->bytes = bytes;
+        this->total_bytes = total_bytes;
+        return meter.update(bytes, total_bytes, rate);
+    }
+
+    // Called by the worker when it is done, a cancelled operation stays cancelled
+    void finish(bool ok) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state == CANCELLED || g_cancellable_is_cancelled(cancellable)) {
+            state = CANCELLED;
+        } else {
+            state = ok ? DONE : FAILED;
+        }
+        resumed.notify_all();
+    }
+
+    State get_state() const {
+        return state;
+    }
+
+    const char* state_name() const {
+        switch (state.load()) {
+            case RUNNING: return "running";
+            case PAUSED: return "paused";
+            case CANCELLED: return "cancelled";
+            case DONE: return "done";
+            default: return "failed";
+        }
+    }
+
+private:
+    std::atomic<State> state{RUNNING};
+    std::mutex mutex;
+    std::condition_variable resumed;
+};
+
+// Operations by id, shared by every isolate so a transfer can be cancelled from any thread.
+// Finished operations are kept for a while so their final status can still be read.
+class OperationRegistry {
+public:
+    static std::shared_ptr<Operation> create(const std::string& type, const std::string& source) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Operation> operation = std::make_shared<Operation>(++next_id, type, source);
+        live[operation->id] = operation;
+        return operation;
+    }
+
+    static std::shared_ptr<Operation> find(guint32 id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = live.find(id);
+        if (it != live.end()) {
+            return it->second;
+        }
+        for (const std::shared_ptr<Operation>& operation : finished) {
+            if (operation->id == id) {
+                return operation;
+            }
+        }
+        return nullptr;
+    }
+
+    static void remove(guint32 id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = live.find(id);
+        if (it == live.end()) {
+            return;
+        }
+        finished.push_front(it->second);
+        live.erase(it);
+        if (finished.size() > MAX_FINISHED) {
+            finished.pop_back();
+        }
+    }
+
+    static std::vector<std::shared_ptr<Operation>> list() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::shared_ptr<Operation>> operations;
+        for (const auto& entry : live) {
+            operations.push_back(entry.second);
+        }
+        return operations;
+    }
+
+    // Cancels every live operation of a type, returns how many there were
+    static int cancel_type(const std::string& type) {
+        int count = 0;
+        for (const std::shared_ptr<Operation>& operation : list()) {
+            if (operation->type == type) {
+                operation->cancel();
+                count++;
+            }
+        }
+        return count;
+    }
+
+private:
+    static const size_t MAX_FINISHED = 32;
+    static std::mutex mutex;
+    static guint32 next_id;
+    static std::map<guint32, std::shared_ptr<Operation>> live;
+    static std::deque<std::shared_ptr<Operation>> finished;
+};
+
+std::mutex OperationRegistry::mutex;
+guint32 OperationRegistry::next_id = 0;
+std::map<guint32, std::shared_ptr<Operation>> OperationRegistry::live;
+std::deque<std::shared_ptr<Operation>> OperationRegistry::finished;
+
+static v8::Local<v8::Object> operation_to_object(const Operation& operation) {
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("id").ToLocalChecked(), Nan::New<v8::Uint32>(operation.id));
+    Nan::Set(obj, Nan::New("type").ToLocalChecked(), Nan::New(operation.type).ToLocalChecked());
+    Nan::Set(obj, Nan::New("source").ToLocalChecked(), Nan::New(operation.source).ToLocalChecked());
+    Nan::Set(obj, Nan::New("state").ToLocalChecked(), Nan::New(operation.state_name()).ToLocalChecked());
+    Nan::Set(obj, Nan::New("items").ToLocalChecked(), Nan::New<v8::Number>((double)operation.items.load()));
+    Nan::Set(obj, Nan::New("bytes").ToLocalChecked(), Nan::New<v8::Number>((double)operation.bytes.load()));
+    Nan::Set(obj, Nan::New("total_bytes").ToLocalChecked(), Nan::New<v8::Number>((double)operation.total_bytes.load()));
+    Nan::Set(obj, Nan::New("elapsed").ToLocalChecked(), Nan::New<v8::Number>((double)((g_get_monotonic_time() - operation.started) / 1000)));
+    set_rate_properties(obj, operation.meter.get_rate());
+    return obj;
+}
+
+// Methods of an operation handle carry the id as function data, the exported
+// op_* functions take it as their first argument
+static std::shared_ptr<Operation> operation_for(const Nan::FunctionCallbackInfo<v8::Value>& info) {
+    v8::Local<v8::Value> id = info.Data()->IsNumber() ? info.Data() : info[0];
+    if (!id->IsNumber()) {
+        return nullptr;
+    }
+    return OperationRegistry::find(Nan::To<uint32_t>(id).FromJust());
+}
+
+static NAN_METHOD(operation_cancel) {
+    std::shared_ptr<Operation> operation = operation_for(info);
+    if (operation) {
+        operation->cancel();
+    }
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(operation != nullptr));
+}
+
+static NAN_METHOD(operation_pause) {
+    std::shared_ptr<Operation> operation = operation_for(info);
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(operation && operation->pause()));
+}
+
+static NAN_METHOD(operation_resume) {
+    std::shared_ptr<Operation> operation = operation_for(info);
+    info.GetReturnValue().Set(Nan::New<v8::Boolean>(operation && operation->resume()));
+}
+
+static NAN_METHOD(operation_status) {
+    std::shared_ptr<Operation> operation = operation_for(info);
+    if (operation) {
+        info.GetReturnValue().Set(operation_to_object(*operation));
+    }
+}
+
+// The object returned to JS for a running operation, {id, type, cancel(), pause(), resume(), status()}
+static v8::Local<v8::Object> operation_handle(const Operation& operation) {
+    v8::Local<v8::Object> handle = Nan::New<v8::Object>();
+    v8::Local<v8::Value> id = Nan::New<v8::Uint32>(operation.id);
+    Nan::Set(handle, Nan::New("id").ToLocalChecked(), id);
+    Nan::Set(handle, Nan::New("type").ToLocalChecked(), Nan::New(operation.type).ToLocalChecked());
+    Nan::Set(handle, Nan::New("cancel").ToLocalChecked(),
+             Nan::GetFunction(Nan::New<v8::FunctionTemplate>(operation_cancel, id)).ToLocalChecked());
+    Nan::Set(handle, Nan::New("pause").ToLocalChecked(),
+             Nan::GetFunction(Nan::New<v8::FunctionTemplate>(operation_pause, id)).ToLocalChecked());
+    Nan::Set(handle, Nan::New("resume").ToLocalChecked(),
+             Nan::GetFunction(Nan::New<v8::FunctionTemplate>(operation_resume, id)).ToLocalChecked());
+    Nan::Set(handle, Nan::New("status").ToLocalChecked(),
+             Nan::GetFunction(Nan::New<v8::FunctionTemplate>(operation_status, id)).ToLocalChecked());
+    return handle;
+}
+
+// Plain copy of the attributes of a directory entry so it can be gathered
+// off the JS thread and converted to a v8 object later
+struct FileResult {
+    guint32 fields = 0;
+    std::string name;
+    std::string display_name;
+    std::string href;
+    std::string location;
+    bool is_hidden = false;
+    bool is_directory = false;
+    std::string mimetype;
+    bool is_symlink = false;
+    bool is_writeable = false;
+    bool is_readable = false;
+    bool is_execute = false;
+    std::string filesystem;
+    std::string owner;
+    std::string group;
+    guint32 permissions = 0;
+    gint64 size = 0;
+    gint64 mtime = 0;
+    gint64 atime = 0;
+    gint64 ctime = 0;
+    int depth = 0;
+};
+
+typedef std::vector<FileResult> FileBatch;
+
+// Copies the requested fields out of a GFileInfo. href and location are set by the caller.
+static void get_file_result(GFileInfo* file_info, guint32 fields, FileResult& fileResult) {
+
+    fileResult.fields = fields;
+    fileResult.name = g_file_info_get_name(file_info);
+
+    if (fields & FIELD_DISPLAY_NAME) {
+        const char* display_name = g_file_info_get_display_name(file_info);
+        fileResult.display_name = display_name ? display_name : fileResult.name;
+    }
+    if (fields & FIELD_IS_HIDDEN) {
+        fileResult.is_hidden = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
+                              ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
+                              : FALSE;
+    }
+    if (fields & FIELD_IS_DIR) {
+        fileResult.is_directory = g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY;
+    }
+    if (fields & FIELD_CONTENT_TYPE) {
+        const char* mimetype = g_file_info_get_content_type(file_info);
+        fileResult.mimetype = mimetype ? mimetype : "";
+    }
+    if (fields & FIELD_IS_SYMLINK) {
+        fileResult.is_symlink = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
+                               ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
+                               : FALSE;
+    }
+    if (fields & FIELD_IS_WRITABLE) {
+        fileResult.is_writeable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE);
+    }
+    if (fields & FIELD_IS_READABLE) {
+        fileResult.is_readable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ);
+    }
+    if (fields & FIELD_IS_EXECUTE) {
+        fileResult.is_execute = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE);
+    }
+    if (fields & FIELD_FILESYSTEM) {
+        const char* fs_type = g_file_info_get_attribute_string(file_info, G_FILE_ATTRIBUTE_FILESYSTEM_TYPE);
+        fileResult.filesystem = fs_type ? fs_type : "unknown";
+    }
+    if (fields & FIELD_OWNER) {
+        char* owner = g_file_info_get_attribute_as_string(file_info, G_FILE_ATTRIBUTE_OWNER_USER);
+        fileResult.owner = owner ? owner : "Unknown";
+        g_free(owner);
+    }
+    if (fields & FIELD_GROUP) {
+        char* group = g_file_info_get_attribute_as_string(file_info, G_FILE_ATTRIBUTE_OWNER_GROUP);
+        fileResult.group = group ? group : "Unknown";
+        g_free(group);
+    }
+    if (fields & FIELD_PERMISSIONS) {
+        fileResult.permissions = g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_UNIX_MODE);
+    }
+    if (fields & FIELD_SIZE) {
+        fileResult.size = g_file_info_get_size(file_info);
+    }
+
+    if (fields & FIELD_MTIME) {
+        GDateTime* mtime_dt = g_file_info_get_modification_date_time(file_info);
+        if (mtime_dt != NULL) {
+            fileResult.mtime = g_date_time_to_unix(mtime_dt);
+            g_date_time_unref(mtime_dt);
+        }
+    }
+
+    if (fields & FIELD_ATIME) {
+        GDateTime* atime_dt = g_file_info_get_access_date_time(file_info);
+        if (atime_dt != NULL) {
+            fileResult.atime = g_date_time_to_unix(atime_dt);
+            g_date_time_unref(atime_dt);
+        }
+    }
+
+    if (fields & FIELD_CTIME) {
+        GDateTime* ctime_dt = g_file_info_get_creation_date_time(file_info);
+        if (ctime_dt != NULL) {
+            fileResult.ctime = g_date_time_to_unix(ctime_dt);
+            g_date_time_unref(ctime_dt);
+        }
+    }
+
+}
+
+// Same as get_file_result for an entry of an enumerated directory
+static void get_child_result(GFile* parent, const std::string& location, GFileInfo* file_info, guint32 fields, FileResult& fileResult) {
+
+    get_file_result(file_info, fields, fileResult);
+
+    if (fields & FIELD_HREF) {
+        GFile* file = g_file_get_child(parent, fileResult.name.c_str());
+        char* href = g_file_get_path(file);
+        fileResult.href = href ? href : location + "/" + fileResult.name;
+        g_free(href);
+        g_object_unref(file);
+    }
+    fileResult.location = location;
+
+}
+
+static v8::Local<v8::Object> file_result_to_object(const FileResult& fileResult) {
+
+    KeyCache& keys = KeyCache::get();
+    guint32 fields = fileResult.fields;
+    v8::Local<v8::Object> fileObj = keys.new_file_object(fields);
+    if (fields & FIELD_NAME)
+        Nan::Set(fileObj, keys.key(KEY_NAME), Nan::New(fileResult.name).ToLocalChecked());
+    if (fields & FIELD_DISPLAY_NAME)
+        Nan::Set(fileObj, keys.key(KEY_DISPLAY_NAME), Nan::New(fileResult.display_name).ToLocalChecked());
+    if (fields & FIELD_HREF)
+        Nan::Set(fileObj, keys.key(KEY_HREF), Nan::New(fileResult.href).ToLocalChecked());
+    if (fields & FIELD_LOCATION)
+        Nan::Set(fileObj, keys.key(KEY_LOCATION), Nan::New(fileResult.location).ToLocalChecked());
+    if (fields & FIELD_IS_DIR)
+        Nan::Set(fileObj, keys.key(KEY_IS_DIR), Nan::New<v8::Boolean>(fileResult.is_directory));
+    if (fields & FIELD_IS_HIDDEN)
+        Nan::Set(fileObj, keys.key(KEY_IS_HIDDEN), Nan::New<v8::Boolean>(fileResult.is_hidden));
+    if (fields & FIELD_IS_READABLE)
+        Nan::Set(fileObj, keys.key(KEY_IS_READABLE), Nan::New<v8::Boolean>(fileResult.is_readable));
+    if (fields & FIELD_IS_WRITABLE)
+        Nan::Set(fileObj, keys.key(KEY_IS_WRITABLE), Nan::New<v8::Boolean>(fileResult.is_writeable));
+    if (fields & FIELD_IS_SYMLINK)
+        Nan::Set(fileObj, keys.key(KEY_IS_SYMLINK), Nan::New<v8::Boolean>(fileResult.is_symlink));
+    if (fields & FIELD_IS_EXECUTE)
+        Nan::Set(fileObj, keys.key(KEY_IS_EXECUTE), Nan::New<v8::Boolean>(fileResult.is_execute));
+    if (fields & FIELD_FILESYSTEM)
+        Nan::Set(fileObj, keys.key(KEY_FILESYSTEM), Nan::New(fileResult.filesystem).ToLocalChecked());
+    if (fields & FIELD_OWNER)
+        Nan::Set(fileObj, keys.key(KEY_OWNER), Nan::New(fileResult.owner).ToLocalChecked());
+    if (fields & FIELD_GROUP)
+        Nan::Set(fileObj, keys.key(KEY_GROUP), Nan::New(fileResult.group).ToLocalChecked());
+    if (fields & FIELD_PERMISSIONS)
+        Nan::Set(fileObj, keys.key(KEY_PERMISSIONS), Nan::New<v8::Int32>(fileResult.permissions));
+    if (fields & FIELD_CONTENT_TYPE)
+        Nan::Set(fileObj, keys.key(KEY_CONTENT_TYPE), Nan::New(fileResult.mimetype).ToLocalChecked());
+    if (fields & FIELD_SIZE)
+        Nan::Set(fileObj, keys.key(KEY_SIZE), Nan::New<v8::Number>(fileResult.size));
+    if (fields & FIELD_MTIME)
+        Nan::Set(fileObj, keys.key(KEY_MTIME), Nan::New<v8::Number>(fileResult.mtime));
+    if (fields & FIELD_ATIME)
+        Nan::Set(fileObj, keys.key(KEY_ATIME), Nan::New<v8::Number>(fileResult.atime));
+    if (fields & FIELD_CTIME)
+        Nan::Set(fileObj, keys.key(KEY_CTIME), Nan::New<v8::Number>(fileResult.ctime));
+    if (fields & FIELD_DEPTH)
+        Nan::Set(fileObj, keys.key(KEY_DEPTH), Nan::New<v8::Int32>(fileResult.depth));
+    return fileObj;
+
+}
+
+static v8::Local<v8::Array> file_batch_to_array(const FileBatch& batch) {
+    v8::Local<v8::Array> resultArray = Nan::New<v8::Array>(batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        Nan::Set(resultArray, i, file_result_to_object(batch[i]));
+    }
+    return resultArray;
+}
+
+// Bits of the flags column returned by the columns format
+enum FileFlag : guint8 {
+    FLAG_IS_DIR      = 1 << 0,
+    FLAG_IS_HIDDEN   = 1 << 1,
+    FLAG_IS_SYMLINK  = 1 << 2,
+    FLAG_IS_READABLE = 1 << 3,
+    FLAG_IS_WRITABLE = 1 << 4
+};
+
+template <typename ArrayType, typename T>
+static v8::Local<ArrayType> new_typed_array(const std::vector<T>& values) {
+    v8::Isolate* isolate = v8::Isolate::GetCurrent();
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, values.size() * sizeof(T));
+    if (!values.empty()) {
+        memcpy(buffer->GetBackingStore()->Data(), values.data(), values.size() * sizeof(T));
+    }
+    return ArrayType::New(buffer, 0, values.size());
+}
+
+// Concatenated utf8 strings plus an offsets array with count + 1 entries
+struct StringColumn {
+    std::string data;
+    std::vector<guint32> offsets { 0 };
+
+    void push(const std::string& value) {
+        data += value;
+        offsets.push_back(data.size());
+    }
+};
+
+// Repeated strings (content types, filesystems) stored once plus an index per row
+struct StringTable {
+    std::vector<std::string> values;
+    std::vector<guint32> index;
+
+    void push(const std::string& value) {
+        auto it = std::find(values.begin(), values.end(), value);
+        if (it == values.end()) {
+            values.push_back(value);
+            it = values.end() - 1;
+        }
+        index.push_back(it - values.begin());
+    }
+};
+
+static void set_string_column(v8::Local<v8::Object> obj, const char* data_key, const char* offsets_key, const StringColumn& column) {
+    Nan::Set(obj, Nan::New(data_key).ToLocalChecked(), Nan::CopyBuffer(column.data.data(), column.data.size()).ToLocalChecked());
+    Nan::Set(obj, Nan::New(offsets_key).ToLocalChecked(), new_typed_array<v8::Uint32Array>(column.offsets));
+}
+
+static void set_string_table(v8::Local<v8::Object> obj, const char* values_key, const char* index_key, const StringTable& table) {
+    v8::Local<v8::Array> values = Nan::New<v8::Array>(table.values.size());
+    for (size_t i = 0; i < table.values.size(); i++) {
+        Nan::Set(values, i, Nan::New(table.values[i]).ToLocalChecked());
+    }
+    Nan::Set(obj, Nan::New(values_key).ToLocalChecked(), values);
+    Nan::Set(obj, Nan::New(index_key).ToLocalChecked(), new_typed_array<v8::Uint32Array>(table.index));
+}
+
+// Struct of arrays version of file_batch_to_array. Numbers go into typed arrays,
+// booleans into one flags bitfield and names into a single utf8 buffer, so a
+// large listing costs a handful of allocations instead of one object per entry.
+static v8::Local<v8::Object> file_batch_to_columns(const FileBatch& batch, const std::string& location, guint32 fields) {
+
+    size_t count = batch.size();
+    StringColumn names;
+    StringColumn display_names;
+    StringTable content_types;
+    StringTable filesystems;
+    std::vector<guint8> flags(count);
+    std::vector<double> size(count), mtime(count), atime(count), ctime(count);
+
+    for (size_t i = 0; i < count; i++) {
+        const FileResult& fileResult = batch[i];
+        names.push(fileResult.name);
+        if (fields & FIELD_DISPLAY_NAME) {
+            display_names.push(fileResult.display_name);
+        }
+        if (fields & FIELD_CONTENT_TYPE) {
+            content_types.push(fileResult.mimetype);
+        }
+        if (fields & FIELD_FILESYSTEM) {
+            filesystems.push(fileResult.filesystem);
+        }
+        flags[i] = (fileResult.is_directory ? FLAG_IS_DIR : 0) |
+                   (fileResult.is_hidden ? FLAG_IS_HIDDEN : 0) |
+                   (fileResult.is_symlink ? FLAG_IS_SYMLINK : 0) |
+                   (fileResult.is_readable ? FLAG_IS_READABLE : 0) |
+                   (fileResult.is_writeable ? FLAG_IS_WRITABLE : 0);
+        size[i] = fileResult.size;
+        mtime[i] = fileResult.mtime;
+        atime[i] = fileResult.atime;
+        ctime[i] = fileResult.ctime;
+    }
+
+    v8::Local<v8::Object> columns = Nan::New<v8::Object>();
+    Nan::Set(columns, Nan::New("count").ToLocalChecked(), Nan::New<v8::Number>(count));
+    Nan::Set(columns, Nan::New("location").ToLocalChecked(), Nan::New(location).ToLocalChecked());
+
+    v8::Local<v8::Array> field_names = Nan::New<v8::Array>();
+    uint32_t field_count = 0;
+    for (const FileFieldInfo& field : FILE_FIELDS) {
+        if (fields & field.field) {
+            Nan::Set(field_names, field_count++, Nan::New(field.name).ToLocalChecked());
+        }
+    }
+    Nan::Set(columns, Nan::New("fields").ToLocalChecked(), field_names);
+
+    set_string_column(columns, "names", "name_offsets", names);
+    Nan::Set(columns, Nan::New("flags").ToLocalChecked(), new_typed_array<v8::Uint8Array>(flags));
+
+    if (fields & FIELD_DISPLAY_NAME)
+        set_string_column(columns, "display_names", "display_name_offsets", display_names);
+    if (fields & FIELD_CONTENT_TYPE)
+        set_string_table(columns, "content_types", "content_type_index", content_types);
+    if (fields & FIELD_FILESYSTEM)
+        set_string_table(columns, "filesystems", "filesystem_index", filesystems);
+    if (fields & FIELD_SIZE)
+        Nan::Set(columns, Nan::New("size").ToLocalChecked(), new_typed_array<v8::Float64Array>(size));
+    if (fields & FIELD_MTIME)
+        Nan::Set(columns, Nan::New("mtime").ToLocalChecked(), new_typed_array<v8::Float64Array>(mtime));
+    if (fields & FIELD_ATIME)
+        Nan::Set(columns, Nan::New("atime").ToLocalChecked(), new_typed_array<v8::Float64Array>(atime));
+    if (fields & FIELD_CTIME)
+        Nan::Set(columns, Nan::New("ctime").ToLocalChecked(), new_typed_array<v8::Float64Array>(ctime));
+
+    return columns;
+
+}
+
+// Reads options.format, returns true for 'columns'
+static bool get_columns_option(v8::Local<v8::Value> options) {
+    if (!options->IsObject()) {
+        return false;
+    }
+    v8::Local<v8::Value> value = Nan::Get(options.As<v8::Object>(), Nan::New("format").ToLocalChecked()).ToLocalChecked();
+    if (!value->IsString()) {
+        return false;
+    }
+    Nan::Utf8String format(value);
+    return strcmp(*format, "columns") == 0;
+}
+
+class ListFilesWorker : public Nan::AsyncWorker {
+public:
+    ListFilesWorker(Nan::Callback *callback, const std::string &source, guint32 fields = LS_FIELDS, bool columns = false)
+        : Nan::AsyncWorker(callback), source(source), fields(fields), columns(columns) {}
+
+    ~ListFilesWorker() {}
+
+    void Execute() {
+        GFile* src = new_file_for(source.c_str());
+
+        GError* error = NULL;
+        GFileEnumerator* enumerator = g_file_enumerate_children(src,
+                                                                fields_to_attributes(fields).c_str(),
+                                                                G_FILE_QUERY_INFO_NONE,
+                                                                NULL,
+                                                                &error);
+
+        if (enumerator == NULL) {
+            if (error != NULL) {
+                SetErrorMessage(error->message);
+                g_error_free(error);
+                g_object_unref(src);
+                return;
+            } else {
+                SetErrorMessage("Unknown error occurred");
+                g_object_unref(src);
+                return;
+            }
+        }
+
+        // every entry shares the same parent so only resolve it once
+        char* location = g_file_get_path(src);
+        src_location = location ? location : source;
+        g_free(location);
+
+        GFileInfo* file_info = NULL;
+        while ((file_info = g_file_enumerator_next_file(enumerator, NULL, &error)) != NULL) {
+            FileResult fileResult;
+            get_child_result(src, src_location, file_info, fields, fileResult);
+            results.push_back(fileResult);
+            g_object_unref(file_info);
+        }
+
+        if (error != NULL) {
+            SetErrorMessage(error->message);
+            g_error_free(error);
+        }
+
+        g_file_enumerator_close(enumerator, NULL, NULL);
+        g_object_unref(enumerator);
+        g_object_unref(src);
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> result;
+        if (columns) {
+            result = file_batch_to_columns(results, src_location, fields);
+        } else {
+            result = file_batch_to_array(results);
+        }
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result };
+        callback->Call(2, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+    std::string source;
+    std::string src_location;
+    guint32 fields;
+    bool columns;
+    std::vector<FileResult> results;
+};
+
+// Parallel directory scanner. Every thread owns a deque of pending directories,
+// it takes work from the back of its own deque and steals from the front of the
+// others when it runs dry. Directories found by a thread stay private until it
+// publishes them, which happens when other threads are idle or the private list
+// grows, and flush is called right before so callers can deliver what they
+// buffered for those directories first. With one thread everything runs on the
+// calling thread in listing order.
+class TreeScanner {
+public:
+
+    struct Dir {
+        GFile* file;
+        std::string location;
+        int depth;
+    };
+
+    // Called for every entry on a scanner thread, returns true to descend into it
+    std::function<bool(int thread, const Dir& dir, GFileInfo* file_info)> visit;
+    // Called on a scanner thread before its directories become visible to the other threads
+    std::function<void(int thread)> flush;
+    // Called for directories that can not be enumerated, the error is freed afterwards
+    std::function<void(int thread, const Dir& dir, GError* error)> error;
+    // Paused between entries when set
+    Operation* operation = NULL;
+
+    TreeScanner(int threads, const std::string& attributes, GFileQueryInfoFlags flags, GCancellable* cancellable)
+        : threads(std::max(1, threads)), attributes(attributes), flags(flags), cancellable(cancellable), queues(this->threads) {}
+
+    static int max_threads() {
+        return std::max(1u, std::thread::hardware_concurrency()) * 4;
+    }
+
+    // Scans the tree below root, returns when every directory has been visited
+    void run(GFile* root, const std::string& location) {
+
+        pending = 1;
+        queues[0].dirs.push_back({ G_FILE(g_object_ref(root)), location, 0 });
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < threads; i++) {
+            pool.emplace_back(&TreeScanner::work, this, i);
+        }
+        work(0);
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+
+    }
+
+private:
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Dir> dirs;
+    };
+
+    void work(int index) {
+
+        std::vector<Dir> found;
+        Dir dir;
+        while (true) {
+
+            if (!take(index, found, dir)) {
+                std::unique_lock<std::mutex> lock(idle_mutex);
+                if (pending == 0) {
+                    break;
+                }
+                idle++;
+                idle_cv.wait_for(lock, std::chrono::milliseconds(2));
+                idle--;
+                continue;
+            }
+
+            scan(index, dir, found);
+            g_object_unref(dir.file);
+
+            if (!found.empty() && (idle > 0 || found.size() > 256)) {
+                publish(index, found);
+            }
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                idle_cv.notify_all();
+            }
+        }
+
+    }
+
+    bool take(int index, std::vector<Dir>& found, Dir& dir) {
+
+        if (!found.empty()) {
+            dir = std::move(found.back());
+            found.pop_back();
+            return true;
+        }
+
+        for (int i = 0; i < threads; i++) {
+            Queue& queue = queues[(index + i) % threads];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.dirs.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                dir = std::move(queue.dirs.back());
+                queue.dirs.pop_back();
+            } else {
+                dir = std::move(queue.dirs.front());
+                queue.dirs.pop_front();
+            }
+            return true;
+        }
+        return false;
+
+    }
+
+    void publish(int index, std::vector<Dir>& found) {
+
+        if (flush) {
+            flush(index);
+        }
+        {
+            Queue& queue = queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.dirs.insert(queue.dirs.end(), found.begin(), found.end());
+        }
+        found.clear();
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_cv.notify_all();
+
+    }
+
+    void scan(int index, const Dir& dir, std::vector<Dir>& found) {
+
+        if (g_cancellable_is_cancelled(cancellable)) {
+            return;
+        }
+
+        GError* enum_error = NULL;
+        GFileEnumerator* enumerator = g_file_enumerate_children(dir.file, attributes.c_str(), flags, cancellable, &enum_error);
+        if (enumerator == NULL) {
+            if (error && !g_error_matches(enum_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                error(index, dir, enum_error);
+            }
+            g_error_free(enum_error);
+            return;
+        }
+
+        std::vector<Dir> children;
+        GFileInfo* file_info = NULL;
+        while ((file_info = g_file_enumerator_next_file(enumerator, cancellable, &enum_error)) != NULL) {
+            if (operation != NULL && !operation->checkpoint()) {
+                g_object_unref(file_info);
+                break;
+            }
+            if (visit(index, dir, file_info)) {
+                GFile* child = g_file_get_child(dir.file, g_file_info_get_name(file_info));
+                children.push_back({ child, file_location(child), dir.depth + 1 });
+            }
+            g_object_unref(file_info);
+        }
+        if (enum_error != NULL) {
+            g_error_free(enum_error);
+        }
+        g_file_enumerator_close(enumerator, NULL, NULL);
+        g_object_unref(enumerator);
+
+        // pushed in reverse so they come off the back in listing order
+        pending += children.size();
+        found.insert(found.end(), children.rbegin(), children.rend());
+
+    }
+
+    int threads;
+    std::string attributes;
+    GFileQueryInfoFlags flags;
+    GCancellable* cancellable;
+    std::vector<Queue> queues;
+    std::atomic<size_t> pending{0};
+    std::atomic<int> idle{0};
+    std::mutex idle_mutex;
+    std::condition_variable idle_cv;
+};
+
+// Base for workers that deliver file entries in batches, callback(err, files, done).
+// Returning false from the callback cancels the worker.
+// The worker is registered as an operation of the given type for as long as it runs.
+class FileStreamWorker : public Nan::AsyncProgressQueueWorker<FileBatch> {
+public:
+    FileStreamWorker(Nan::Callback *callback, const char* type, const std::string& source)
+        : Nan::AsyncProgressQueueWorker<FileBatch>(callback) {
+        operation = OperationRegistry::create(type, source);
+        cancellable = operation->cancellable;
+    }
+
+    ~FileStreamWorker() {
+        OperationRegistry::remove(operation->id);
+    }
+
+    Operation& get_operation() {
+        return *operation;
+    }
+
+    void HandleProgressCallback(const FileBatch* batch, size_t count) {
+        Nan::HandleScope scope;
+
+        for (size_t i = 0; i < count; i++) {
+            if (g_cancellable_is_cancelled(cancellable)) {
+                return;
+            }
+            operation->items += batch[i].size();
+            v8::Local<v8::Value> argv[] = { Nan::Null(), file_batch_to_array(batch[i]), Nan::False() };
+            v8::Local<v8::Value> res = callback->Call(3, argv);
+            if (!res.IsEmpty() && res->IsFalse()) {
+                operation->cancel();
+            }
+        }
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(true);
+        v8::Local<v8::Value> argv[] = { Nan::Null(), Nan::New<v8::Array>(), Nan::True() };
+        callback->Call(3, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(false);
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+protected:
+
+    // Records error unless it is a cancellation, frees it
+    void set_error(GError* error) {
+        if (error != NULL) {
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                SetErrorMessage(error->message);
+            }
+            g_error_free(error);
+        }
+    }
+
+    std::shared_ptr<Operation> operation;
+    GCancellable* cancellable = NULL;
+};
+
+// Streams a directory listing in chunks using g_file_enumerator_next_files_async.
+// The async calls are dispatched on a private GMainContext owned by the worker
+// thread so they do not depend on a glib main loop running on the JS thread.
+// The callback is called as callback(err, files, done) once per chunk and a
+// final time with done = true. Returning false from the callback cancels the
+// listing before the next chunk is requested.
+class ListStreamWorker : public FileStreamWorker {
+public:
+    ListStreamWorker(Nan::Callback *callback, const std::string &source, int batch_size, guint32 fields = LS_FIELDS)
+        : FileStreamWorker(callback, "list", source), source(source), batch_size(batch_size), fields(fields) {}
+
+    void Execute(const ExecutionProgress& progress) {
+
+        GMainContext* context = g_main_context_new();
+        g_main_context_push_thread_default(context);
+        loop = g_main_loop_new(context, FALSE);
+        this->progress = &progress;
+
+        src = new_file_for(source.c_str());
+        char* location = g_file_get_path(src);
+        src_location = location ? location : source;
+        g_free(location);
+
+        attributes = fields_to_attributes(fields);
+        g_file_enumerate_children_async(src,
+                                        attributes.c_str(),
+                                        G_FILE_QUERY_INFO_NONE,
+                                        G_PRIORITY_DEFAULT,
+                                        cancellable,
+                                        on_enumerate_ready,
+                                        this);
+
+        g_main_loop_run(loop);
+
+        if (enumerator != NULL) {
+            g_file_enumerator_close(enumerator, NULL, NULL);
+            g_object_unref(enumerator);
+        }
+
+        g_object_unref(src);
+        g_main_loop_unref(loop);
+        g_main_context_pop_thread_default(context);
+        g_main_context_unref(context);
+        this->progress = NULL;
+
+    }
+
+private:
+
+    static void on_enumerate_ready(GObject* source_object, GAsyncResult* res, gpointer user_data) {
+        ListStreamWorker* worker = static_cast<ListStreamWorker*>(user_data);
+
+        GError* error = NULL;
+        worker->enumerator = g_file_enumerate_children_finish(G_FILE(source_object), res, &error);
+        if (worker->enumerator == NULL) {
+            worker->finish(error);
+            return;
+        }
+        worker->next_chunk();
+    }
+
+    static void on_next_files(GObject* source_object, GAsyncResult* res, gpointer user_data) {
+        ListStreamWorker* worker = static_cast<ListStreamWorker*>(user_data);
+
+        GError* error = NULL;
+        GList* files = g_file_enumerator_next_files_finish(G_FILE_ENUMERATOR(source_object), res, &error);
+        if (files == NULL) {
+            worker->finish(error);
+            return;
+        }
+
+        FileBatch batch;
+        for (GList* iter = files; iter != NULL; iter = iter->next) {
+            FileResult fileResult;
+            get_child_result(worker->src, worker->src_location, G_FILE_INFO(iter->data), worker->fields, fileResult);
+            batch.push_back(fileResult);
+        }
+        g_list_free_full(files, g_object_unref);
+
+        worker->progress->Send(&batch, 1);
+        worker->next_chunk();
+    }
+
+    void next_chunk() {
+        // honour pause and cancellation between chunks
+        if (!operation->checkpoint() || g_cancellable_is_cancelled(cancellable)) {
+            finish(NULL);
+            return;
+        }
+        g_file_enumerator_next_files_async(enumerator,
+                                           batch_size,
+                                           G_PRIORITY_DEFAULT,
+                                           cancellable,
+                                           on_next_files,
+                                           this);
+    }
+
+    void finish(GError* error) {
+        set_error(error);
+        g_main_loop_quit(loop);
+    }
+
+    std::string source;
+    std::string src_location;
+    std::string attributes;
+    int batch_size;
+    guint32 fields;
+    GFile* src = NULL;
+    GFileEnumerator* enumerator = NULL;
+    GMainLoop* loop = NULL;
+    const ExecutionProgress* progress = NULL;
+};
+
+// How walk treats symbolic links
+enum SymlinkPolicy {
+    SYMLINKS_SKIP,      // leave them out of the results
+    SYMLINKS_LIST,      // report them but never descend into them
+    SYMLINKS_FOLLOW     // descend into linked directories, each directory is visited once
+};
+
+struct WalkOptions {
+    int max_depth = -1;             // -1 for no limit, 0 for the root only
+    SymlinkPolicy symlinks = SYMLINKS_LIST;
+    bool show_hidden = true;
+    bool include_root = true;
+    int batch_size = 1024;
+    int threads = 1;
+    guint32 fields = WALK_FIELDS;
+};
+
+// Recursive directory traversal, parents are always delivered before their children.
+// Directories below the root that cannot be read are skipped. With options.threads > 1
+// the tree is scanned by a TreeScanner pool and batches of different threads interleave.
+class WalkWorker : public FileStreamWorker {
+public:
+    WalkWorker(Nan::Callback *callback, const std::string &root, const WalkOptions &options)
+        : FileStreamWorker(callback, "walk", root), root(root), options(options) {}
+
+    void Execute(const ExecutionProgress& progress) {
+
+        GFileQueryInfoFlags flags = options.symlinks == SYMLINKS_FOLLOW ? G_FILE_QUERY_INFO_NONE : G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS;
+
+        // the traversal itself needs the type, link and hidden flags whatever fields were asked for
+        std::string attributes = fields_to_attributes(options.fields);
+        attributes += "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN;
+        if (options.symlinks == SYMLINKS_FOLLOW) {
+            attributes += "," G_FILE_ATTRIBUTE_UNIX_DEVICE "," G_FILE_ATTRIBUTE_UNIX_INODE;
+        }
+
+        GError* error = NULL;
+        GFile* root_file = new_file_for(root.c_str());
+        GFileInfo* root_info = g_file_query_info(root_file, attributes.c_str(), flags, cancellable, &error);
+        if (root_info == NULL) {
+            set_error(error);
+            g_object_unref(root_file);
+            return;
+        }
+
+        std::string root_location = file_location(root_file);
+
+        // the root goes out on its own so it is ahead of anything a scanner thread sends
+        if (options.include_root) {
+            FileBatch batch(1);
+            get_file_result(root_info, options.fields, batch[0]);
+            batch[0].href = root_location;
+            GFile* parent = g_file_get_parent(root_file);
+            if (parent != NULL) {
+                batch[0].location = file_location(parent);
+                g_object_unref(parent);
+            }
+            progress.Send(&batch, 1);
+        }
+
+        bool descend = g_file_info_get_file_type(root_info) == G_FILE_TYPE_DIRECTORY && options.max_depth != 0 && visit(root_info);
+        g_object_unref(root_info);
+
+        if (descend) {
+
+            std::vector<FileBatch> batches(options.threads);
+            TreeScanner scanner(options.threads, attributes, flags, cancellable);
+            scanner.operation = operation.get();
+
+            scanner.visit = [&](int thread, const TreeScanner::Dir& dir, GFileInfo* file_info) {
+
+                bool is_symlink = g_file_info_get_is_symlink(file_info);
+                if ((is_symlink && options.symlinks == SYMLINKS_SKIP) ||
+                    (!options.show_hidden && g_file_info_get_is_hidden(file_info))) {
+                    return false;
+                }
+
+                FileBatch& batch = batches[thread];
+                batch.emplace_back();
+                get_child_result(dir.file, dir.location, file_info, options.fields, batch.back());
+                batch.back().depth = dir.depth + 1;
+                if ((int)batch.size() >= options.batch_size) {
+                    send(progress, batch);
+                }
+
+                return g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY &&
+                       (!is_symlink || options.symlinks == SYMLINKS_FOLLOW) &&
+                       (options.max_depth < 0 || dir.depth + 1 < options.max_depth) &&
+                       visit(file_info);
+            };
+            scanner.flush = [&](int thread) {
+                send(progress, batches[thread]);
+            };
+            scanner.error = [&](int thread, const TreeScanner::Dir& dir, GError* dir_error) {
+                // the root has to be readable, anything below it is skipped
+                if (dir.depth == 0) {
+                    SetErrorMessage(dir_error->message);
+                }
+            };
+
+            scanner.run(root_file, root_location);
+
+            for (FileBatch& batch : batches) {
+                send(progress, batch);
+            }
+        }
+
+        g_object_unref(root_file);
+
+    }
+
+private:
+
+    void send(const ExecutionProgress& progress, FileBatch& batch) {
+        if (!batch.empty() && !g_cancellable_is_cancelled(cancellable)) {
+            progress.Send(&batch, 1);
+        }
+        batch.clear();
+    }
+
+    // Returns false for a directory that was already visited through another link
+    bool visit(GFileInfo* file_info) {
+        if (options.symlinks != SYMLINKS_FOLLOW) {
+            return true;
+        }
+        std::pair<guint32, guint64> id(g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_UNIX_DEVICE),
+                                       g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_UNIX_INODE));
+        std::lock_guard<std::mutex> lock(visited_mutex);
+        return visited.insert(id).second;
+    }
+
+    std::string root;
+    WalkOptions options;
+    std::mutex visited_mutex;
+    std::set<std::pair<guint32, guint64>> visited;
+};
+
+// Case folded and normalized copy of a UTF-8 string
+static std::string utf8_casefold(const char* str) {
+    char* folded = g_utf8_casefold(str, -1);
+    char* normalized = g_utf8_normalize(folded, -1, G_NORMALIZE_DEFAULT);
+    std::string result = normalized ? normalized : folded;
+    g_free(normalized);
+    g_free(folded);
+    return result;
+}
+
+// Precompiled file name matcher for find. Matching only reads the compiled state
+// so one matcher is shared by all scanner threads.
+class NameMatcher {
+public:
+
+    enum Mode { SUBSTRING, GLOB, REGEX };
+
+    NameMatcher(const std::string& query, Mode mode, bool case_sensitive)
+        : mode(mode), case_sensitive(case_sensitive) {
+
+        if (mode == REGEX) {
+            GError* error = NULL;
+            GRegexCompileFlags flags = (GRegexCompileFlags)(G_REGEX_OPTIMIZE | (case_sensitive ? 0 : G_REGEX_CASELESS));
+            regex = g_regex_new(query.c_str(), flags, (GRegexMatchFlags)0, &error);
+            if (regex == NULL) {
+                error_message = error->message;
+                g_error_free(error);
+            }
+            return;
+        }
+
+        pattern = case_sensitive ? query : utf8_casefold(query.c_str());
+        literal = mode == SUBSTRING ? utf8_casefold(query.c_str()) : "";
+        ascii = is_ascii(pattern.c_str());
+        if (mode == GLOB) {
+            spec = g_pattern_spec_new(pattern.c_str());
+        }
+
+    }
+
+    ~NameMatcher() {
+        if (regex != NULL) {
+            g_regex_unref(regex);
+        }
+        if (spec != NULL) {
+            g_pattern_spec_free(spec);
+        }
+    }
+
+    bool valid() const {
+        return error_message.empty();
+    }
+
+    const std::string& error() const {
+        return error_message;
+    }
+
+    // Case folded text every match contains, empty for glob and regex
+    const std::string& get_literal() const {
+        return literal;
+    }
+
+    bool match(const char* name) const {
+
+        if (mode == REGEX) {
+            return g_regex_match(regex, name, (GRegexMatchFlags)0, NULL);
+        }
+
+        if (mode == SUBSTRING && (case_sensitive || (ascii && is_ascii(name)))) {
+            // plain ASCII names are compared in place without folding a copy
+            size_t length = strlen(name);
+            bool (*equal)(char, char) = case_sensitive ? +[](char a, char b) { return a == b; }
+                                                       : +[](char a, char b) { return g_ascii_tolower(a) == b; };
+            return std::search(name, name + length, pattern.begin(), pattern.end(), equal) != name + length;
+        }
+
+        std::string folded = case_sensitive ? std::string(name) : utf8_casefold(name);
+        if (mode == GLOB) {
+            return g_pattern_spec_match_string(spec, folded.c_str());
+        }
+        return folded.find(pattern) != std::string::npos;
+
+    }
+
+private:
+
+    static bool is_ascii(const char* str) {
+        for (; *str; str++) {
+            if ((unsigned char)*str >= 0x80) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Mode mode;
+    bool case_sensitive;
+    bool ascii = false;
+    std::string pattern;
+    std::string literal;
+    std::string error_message;
+    GRegex* regex = NULL;
+    GPatternSpec* spec = NULL;
+};
+
+static void put_varint(std::string& out, guint64 value) {
+    while (value >= 0x80) {
+        out.push_back((char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+// Reads a varint that must end before end, false when it runs past it or overflows
+static bool get_varint(const guint8*& p, const guint8* end, guint64& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        guint8 byte = *p++;
+        value |= (guint64)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Distinct trigrams of a case folded name, three bytes packed into an integer
+static void name_trigrams(const std::string& folded, std::vector<guint32>& trigrams) {
+    trigrams.clear();
+    for (size_t i = 0; i + 3 <= folded.size(); i++) {
+        trigrams.push_back(((guint32)(guint8)folded[i] << 16) | ((guint32)(guint8)folded[i + 1] << 8) | (guint8)folded[i + 2]);
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+}
+
+// Path of full relative to root, empty for root itself
+static std::string relative_path(const std::string& root, const std::string& full) {
+    if (full.size() <= root.size()) {
+        return "";
+    }
+    return full.substr(root.back() == '/' ? root.size() : root.size() + 1);
+}
+
+// True when location is root or lies below it
+static bool path_is_under(const std::string& root, const std::string& location) {
+    if (location.compare(0, root.size(), root) != 0) {
+        return false;
+    }
+    return location.size() == root.size() || root.back() == '/' || location[root.size()] == '/';
+}
+
+// Filename index of a tree. The file holds the sorted paths relative to root,
+// front coded in blocks of 16 so any entry decodes from its block start, and a
+// trigram table of the case folded names with delta coded posting lists of
+// entry ids. It is memory mapped and never modified in place. Changes reported
+// by watch go to an in-memory delta, added paths and tombstones for removed
+// ones, which compact merges into a new file once it grows. Folders nobody
+// watches are only current as of the build time kept in the header.
+//
+// Layout: IndexHeader, root, block offsets (guint32), paths, trigram table, postings.
+// Path entry: varint shared prefix length, varint suffix length, flags byte, suffix.
+class FileIndex {
+public:
+
+    struct Entry {
+        std::string path;
+        bool is_dir;
+        bool operator<(const Entry& other) const { return path < other.path; }
+    };
+
+    // Called for every hit with the path relative to root, returns false to stop
+    typedef std::function<bool(const std::string& path, bool is_dir)> HitCallback;
+
+    FileIndex(const std::string& root, const std::string& file) : root(root), file(file) {}
+
+    ~FileIndex() {
+        if (mapped != NULL) {
+            g_mapped_file_unref(mapped);
+        }
+    }
+
+    // Index file used for root when none is given, under the user cache dir
+    static std::string default_file(const std::string& root) {
+        char* digest = g_compute_checksum_for_string(G_CHECKSUM_MD5, root.c_str(), -1);
+        char* file = g_build_filename(g_get_user_cache_dir(), "sfm", "index", digest, NULL);
+        std::string result = std::string(file) + ".idx";
+        g_free(file);
+        g_free(digest);
+        return result;
+    }
+
+    // Writes sorted, unique entries scanned at built (unix seconds) to file, replacing it atomically
+    static bool write(const std::string& file, const std::string& root, const std::vector<Entry>& entries, gint64 built, std::string& error) {
+
+        std::string blocks, paths, table, postings;
+
+        std::unordered_map<guint32, std::vector<guint32>> ids;
+        std::vector<guint32> trigrams;
+        const std::string* previous = NULL;
+        for (guint32 id = 0; id < entries.size(); id++) {
+
+            const std::string& path = entries[id].path;
+            size_t shared = 0;
+            if (id % BLOCK_SIZE == 0) {
+                guint32 offset = paths.size();
+                blocks.append((const char*)&offset, sizeof(offset));
+            } else {
+                while (shared < path.size() && shared < previous->size() && path[shared] == (*previous)[shared]) {
+                    shared++;
+                }
+            }
+            put_varint(paths, shared);
+            put_varint(paths, path.size() - shared);
+            paths.push_back(entries[id].is_dir ? FLAG_DIR : 0);
+            paths.append(path, shared, std::string::npos);
+            previous = &path;
+
+            size_t slash = path.rfind('/');
+            name_trigrams(utf8_casefold(path.c_str() + (slash == std::string::npos ? 0 : slash + 1)), trigrams);
+            for (guint32 trigram : trigrams) {
+                ids[trigram].push_back(id);
+            }
+        }
+
+        std::vector<guint32> keys;
+        keys.reserve(ids.size());
+        for (const auto& it : ids) {
+            keys.push_back(it.first);
+        }
+        std::sort(keys.begin(), keys.end());
+        for (guint32 trigram : keys) {
+            const std::vector<guint32>& list = ids[trigram];
+            TrigramEntry entry = { trigram, (guint32)list.size(), (guint64)postings.size() };
+            table.append((const char*)&entry, sizeof(entry));
+            guint32 last = 0;
+            for (guint32 id : list) {
+                put_varint(postings, id - last);
+                last = id;
+            }
+        }
+
+        // the block offsets and the trigram table are read in place, keep them aligned
+        std::string root_data = root;
+        root_data.resize((root.size() + 7) & ~(size_t)7, '\0');
+        paths.resize((paths.size() + 7) & ~(size_t)7, '\0');
+
+        IndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.count = entries.size();
+        header.trigram_count = keys.size();
+        header.root_offset = sizeof(header);
+        header.root_length = root.size();
+        header.blocks_offset = header.root_offset + root_data.size();
+        blocks.resize((blocks.size() + 7) & ~(size_t)7, '\0');
+        header.paths_offset = header.blocks_offset + blocks.size();
+        header.paths_length = paths.size();
+        header.trigrams_offset = header.paths_offset + paths.size();
+        header.postings_offset = header.trigrams_offset + table.size();
+        header.postings_length = postings.size();
+        header.built = built;
+
+        std::string data((const char*)&header, sizeof(header));
+        data += root_data;
+        data += blocks;
+        data += paths;
+        data += table;
+        data += postings;
+
+        char* dir = g_path_get_dirname(file.c_str());
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+
+        GError* write_error = NULL;
+        if (!g_file_set_contents(file.c_str(), data.data(), data.size(), &write_error)) {
+            error = write_error->message;
+            g_error_free(write_error);
+            return false;
+        }
+        return true;
+
+    }
+
+    // Maps the index file, fails when it is missing, damaged or for another root
+    bool open(std::string& error) {
+        GMappedFile* file_map = load(error);
+        if (file_map == NULL) {
+            return false;
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        install(file_map);
+        return true;
+    }
+
+    const std::string& get_root() const {
+        return root;
+    }
+
+    const std::string& get_file() const {
+        return file;
+    }
+
+    // Queues a change, safe to call from any thread and never waits for a search
+    void changed(const std::string& path, bool exists, bool is_dir) {
+        std::lock_guard<std::mutex> lock(events_mutex);
+        events.push_back({ relative_path(root, path), exists, is_dir });
+    }
+
+    void stats(guint32& count, size_t& added_count, size_t& removed_count) {
+        apply_events();
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        count = header ? header->count : 0;
+        added_count = added.size();
+        removed_count = removed.size();
+    }
+
+    // Unix time the tree was scanned, saving the delta keeps it
+    gint64 get_built() {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return header ? (gint64)header->built : 0;
+    }
+
+    // True when the delta is big enough to be worth merging into the file
+    bool needs_compact() {
+        apply_events();
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return added.size() + removed.size() > std::max<size_t>(4096, (header ? header->count : 0) / 8);
+    }
+
+    // Merges the delta into a new index file. Searches keep using the old file
+    // meanwhile and changes applied during the merge stay in the delta.
+    bool compact(std::string& error) {
+
+        std::lock_guard<std::mutex> compact_lock(compact_mutex);
+        apply_events();
+
+        std::vector<Entry> entries;
+        std::map<std::string, bool> merged_added;
+        std::set<std::string> merged_removed;
+        gint64 built = 0;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            built = header ? (gint64)header->built : 0;
+            merged_added = added;
+            merged_removed = removed;
+            entries.reserve((header ? header->count : 0) + added.size());
+            for_each_entry([&](guint32 id, const std::string& path, bool is_dir) {
+                if (!is_removed(path) && added.find(path) == added.end()) {
+                    entries.push_back({ path, is_dir });
+                }
+                return true;
+            });
+            for (const auto& it : added) {
+                entries.push_back({ it.first, it.second });
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+
+        if (!write(file, root, entries, built, error)) {
+            return false;
+        }
+        GMappedFile* file_map = load(error);
+        if (file_map == NULL) {
+            return false;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        install(file_map);
+        for (const auto& it : merged_added) {
+            auto current = added.find(it.first);
+            if (current != added.end() && current->second == it.second) {
+                added.erase(current);
+            }
+        }
+        for (const std::string& path : merged_removed) {
+            removed.erase(path);
+        }
+        return true;
+
+    }
+
+    // Finds names below prefix (relative to root, empty for all) that match
+    void search(const std::string& prefix, const NameMatcher& matcher, bool show_hidden, const HitCallback& hit) {
+
+        apply_events();
+        std::shared_lock<std::shared_mutex> lock(mutex);
+
+        auto check = [&](const std::string& path, bool is_dir) {
+            if (!prefix.empty() && (path.size() <= prefix.size() || path.compare(0, prefix.size(), prefix) != 0 || path[prefix.size()] != '/')) {
+                return true;
+            }
+            if (!show_hidden && is_hidden(path, prefix.empty() ? 0 : prefix.size() + 1)) {
+                return true;
+            }
+            size_t slash = path.rfind('/');
+            if (!matcher.match(path.c_str() + (slash == std::string::npos ? 0 : slash + 1))) {
+                return true;
+            }
+            return hit(path, is_dir);
+        };
+
+        bool go_on = true;
+        std::vector<guint32> candidates;
+        if (header != NULL && lookup(matcher.get_literal(), candidates)) {
+            std::string path;
+            bool is_dir = false;
+            for (guint32 id : candidates) {
+                if (!decode(id, path, is_dir)) {
+                    continue;
+                }
+                if (!is_removed(path) && added.find(path) == added.end() && !(go_on = check(path, is_dir))) {
+                    break;
+                }
+            }
+        } else if (header != NULL) {
+            for_each_entry([&](guint32 id, const std::string& path, bool is_dir) {
+                if (is_removed(path) || added.find(path) != added.end()) {
+                    return true;
+                }
+                return go_on = check(path, is_dir);
+            });
+        }
+
+        for (auto it = added.lower_bound(prefix); go_on && it != added.end(); ++it) {
+            if (!prefix.empty() && it->first.compare(0, prefix.size(), prefix) != 0) {
+                break;
+            }
+            go_on = check(it->first, it->second);
+        }
+
+    }
+
+private:
+
+    static constexpr const char INDEX_MAGIC[8] = { 'S', 'F', 'M', 'I', 'D', 'X', '0', '2' };
+    static const guint32 BLOCK_SIZE = 16;
+    static const guint8 FLAG_DIR = 1;
+
+    struct IndexHeader {
+        char magic[8];
+        guint32 count;
+        guint32 trigram_count;
+        guint64 root_offset;
+        guint64 root_length;
+        guint64 blocks_offset;
+        guint64 paths_offset;
+        guint64 paths_length;
+        guint64 trigrams_offset;
+        guint64 postings_offset;
+        guint64 postings_length;
+        guint64 built;
+    };
+
+    struct TrigramEntry {
+        guint32 trigram;
+        guint32 count;
+        guint64 offset;
+    };
+
+    struct Event {
+        std::string path;
+        bool exists;
+        bool is_dir;
+    };
+
+    GMappedFile* load(std::string& error) const {
+
+        GError* map_error = NULL;
+        GMappedFile* file_map = g_mapped_file_new(file.c_str(), FALSE, &map_error);
+        if (file_map == NULL) {
+            error = map_error->message;
+            g_error_free(map_error);
+            return NULL;
+        }
+
+        const guint8* data = (const guint8*)g_mapped_file_get_contents(file_map);
+        gsize length = g_mapped_file_get_length(file_map);
+        if (!is_valid(data, length)) {
+            g_mapped_file_unref(file_map);
+            error = "Not a valid index for " + root;
+            return NULL;
+        }
+        return file_map;
+
+    }
+
+    // True when offset and size lie within length, without overflowing
+    static bool fits(guint64 offset, guint64 size, guint64 length) {
+        return offset <= length && size <= length - offset;
+    }
+
+    // Checks the header, that the sections are in order and inside the file, and
+    // that the block and posting offsets stay inside their section. Entries and
+    // postings are still bounded while decoding, this only keeps the offsets sane.
+    bool is_valid(const guint8* data, gsize length) const {
+
+        if (data == NULL || length < sizeof(IndexHeader)) {
+            return false;
+        }
+        const IndexHeader* h = (const IndexHeader*)data;
+        if (memcmp(h->magic, INDEX_MAGIC, sizeof(h->magic)) != 0) {
+            return false;
+        }
+
+        guint64 block_bytes = ((guint64)h->count + BLOCK_SIZE - 1) / BLOCK_SIZE * sizeof(guint32);
+        guint64 table_bytes = (guint64)h->trigram_count * sizeof(TrigramEntry);
+        if (h->root_offset < sizeof(IndexHeader) || !fits(h->root_offset, h->root_length, length) ||
+            h->blocks_offset < h->root_offset + h->root_length || !fits(h->blocks_offset, block_bytes, length) ||
+            h->paths_offset < h->blocks_offset + block_bytes || !fits(h->paths_offset, h->paths_length, length) ||
+            h->trigrams_offset < h->paths_offset + h->paths_length || !fits(h->trigrams_offset, table_bytes, length) ||
+            h->postings_offset < h->trigrams_offset + table_bytes || !fits(h->postings_offset, h->postings_length, length) ||
+            h->postings_offset + h->postings_length != length) {
+            return false;
+        }
+        if (h->blocks_offset % alignof(guint32) != 0 || h->trigrams_offset % alignof(TrigramEntry) != 0) {
+            return false;
+        }
+        if (h->root_length != root.size() || memcmp(data + h->root_offset, root.data(), root.size()) != 0) {
+            return false;
+        }
+
+        const guint32* block = (const guint32*)(data + h->blocks_offset);
+        for (guint64 i = 0; i < block_bytes / sizeof(guint32); i++) {
+            if (block[i] >= h->paths_length || (i > 0 && block[i] <= block[i - 1])) {
+                return false;
+            }
+        }
+        const TrigramEntry* entry = (const TrigramEntry*)(data + h->trigrams_offset);
+        for (guint32 i = 0; i < h->trigram_count; i++) {
+            if (entry[i].offset > h->postings_length || entry[i].count > h->count ||
+                (i > 0 && (entry[i].trigram <= entry[i - 1].trigram || entry[i].offset < entry[i - 1].offset))) {
+                return false;
+            }
+        }
+        return true;
+
+    }
+
+    // Switches to a file checked by load, called with the lock held
+    void install(GMappedFile* file_map) {
+        if (mapped != NULL) {
+            g_mapped_file_unref(mapped);
+        }
+        const guint8* data = (const guint8*)g_mapped_file_get_contents(file_map);
+        mapped = file_map;
+        header = (const IndexHeader*)data;
+        blocks = (const guint32*)(data + header->blocks_offset);
+        paths = data + header->paths_offset;
+        trigrams = (const TrigramEntry*)(data + header->trigrams_offset);
+        postings = data + header->postings_offset;
+    }
+
+    void apply_events() {
+
+        std::vector<Event> pending;
+        {
+            std::lock_guard<std::mutex> lock(events_mutex);
+            pending.swap(events);
+        }
+        if (pending.empty()) {
+            return;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        for (const Event& event : pending) {
+            if (event.path.empty()) {
+                continue;
+            }
+            if (event.exists) {
+                // a tombstone stays so the old children of a recreated directory stay hidden
+                added[event.path] = event.is_dir;
+            } else {
+                removed.insert(event.path);
+                auto it = added.find(event.path);
+                if (it != added.end()) {
+                    it = added.erase(it);
+                }
+                std::string children = event.path + "/";
+                it = added.lower_bound(children);
+                while (it != added.end() && it->first.compare(0, children.size(), children) == 0) {
+                    it = added.erase(it);
+                }
+            }
+        }
+
+    }
+
+    // True when path or one of its parents was removed
+    bool is_removed(const std::string& path) const {
+        if (removed.empty()) {
+            return false;
+        }
+        if (removed.count(path)) {
+            return true;
+        }
+        for (size_t slash = path.find('/'); slash != std::string::npos; slash = path.find('/', slash + 1)) {
+            if (removed.count(path.substr(0, slash))) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // True when a component of path from start on begins with a dot
+    static bool is_hidden(const std::string& path, size_t start) {
+        if (start < path.size() && path[start] == '.') {
+            return true;
+        }
+        return path.find("/.", start) != std::string::npos;
+    }
+
+    // Intersects the posting lists of the trigrams of literal, false when it has none
+    bool lookup(const std::string& literal, std::vector<guint32>& ids) const {
+
+        std::vector<guint32> keys;
+        name_trigrams(literal, keys);
+        if (keys.empty()) {
+            return false;
+        }
+
+        std::vector<const TrigramEntry*> lists;
+        for (guint32 key : keys) {
+            const TrigramEntry* end = trigrams + header->trigram_count;
+            const TrigramEntry* entry = std::lower_bound(trigrams, end, key,
+                                                         [](const TrigramEntry& e, guint32 k) { return e.trigram < k; });
+            if (entry == end || entry->trigram != key) {
+                ids.clear();
+                return true;
+            }
+            lists.push_back(entry);
+        }
+        std::sort(lists.begin(), lists.end(), [](const TrigramEntry* a, const TrigramEntry* b) { return a->count < b->count; });
+
+        // start from the shortest list, every other list only narrows it down
+        ids.clear();
+        std::vector<guint32> list, narrowed;
+        for (size_t i = 0; i < lists.size(); i++) {
+            // a list ends where the next trigram's starts
+            bool is_last = (guint32)(lists[i] - trigrams) + 1 == header->trigram_count;
+            const guint8* p = postings + lists[i]->offset;
+            const guint8* end = postings + (is_last ? header->postings_length : (lists[i] + 1)->offset);
+            list.resize(lists[i]->count);
+            guint64 id = 0;
+            for (guint32 n = 0; n < lists[i]->count; n++) {
+                guint64 delta;
+                if (!get_varint(p, end, delta) || delta > header->count || (id += delta) >= header->count) {
+                    // a damaged list, let the caller scan every entry instead
+                    ids.clear();
+                    return false;
+                }
+                list[n] = (guint32)id;
+            }
+            if (i == 0) {
+                ids.swap(list);
+            } else {
+                narrowed.clear();
+                std::set_intersection(ids.begin(), ids.end(), list.begin(), list.end(), std::back_inserter(narrowed));
+                ids.swap(narrowed);
+            }
+            if (ids.empty()) {
+                break;
+            }
+        }
+        return true;
+
+    }
+
+    // End of block in paths, where the next block starts
+    const guint8* block_end(guint32 block) const {
+        guint32 last = (header->count - 1) / BLOCK_SIZE;
+        return paths + (block == last ? header->paths_length : blocks[block + 1]);
+    }
+
+    // False when the entry is damaged
+    bool decode(guint32 id, std::string& path, bool& is_dir) const {
+        guint32 block = id / BLOCK_SIZE;
+        const guint8* p = paths + blocks[block];
+        const guint8* end = block_end(block);
+        path.clear();
+        for (guint32 i = id - id % BLOCK_SIZE; i <= id; i++) {
+            if (!next_entry(p, end, path, is_dir)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Decodes the entry at p on top of the previous path, false when it does not fit before end
+    static bool next_entry(const guint8*& p, const guint8* end, std::string& path, bool& is_dir) {
+        guint64 shared, suffix;
+        if (!get_varint(p, end, shared) || !get_varint(p, end, suffix) || shared > path.size() ||
+            p >= end || suffix > (guint64)(end - p - 1)) {
+            return false;
+        }
+        is_dir = (*p++ & FLAG_DIR) != 0;
+        path.resize(shared);
+        path.append((const char*)p, suffix);
+        p += suffix;
+        return true;
+    }
+
+    // Decodes all entries in order, stops when fn returns false or at a damaged entry
+    void for_each_entry(const std::function<bool(guint32, const std::string&, bool)>& fn) const {
+        if (header == NULL) {
+            return;
+        }
+        const guint8* p = paths;
+        const guint8* end = paths;
+        std::string path;
+        bool is_dir = false;
+        for (guint32 id = 0; id < header->count; id++) {
+            if (id % BLOCK_SIZE == 0) {
+                p = paths + blocks[id / BLOCK_SIZE];
+                end = block_end(id / BLOCK_SIZE);
+                path.clear();
+            }
+            if (!next_entry(p, end, path, is_dir) || !fn(id, path, is_dir)) {
+                return;
+            }
+        }
+    }
+
+    std::string root;
+    std::string file;
+
+    std::shared_mutex mutex;
+    GMappedFile* mapped = NULL;
+    const IndexHeader* header = NULL;
+    const guint32* blocks = NULL;
+    const guint8* paths = NULL;
+    const TrigramEntry* trigrams = NULL;
+    const guint8* postings = NULL;
+    std::map<std::string, bool> added;
+    std::set<std::string> removed;
+
+    std::mutex events_mutex;
+    std::vector<Event> events;
+    std::mutex compact_mutex;
+};
+
+// Open indexes, shared by all isolates
+class IndexRegistry {
+public:
+
+    static std::shared_ptr<FileIndex> find(const std::string& location) {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<FileIndex> best;
+        for (const auto& index : indexes) {
+            if (path_is_under(index->get_root(), location) &&
+                (!best || index->get_root().size() > best->get_root().size())) {
+                best = index;
+            }
+        }
+        return best;
+    }
+
+    static void add(const std::shared_ptr<FileIndex>& index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        indexes.erase(std::remove_if(indexes.begin(), indexes.end(),
+                                     [&](const std::shared_ptr<FileIndex>& i) { return i->get_root() == index->get_root(); }),
+                      indexes.end());
+        indexes.push_back(index);
+    }
+
+    static bool remove(const std::string& root) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t size = indexes.size();
+        indexes.erase(std::remove_if(indexes.begin(), indexes.end(),
+                                     [&](const std::shared_ptr<FileIndex>& i) { return i->get_root() == root; }),
+                      indexes.end());
+        return indexes.size() != size;
+    }
+
+    static bool empty() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return indexes.empty();
+    }
+
+private:
+    static std::mutex mutex;
+    static std::vector<std::shared_ptr<FileIndex>> indexes;
+};
+
+std::mutex IndexRegistry::mutex;
+std::vector<std::shared_ptr<FileIndex>> IndexRegistry::indexes;
+
+// Builds the index of a tree on the parallel scanner, callback(err, {root, file, count, built})
+class IndexBuildWorker : public Nan::AsyncWorker {
+public:
+    IndexBuildWorker(Nan::Callback *callback, const std::string &source, const std::string &file, int threads)
+        : Nan::AsyncWorker(callback), source(source), file(file), threads(threads) {}
+
+    void Execute() {
+
+        GFile* src = new_file_for(source.c_str());
+        root = file_location(src);
+        if (file.empty()) {
+            file = FileIndex::default_file(root);
+        }
+
+        built = g_get_real_time() / G_USEC_PER_SEC;
+        std::vector<std::vector<FileIndex::Entry>> found(threads);
+        std::string error;
+        TreeScanner scanner(threads, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL);
+        scanner.visit = [&](int thread, const TreeScanner::Dir& dir, GFileInfo* file_info) {
+            bool is_dir = g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY;
+            std::string path = relative_path(root, dir.location);
+            if (!path.empty()) {
+                path += "/";
+            }
+            path += g_file_info_get_name(file_info);
+            found[thread].push_back({ std::move(path), is_dir });
+            return is_dir;
+        };
+        scanner.error = [&](int thread, const TreeScanner::Dir& dir, GError* dir_error) {
+            if (dir.depth == 0) {
+                error = dir_error->message;
+            }
+        };
+        scanner.run(src, root);
+        g_object_unref(src);
+
+        if (!error.empty()) {
+            SetErrorMessage(error.c_str());
+            return;
+        }
+
+        std::vector<FileIndex::Entry> entries;
+        for (auto& list : found) {
+            entries.insert(entries.end(), std::make_move_iterator(list.begin()), std::make_move_iterator(list.end()));
+            list.clear();
+        }
+        std::sort(entries.begin(), entries.end());
+        count = entries.size();
+
+        std::shared_ptr<FileIndex> index = std::make_shared<FileIndex>(root, file);
+        if (!FileIndex::write(file, root, entries, built, error) || !index->open(error)) {
+            SetErrorMessage(error.c_str());
+            return;
+        }
+        IndexRegistry::add(index);
+
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Object> result = Nan::New<v8::Object>();
+        Nan::Set(result, key(KEY_ROOT), Nan::New(root).ToLocalChecked());
+        Nan::Set(result, key(KEY_FILE), Nan::New(file).ToLocalChecked());
+        Nan::Set(result, key(KEY_COUNT), Nan::New<v8::Number>(count));
+        Nan::Set(result, key(KEY_BUILT), Nan::New<v8::Number>(built));
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result };
+        callback->Call(2, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+    std::string source;
+    std::string root;
+    std::string file;
+    int threads;
+    size_t count = 0;
+    gint64 built = 0;
+};
+
+// Merges the changes of an index into its file, callback(err)
+class IndexCompactWorker : public Nan::AsyncWorker {
+public:
+    IndexCompactWorker(Nan::Callback *callback, const std::shared_ptr<FileIndex> &index)
+        : Nan::AsyncWorker(callback), index(index) {}
+
+    void Execute() {
+        std::string error;
+        if (!index->compact(error)) {
+            SetErrorMessage(error.c_str());
+        }
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+    std::shared_ptr<FileIndex> index;
+};
+
+// Fields returned by find when no options are given, content_type is guessed from the name
+static const guint32 FIND_FIELDS = FIELD_NAME | FIELD_DISPLAY_NAME | FIELD_HREF | FIELD_LOCATION |
+                                   FIELD_IS_DIR | FIELD_IS_HIDDEN | FIELD_IS_SYMLINK | FIELD_CONTENT_TYPE |
+                                   FIELD_SIZE | FIELD_MTIME;
+
+struct FindOptions {
+    NameMatcher::Mode mode = NameMatcher::SUBSTRING;
+    bool case_sensitive = false;
+    bool show_hidden = false;
+    gint64 min_size = -1;
+    gint64 max_size = -1;
+    gint64 mtime_from = -1;
+    gint64 mtime_to = -1;
+    GFileType type = G_FILE_TYPE_UNKNOWN;   // unknown matches files and directories
+    int max_results = 10000;
+    int batch_size = 256;
+    int threads = 4;
+    bool use_index = true;
+    gint64 max_index_age = -1;              // seconds, an older index is walked past, -1 for any
+    guint32 fields = FIND_FIELDS;
+};
+
+// Fields find can fill from a file index without looking at the file
+static const guint32 INDEX_FIELDS = FIELD_NAME | FIELD_DISPLAY_NAME | FIELD_HREF | FIELD_LOCATION |
+                                    FIELD_IS_DIR | FIELD_IS_HIDDEN | FIELD_CONTENT_TYPE;
+
+// Parallel search below a location. Hits are delivered in batches, a thread sends what
+// it has after batch_size hits or 100ms so the first results show up quickly. The walk
+// stops after max_results hits or when the callback returns false. Locations covered
+// by an open file index are answered from the index instead of walking the tree, the
+// final callback then gets {root, built} of the index so results can be told apart.
+class FindWorker : public FileStreamWorker {
+public:
+    FindWorker(Nan::Callback *callback, const std::string &query, const std::string &location, const FindOptions &options)
+        : FileStreamWorker(callback, "find", location), matcher(query, options.mode, options.case_sensitive), location(location), options(options) {
+        // the scan also stops on its own at max_results without cancelling the delivery
+        stop = g_cancellable_new();
+        handler = g_cancellable_connect(cancellable, G_CALLBACK(on_cancelled), stop, NULL);
+    }
+
+    ~FindWorker() {
+        g_cancellable_disconnect(cancellable, handler);
+        g_object_unref(stop);
+    }
+
+    const NameMatcher& get_matcher() const {
+        return matcher;
+    }
+
+    void Execute(const ExecutionProgress& progress) {
+
+        // content type sniffing would read every file, it is guessed from the name of hits instead
+        std::string attributes = fields_to_attributes(options.fields & ~FIELD_CONTENT_TYPE);
+        attributes += "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN;
+        if (options.min_size >= 0 || options.max_size >= 0) {
+            attributes += "," G_FILE_ATTRIBUTE_STANDARD_SIZE;
+        }
+        if (options.mtime_from >= 0 || options.mtime_to >= 0) {
+            attributes += "," G_FILE_ATTRIBUTE_TIME_MODIFIED;
+        }
+
+        struct ThreadHits {
+            FileBatch batch;
+            gint64 last_send = 0;
+        };
+        GFile* src = new_file_for(location.c_str());
+        std::string src_location = file_location(src);
+
+        std::shared_ptr<FileIndex> index = options.use_index ? IndexRegistry::find(src_location) : nullptr;
+        gint64 built = index ? index->get_built() : 0;
+        if (index && (options.max_index_age < 0 || g_get_real_time() / G_USEC_PER_SEC - built <= options.max_index_age)) {
+            index_root = index->get_root();
+            index_built = built;
+            g_object_unref(src);
+            search_index(progress, *index, src_location, attributes);
+            return;
+        }
+
+        std::vector<ThreadHits> hits(options.threads);
+        TreeScanner scanner(options.threads, attributes, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, stop);
+        scanner.operation = operation.get();
+
+        scanner.visit = [&](int thread, const TreeScanner::Dir& dir, GFileInfo* file_info) {
+
+            if (!options.show_hidden && g_file_info_get_is_hidden(file_info)) {
+                return false;
+            }
+
+            GFileType type = g_file_info_get_file_type(file_info);
+            bool is_dir = type == G_FILE_TYPE_DIRECTORY;
+            if (filter(file_info, type) && matcher.match(g_file_info_get_name(file_info))) {
+                if (++found > options.max_results) {
+                    g_cancellable_cancel(stop);
+                    return false;
+                }
+                ThreadHits& t = hits[thread];
+                t.batch.emplace_back();
+                FileResult& fileResult = t.batch.back();
+                get_child_result(dir.file, dir.location, file_info, options.fields, fileResult);
+                if (options.fields & FIELD_CONTENT_TYPE) {
+                    fileResult.fields |= FIELD_CONTENT_TYPE;
+                    fileResult.mimetype = guess_content_type(fileResult.name, is_dir);
+                }
+            }
+
+            ThreadHits& t = hits[thread];
+            gint64 now = g_get_monotonic_time();
+            if (!t.batch.empty() && ((int)t.batch.size() >= options.batch_size || now - t.last_send > 100 * 1000)) {
+                send(progress, t.batch);
+                t.last_send = now;
+            }
+
+            return is_dir;
+        };
+        scanner.error = [&](int thread, const TreeScanner::Dir& dir, GError* dir_error) {
+            if (dir.depth == 0) {
+                SetErrorMessage(dir_error->message);
+            }
+        };
+
+        scanner.run(src, src_location);
+        g_object_unref(src);
+
+        for (ThreadHits& t : hits) {
+            send(progress, t.batch);
+        }
+
+    }
+
+    // Hits of an index are only looked up on disk when filters or fields need more than the path
+    void search_index(const ExecutionProgress& progress, FileIndex& index, const std::string& src_location, const std::string& attributes) {
+
+        bool need_info = options.min_size >= 0 || options.max_size >= 0 || options.mtime_from >= 0 || options.mtime_to >= 0 ||
+                         (options.fields & ~INDEX_FIELDS) != 0;
+        bool filtered = options.min_size >= 0 || options.max_size >= 0 || options.mtime_from >= 0 || options.mtime_to >= 0;
+        const std::string& root = index.get_root();
+
+        // Only names are matched while the index is locked, files are looked at once it is
+        // released. Hits that a size or time filter may drop are all collected.
+        std::vector<std::pair<std::string, bool>> hits;
+        index.search(relative_path(root, src_location), matcher, options.show_hidden, [&](const std::string& path, bool is_dir) {
+
+            if (g_cancellable_is_cancelled(stop)) {
+                return false;
+            }
+            if ((options.type == G_FILE_TYPE_REGULAR && is_dir) || (options.type == G_FILE_TYPE_DIRECTORY && !is_dir)) {
+                return true;
+            }
+            hits.emplace_back(path, is_dir);
+            return filtered || (int)hits.size() < options.max_results;
+        });
+
+        FileBatch batch;
+        for (const auto& hit : hits) {
+
+            if (g_cancellable_is_cancelled(stop)) {
+                break;
+            }
+
+            bool is_dir = hit.second;
+            std::string href = root.back() == '/' ? root + hit.first : root + "/" + hit.first;
+            size_t slash = href.rfind('/');
+
+            FileResult fileResult;
+            if (need_info) {
+                GFile* file = new_file_for(href.c_str());
+                GFileInfo* file_info = g_file_query_info(file, attributes.c_str(), G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, stop, NULL);
+                g_object_unref(file);
+                // gone since it was indexed
+                if (file_info == NULL) {
+                    continue;
+                }
+                bool keep = filter(file_info, g_file_info_get_file_type(file_info));
+                if (keep) {
+                    get_file_result(file_info, options.fields, fileResult);
+                }
+                g_object_unref(file_info);
+                if (!keep) {
+                    continue;
+                }
+            } else {
+                fileResult.fields = options.fields;
+                fileResult.name = href.substr(slash + 1);
+                fileResult.display_name = fileResult.name;
+                fileResult.is_directory = is_dir;
+                fileResult.is_hidden = fileResult.name[0] == '.';
+            }
+            fileResult.href = href;
+            fileResult.location = slash == 0 ? "/" : href.substr(0, slash);
+            if (options.fields & FIELD_CONTENT_TYPE) {
+                fileResult.fields |= FIELD_CONTENT_TYPE;
+                fileResult.mimetype = guess_content_type(fileResult.name, is_dir);
+            }
+
+            batch.push_back(std::move(fileResult));
+            if (++found >= options.max_results) {
+                break;
+            }
+            if ((int)batch.size() >= options.batch_size) {
+                send(progress, batch);
+            }
+        }
+        send(progress, batch);
+
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(true);
+        v8::Local<v8::Value> index = Nan::Null();
+        if (!index_root.empty()) {
+            v8::Local<v8::Object> object = Nan::New<v8::Object>();
+            Nan::Set(object, key(KEY_ROOT), Nan::New(index_root).ToLocalChecked());
+            Nan::Set(object, key(KEY_BUILT), Nan::New<v8::Number>(index_built));
+            index = object;
+        }
+        v8::Local<v8::Value> argv[] = { Nan::Null(), Nan::New<v8::Array>(), Nan::True(), index };
+        callback->Call(4, argv);
+    }
+
+private:
+
+    static void on_cancelled(GCancellable* cancellable, gpointer stop) {
+        g_cancellable_cancel(G_CANCELLABLE(stop));
+    }
+
+    static std::string guess_content_type(const std::string& name, bool is_dir) {
+        if (is_dir) {
+            return "inode/directory";
+        }
+        char* content_type = g_content_type_guess(name.c_str(), NULL, 0, NULL);
+        std::string result = content_type ? content_type : "";
+        g_free(content_type);
+        return result;
+    }
+
+    bool filter(GFileInfo* file_info, GFileType type) const {
+
+        if (options.type != G_FILE_TYPE_UNKNOWN && type != options.type) {
+            return false;
+        }
+        if (options.min_size >= 0 || options.max_size >= 0) {
+            // sizes only apply to files
+            if (type == G_FILE_TYPE_DIRECTORY) {
+                return false;
+            }
+            gint64 size = g_file_info_get_size(file_info);
+            if ((options.min_size >= 0 && size < options.min_size) || (options.max_size >= 0 && size > options.max_size)) {
+                return false;
+            }
+        }
+        if (options.mtime_from >= 0 || options.mtime_to >= 0) {
+            gint64 mtime = (gint64)g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+            if ((options.mtime_from >= 0 && mtime < options.mtime_from) || (options.mtime_to >= 0 && mtime > options.mtime_to)) {
+                return false;
+            }
+        }
+        return true;
+
+    }
+
+    void send(const ExecutionProgress& progress, FileBatch& batch) {
+        if (!batch.empty() && !g_cancellable_is_cancelled(cancellable)) {
+            progress.Send(&batch, 1);
+        }
+        batch.clear();
+    }
+
+    NameMatcher matcher;
+    std::string location;
+    FindOptions options;
+    std::string index_root;
+    gint64 index_built = 0;
+    std::atomic<int> found{0};
+    GCancellable* stop = NULL;
+    gulong handler = 0;
+};
+
+// Totals of count
+struct CountResult {
+    guint64 files = 0;
+    guint64 folders = 0;
+};
+
+// Counts the entries below path, only its immediate children unless recursive.
+// Returns false and sets error when path can not be enumerated.
+static bool count_tree(const std::string& path, bool recursive, int threads, GCancellable* cancellable, CountResult& result, std::string& error) {
+
+    struct ThreadCount {
+        CountResult count;
+        char padding[64];   // keep the counters of different threads off the same cache line
+    };
+    std::vector<ThreadCount> counts(std::max(1, threads));
+
+    GFile* src = new_file_for(path.c_str());
+    TreeScanner scanner(threads, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                        G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable);
+
+    scanner.visit = [&](int thread, const TreeScanner::Dir& dir, GFileInfo* file_info) {
+        if (g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY) {
+            counts[thread].count.folders++;
+            return recursive;
+        }
+        counts[thread].count.files++;
+        return false;
+    };
+    scanner.error = [&](int thread, const TreeScanner::Dir& dir, GError* dir_error) {
+        if (dir.depth == 0) {
+            error = dir_error->message;
+        }
+    };
+
+    scanner.run(src, path);
+    g_object_unref(src);
+
+    for (const ThreadCount& count : counts) {
+        result.files += count.count.files;
+        result.folders += count.count.folders;
+    }
+    return error.empty();
+
+}
+
+static v8::Local<v8::Object> count_result_to_object(const CountResult& result) {
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("files").ToLocalChecked(), Nan::New<v8::Number>(result.files));
+    Nan::Set(obj, Nan::New("folders").ToLocalChecked(), Nan::New<v8::Number>(result.folders));
+    Nan::Set(obj, Nan::New("total").ToLocalChecked(), Nan::New<v8::Number>(result.files + result.folders));
+    return obj;
+}
+
+class CountWorker : public Nan::AsyncWorker {
+public:
+    CountWorker(Nan::Callback *callback, const std::string &source, bool recursive, int threads)
+        : Nan::AsyncWorker(callback), source(source), recursive(recursive), threads(threads) {}
+
+    void Execute() {
+        std::string error;
+        if (!count_tree(source, recursive, threads, NULL, result, error)) {
+            SetErrorMessage(error.c_str());
+        }
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), count_result_to_object(result) };
+        callback->Call(2, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+    std::string source;
+    bool recursive;
+    int threads;
+    CountResult result;
+};
+
+// Totals of du. size is the apparent size of everything but directories,
+// allocated the space taken on disk including directories.
+struct DuResult {
+    guint64 size = 0;
+    guint64 allocated = 0;
+    guint64 files = 0;
+    guint64 folders = 0;
+    bool cached = false;
+};
+
+struct DuOptions {
+    bool one_file_system = false;
+    bool cache = true;
+    int threads = 4;
+};
+
+// Results of du for the last few roots. Events of the directories watched with watch()
+// drop the entries above them right away, volume monitor events do not. Changes in
+// folders nobody watches are caught by the modification times of the directories in
+// the tree, which are only compared again once an entry is DU_CACHE_RECHECK old, until
+// then a hit costs a stat of the root.
+class DuCache {
+public:
+
+    struct Entry {
+        std::string key;
+        std::string root;
+        DuResult result;
+        std::vector<std::pair<std::string, guint64>> dirs;
+        gint64 checked = 0;     // monotonic time the directory mtimes were last compared
+    };
+
+    static DuCache& get() {
+        static DuCache cache;
+        return cache;
+    }
+
+    static std::string key_for(const std::string& location, const DuOptions& options) {
+        return location + (options.one_file_system ? "\n1" : "\n0");
+    }
+
+    bool find(const std::string& key, Entry& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it == index.end()) {
+            return false;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        entry = *it->second;
+        return true;
+    }
+
+    void put(Entry&& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(entry.key);
+        if (it != index.end()) {
+            entries.erase(it->second);
+            index.erase(it);
+        }
+        entries.push_front(std::move(entry));
+        index[entries.front().key] = entries.begin();
+        while (entries.size() > MAX_ENTRIES) {
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+
+    void remove(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            entries.erase(it->second);
+            index.erase(it);
+        }
+    }
+
+    // Drops the entries of every root above location, called for file monitor events
+    void changed(const std::string& location) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (path_is_under(it->root, location)) {
+                index.erase(it->key);
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+private:
+    static const size_t MAX_ENTRIES = 32;
+    std::mutex mutex;
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+};
+
+// Modification time of a directory in microseconds
+static guint64 dir_mtime(GFileInfo* file_info) {
+    return g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+           g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+}
+
+// Time after which a cached du compares the mtimes of all its directories again
+static const gint64 DU_CACHE_RECHECK = 30 * G_USEC_PER_SEC;
+
+// True when every directory of a cached tree still has the recorded mtime. Within
+// DU_CACHE_RECHECK of the last full check only the root is compared, deeper changes
+// in watched folders have dropped the entry already, see DuCache::changed.
+static bool du_cache_valid(DuCache::Entry& entry, GCancellable* cancellable) {
+    gint64 now = g_get_monotonic_time();
+    bool recheck = now - entry.checked >= DU_CACHE_RECHECK;
+    for (const auto& dir : entry.dirs) {
+        GFile* file = new_file_for(dir.first.c_str());
+        GFileInfo* file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                                 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable, NULL);
+        g_object_unref(file);
+        if (file_info == NULL) {
+            return false;
+        }
+        bool same = dir_mtime(file_info) == dir.second;
+        g_object_unref(file_info);
+        if (!same) {
+            return false;
+        }
+        // the root comes first
+        if (!recheck) {
+            return true;
+        }
+    }
+    entry.checked = now;
+    return true;
+}
+
+// Recursive size of path. Hard linked files are counted once by (device, inode).
+// progress is called from scanner threads with the running totals about every 100ms.
+// Returns false and sets error when path can not be read.
+static bool du_tree(const std::string& path, const DuOptions& options, GCancellable* cancellable,
+                    const std::function<void(const DuResult&)>& progress, DuResult& result, std::string& error) {
+
+    static const char* attributes = G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE ","
+                                    G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE ","
+                                    G_FILE_ATTRIBUTE_UNIX_DEVICE "," G_FILE_ATTRIBUTE_UNIX_INODE "," G_FILE_ATTRIBUTE_UNIX_NLINK ","
+                                    G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC;
+
+    GFile* src = new_file_for(path.c_str());
+    std::string location = file_location(src);
+    std::string key = DuCache::key_for(location, options);
+
+    DuCache::Entry cached;
+    if (options.cache && DuCache::get().find(key, cached)) {
+        gint64 checked = cached.checked;
+        if (du_cache_valid(cached, cancellable)) {
+            g_object_unref(src);
+            result = cached.result;
+            result.cached = true;
+            if (cached.checked != checked) {
+                DuCache::get().put(std::move(cached));
+            }
+            return true;
+        }
+        DuCache::get().remove(key);
+    }
+
+    GError* query_error = NULL;
+    GFileInfo* root_info = g_file_query_info(src, attributes, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable, &query_error);
+    if (root_info == NULL) {
+        error = query_error->message;
+        g_error_free(query_error);
+        g_object_unref(src);
+        return false;
+    }
+
+    guint32 root_device = g_file_info_get_attribute_uint32(root_info, G_FILE_ATTRIBUTE_UNIX_DEVICE);
+    bool is_dir = g_file_info_get_file_type(root_info) == G_FILE_TYPE_DIRECTORY;
+    if (!is_dir) {
+        result.size = g_file_info_get_size(root_info);
+        result.allocated = g_file_info_get_attribute_uint64(root_info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
+        result.files = 1;
+        g_object_unref(root_info);
+        g_object_unref(src);
+        return true;
+    }
+
+    struct ThreadTotals {
+        std::atomic<guint64> size{0};
+        std::atomic<guint64> allocated{0};
+        std::atomic<guint64> files{0};
+        std::atomic<guint64> folders{0};
+        std::vector<std::pair<std::string, guint64>> dirs;
+        char padding[64];
+    };
+    int threads = std::max(1, options.threads);
+    std::vector<ThreadTotals> totals(threads);
+    totals[0].allocated += g_file_info_get_attribute_uint64(root_info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE);
+    totals[0].dirs.emplace_back(location, dir_mtime(root_info));
+    g_object_unref(root_info);
+
+    std::mutex inodes_mutex;
+    std::set<std::pair<guint32, guint64>> inodes;
+
+    auto sum = [&]() {
+        DuResult sum;
+        for (const ThreadTotals& t : totals) {
+            sum.size += t.size.load(std::memory_order_relaxed);
+            sum.allocated += t.allocated.load(std::memory_order_relaxed);
+            sum.files += t.files.load(std::memory_order_relaxed);
+            sum.folders += t.folders.load(std::memory_order_relaxed);
+        }
+        return sum;
+    };
+
+    std::atomic<gint64> last_progress{g_get_monotonic_time()};
+
+    TreeScanner scanner(threads, attributes, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, cancellable);
+    scanner.visit = [&](int thread, const TreeScanner::Dir& dir, GFileInfo* file_info) {
+
+        ThreadTotals& t = totals[thread];
+        bool descend = false;
+
+        if (g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY) {
+            t.folders.fetch_add(1, std::memory_order_relaxed);
+            t.allocated.fetch_add(g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE), std::memory_order_relaxed);
+            descend = !options.one_file_system ||
+                      g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_UNIX_DEVICE) == root_device;
+            if (descend) {
+                GFile* child = g_file_get_child(dir.file, g_file_info_get_name(file_info));
+                t.dirs.emplace_back(file_location(child), dir_mtime(file_info));
+                g_object_unref(child);
+            }
+        } else {
+            bool counted = false;
+            if (g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_UNIX_NLINK) > 1) {
+                std::pair<guint32, guint64> id(g_file_info_get_attribute_uint32(file_info, G_FILE_ATTRIBUTE_UNIX_DEVICE),
+                                               g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_UNIX_INODE));
+                std::lock_guard<std::mutex> lock(inodes_mutex);
+                counted = !inodes.insert(id).second;
+            }
+            t.files.fetch_add(1, std::memory_order_relaxed);
+            if (!counted) {
+                t.size.fetch_add(g_file_info_get_size(file_info), std::memory_order_relaxed);
+                t.allocated.fetch_add(g_file_info_get_attribute_uint64(file_info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE), std::memory_order_relaxed);
+            }
+        }
+
+        if (progress) {
+            gint64 now = g_get_monotonic_time();
+            gint64 last = last_progress.load(std::memory_order_relaxed);
+            if (now - last > 100 * 1000 && last_progress.compare_exchange_strong(last, now)) {
+                progress(sum());
+            }
+        }
+
+        return descend;
+    };
+    scanner.error = [&](int thread, const TreeScanner::Dir& dir, GError* dir_error) {
+        if (dir.depth == 0) {
+            error = dir_error->message;
+        }
+    };
+
+    scanner.run(src, location);
+    g_object_unref(src);
+
+    if (!error.empty()) {
+        return false;
+    }
+    result = sum();
+
+    // a cancelled scan is incomplete and not worth keeping
+    if (options.cache && !g_cancellable_is_cancelled(cancellable)) {
+        DuCache::Entry entry;
+        entry.key = key;
+        entry.root = location;
+        entry.result = result;
+        entry.checked = g_get_monotonic_time();
+        for (ThreadTotals& t : totals) {
+            entry.dirs.insert(entry.dirs.end(), t.dirs.begin(), t.dirs.end());
+        }
+        DuCache::get().put(std::move(entry));
+    }
+    return true;
+
+}
+
+static v8::Local<v8::Object> du_result_to_object(const DuResult& result) {
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("size").ToLocalChecked(), Nan::New<v8::Number>(result.size));
+    Nan::Set(obj, Nan::New("allocated").ToLocalChecked(), Nan::New<v8::Number>(result.allocated));
+    Nan::Set(obj, Nan::New("files").ToLocalChecked(), Nan::New<v8::Number>(result.files));
+    Nan::Set(obj, Nan::New("folders").ToLocalChecked(), Nan::New<v8::Number>(result.folders));
+    Nan::Set(obj, Nan::New("cached").ToLocalChecked(), Nan::New<v8::Boolean>(result.cached));
+    return obj;
+}
+
+// Runs du on the libuv threadpool, callback(err, totals, done) gets running totals
+// while scanning and the final totals with done set. Returning false cancels.
+class DuWorker : public Nan::AsyncProgressQueueWorker<DuResult> {
+public:
+    DuWorker(Nan::Callback *callback, const std::string &source, const DuOptions &options)
+        : Nan::AsyncProgressQueueWorker<DuResult>(callback), source(source), options(options) {
+        cancellable = g_cancellable_new();
+    }
+
+    ~DuWorker() {
+        g_object_unref(cancellable);
+    }
+
+    void Execute(const ExecutionProgress& progress) {
+        std::string error;
+        auto send = [&](const DuResult& totals) {
+            progress.Send(&totals, 1);
+        };
+        if (!du_tree(source, options, cancellable, send, result, error)) {
+            SetErrorMessage(error.c_str());
+        }
+    }
+
+    void HandleProgressCallback(const DuResult* totals, size_t count) {
+        Nan::HandleScope scope;
+
+        // only the latest totals matter
+        if (count == 0 || g_cancellable_is_cancelled(cancellable)) {
+            return;
+        }
+        v8::Local<v8::Value> argv[] = { Nan::Null(), du_result_to_object(totals[count - 1]), Nan::False() };
+        v8::Local<v8::Value> res = callback->Call(3, argv);
+        if (!res.IsEmpty() && res->IsFalse()) {
+            g_cancellable_cancel(cancellable);
+        }
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), du_result_to_object(result), Nan::True() };
+        callback->Call(3, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+    std::string source;
+    DuOptions options;
+    DuResult result;
+    GCancellable* cancellable = NULL;
+};
+
+// Whether a copy may share extents with its source, see copy_file_fast
+enum ReflinkMode {
+    REFLINK_AUTO,       // clone when the filesystem can, copy otherwise
+    REFLINK_ALWAYS,     // fail unless the file can be cloned
+    REFLINK_NEVER       // always copy the data
+};
+
+static bool get_reflink_option(v8::Local<v8::Value> options, ReflinkMode& mode, std::string& error) {
+    std::string reflink = get_string_option(options, "reflink", "auto");
+    if (reflink == "auto") {
+        mode = REFLINK_AUTO;
+    } else if (reflink == "always") {
+        mode = REFLINK_ALWAYS;
+    } else if (reflink == "never") {
+        mode = REFLINK_NEVER;
+    } else {
+        error = "options.reflink must be 'auto', 'always' or 'never'";
+        return false;
+    }
+    return true;
+}
+
+// Bytes handed to the kernel per call so progress and cancellation stay responsive
+static const size_t KERNEL_COPY_CHUNK = 16 * 1024 * 1024;
+
+enum KernelCopyResult {
+    KERNEL_COPY_DONE,
+    KERNEL_COPY_FAILED,
+    KERNEL_COPY_UNSUPPORTED     // nothing was written, the caller should copy another way
+};
+
+static void set_errno_error(GError** error, int code, const char* what, const char* path) {
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(code), "%s %s: %s", what, path, g_strerror(code));
+}
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+// rename that fails with EEXIST instead of replacing destination. Filesystems without
+// RENAME_NOREPLACE get a plain rename after a check, which leaves a small race.
+static int rename_noreplace(const char* source, const char* destination) {
+#ifdef SYS_renameat2
+    if (syscall(SYS_renameat2, AT_FDCWD, source, AT_FDCWD, destination, RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+#endif
+    struct stat st;
+    if (lstat(destination, &st) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(source, destination);
+}
+
+// Creates an empty file next to destination to copy into, so an existing destination is
+// only replaced once the copy is complete, see commit_temp_file. temp is set to its path.
+static int open_temp_beside(const char* destination, std::string& temp, GError** error) {
+    char* dir = g_path_get_dirname(destination);
+    char* name = g_path_get_basename(destination);
+    std::string base = name;
+    if (base.size() > 200) {
+        base.resize(200);
+    }
+    std::string pattern = std::string(dir) + "/." + base + ".XXXXXX";
+    g_free(dir);
+    g_free(name);
+
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    int fd = g_mkstemp_full(path.data(), O_WRONLY | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        set_errno_error(error, errno, "Error opening file", destination);
+        return -1;
+    }
+    temp = path.data();
+    return fd;
+}
+
+// Renames a complete temporary file to destination, replacing it only when overwrite is
+// set. The temporary file is removed when that fails.
+static bool commit_temp_file(const std::string& temp, const char* destination, bool overwrite, GError** error) {
+    int res = overwrite ? rename(temp.c_str(), destination) : rename_noreplace(temp.c_str(), destination);
+    if (res != 0) {
+        set_errno_error(error, errno, "Error writing file", destination);
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Copies a regular local file with FICLONE, copy_file_range or sendfile so the data never
+// passes through user space. The copy is written to a temporary file that replaces the
+// destination when it is complete, like g_file_copy. Mode and times are copied as GIO
+// does by default, ownership too with G_FILE_COPY_ALL_METADATA when permitted.
+static KernelCopyResult kernel_copy(const char* source, const char* destination, GFileCopyFlags flags, ReflinkMode reflink,
+                                    GCancellable* cancellable, GFileProgressCallback progress, gpointer user_data, GError** error) {
+
+    // checked before opening, opening a FIFO or device for reading can block forever
+    bool nofollow = (flags & G_FILE_COPY_NOFOLLOW_SYMLINKS) != 0;
+    struct stat st;
+    if ((nofollow ? lstat(source, &st) : stat(source, &st)) != 0) {
+        set_errno_error(error, errno, "Error opening file", source);
+        return KERNEL_COPY_FAILED;
+    }
+    if (!S_ISREG(st.st_mode) || (flags & G_FILE_COPY_TARGET_DEFAULT_PERMS)) {
+        // links copied as links, special files and default permissions are left to GIO
+        return KERNEL_COPY_UNSUPPORTED;
+    }
+
+    struct stat dest_st;
+    if (lstat(destination, &dest_st) == 0) {
+        int code = 0;
+        if (!(flags & G_FILE_COPY_OVERWRITE)) {
+            code = EEXIST;
+        } else if (S_ISDIR(dest_st.st_mode)) {
+            code = EISDIR;
+        }
+        if (code != 0) {
+            set_errno_error(error, code, "Error opening file", destination);
+            return KERNEL_COPY_FAILED;
+        }
+        if (dest_st.st_dev == st.st_dev && dest_st.st_ino == st.st_ino) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Can not copy %s onto itself", source);
+            return KERNEL_COPY_FAILED;
+        }
+    }
+
+    // O_NONBLOCK in case source was swapped for a FIFO since the stat
+    int in = open(source, O_RDONLY | O_CLOEXEC | O_NONBLOCK | (nofollow ? O_NOFOLLOW : 0));
+    if (in < 0 && errno == ELOOP) {
+        return KERNEL_COPY_UNSUPPORTED;
+    }
+    if (in < 0) {
+        set_errno_error(error, errno, "Error opening file", source);
+        return KERNEL_COPY_FAILED;
+    }
+    struct stat in_st;
+    if (fstat(in, &in_st) != 0 || !S_ISREG(in_st.st_mode)) {
+        close(in);
+        return KERNEL_COPY_UNSUPPORTED;
+    }
+    st = in_st;
+
+    std::string temp;
+    int out = open_temp_beside(destination, temp, error);
+    if (out < 0) {
+        close(in);
+        return KERNEL_COPY_FAILED;
+    }
+
+    KernelCopyResult result = KERNEL_COPY_DONE;
+    goffset total = st.st_size;
+    goffset copied = 0;
+    bool cloned = false;
+
+#ifdef FICLONE
+    if (result == KERNEL_COPY_DONE && reflink != REFLINK_NEVER) {
+        cloned = ioctl(out, FICLONE, in) == 0;
+    }
+#endif
+    if (result == KERNEL_COPY_DONE && !cloned && reflink == REFLINK_ALWAYS) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Can not clone %s to %s", source, destination);
+        result = KERNEL_COPY_FAILED;
+    }
+
+    if (cloned) {
+        copied = total;
+    } else if (result == KERNEL_COPY_DONE) {
+
+        bool use_sendfile = false;
+        while (copied < total) {
+
+            if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+                result = KERNEL_COPY_FAILED;
+                break;
+            }
+
+            size_t chunk = (size_t)std::min<goffset>(total - copied, KERNEL_COPY_CHUNK);
+            ssize_t count = use_sendfile ? sendfile(out, in, NULL, chunk)
+                                         : copy_file_range(in, NULL, out, NULL, chunk, 0);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            if (count < 0 && copied == 0) {
+                // copy_file_range refuses some filesystem pairs, sendfile takes anything the
+                // kernel can read with splice, after that only user space copies are left
+                if (!use_sendfile && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP || errno == EBADF)) {
+                    use_sendfile = true;
+                    continue;
+                }
+                if (use_sendfile && (errno == EINVAL || errno == ENOSYS)) {
+                    result = KERNEL_COPY_UNSUPPORTED;
+                    break;
+                }
+            }
+            if (count < 0) {
+                set_errno_error(error, errno, "Error writing to file", destination);
+                result = KERNEL_COPY_FAILED;
+                break;
+            }
+            if (count == 0) {
+                // the source shrank while copying
+                break;
+            }
+
+            copied += count;
+            if (progress != NULL) {
+                progress(copied, total, user_data);
+            }
+
+        }
+    }
+
+    if (result == KERNEL_COPY_DONE) {
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        if ((flags & G_FILE_COPY_ALL_METADATA) && fchown(out, st.st_uid, st.st_gid) != 0) {
+            // only root may give files away, the copy keeps the current owner
+        }
+        futimens(out, times);
+        fchmod(out, st.st_mode & 07777);
+        if (cloned && progress != NULL) {
+            progress(copied, total, user_data);
+        }
+    }
+
+    close(in);
+    if (close(out) != 0 && result == KERNEL_COPY_DONE) {
+        set_errno_error(error, errno, "Error closing file", destination);
+        result = KERNEL_COPY_FAILED;
+    }
+    if (result == KERNEL_COPY_DONE) {
+        if (!commit_temp_file(temp, destination, (flags & G_FILE_COPY_OVERWRITE) != 0, error)) {
+            result = KERNEL_COPY_FAILED;
+        }
+    } else {
+        unlink(temp.c_str());
+    }
+    return result;
+
+}
+
+// g_file_copy with a kernel fast path for local regular files, see kernel_copy. Anything
+// else, and local files the kernel can not copy directly, goes through GIO streams.
+static gboolean copy_file_fast(GFile* src, GFile* dest, GFileCopyFlags flags, ReflinkMode reflink, GCancellable* cancellable,
+                               GFileProgressCallback progress, gpointer user_data, GError** error) {
+
+    char* source = g_file_get_path(src);
+    char* destination = g_file_get_path(dest);
+
+    KernelCopyResult result = KERNEL_COPY_UNSUPPORTED;
+    if (source != NULL && destination != NULL) {
+        result = kernel_copy(source, destination, flags, reflink, cancellable, progress, user_data, error);
+    } else if (reflink == REFLINK_ALWAYS) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Reflinks need local files");
+        result = KERNEL_COPY_FAILED;
+    }
+
+    g_free(source);
+    g_free(destination);
+
+    if (result == KERNEL_COPY_UNSUPPORTED) {
+        return g_file_copy(src, dest, flags, cancellable, progress, user_data, error);
+    }
+    return result == KERNEL_COPY_DONE;
+
+}
+
+// Files below this size are copied in one go even when the copy is resumable
+static const goffset RESUME_MIN_SIZE = 64 * 1024 * 1024;
+// Bytes copied between two checkpoints of a resumable copy
+static const goffset RESUME_CHECKPOINT_BYTES = 64 * 1024 * 1024;
+static const size_t RESUME_BUFFER_SIZE = 1024 * 1024;
+static const guint64 FNV1A_OFFSET = 0xcbf29ce484222325ULL;
+
+static guint64 fnv1a_update(guint64 hash, const guint8* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Checkpoint of a resumable copy, kept in a key file next to the partial file. chunks holds
+// the FNV-1a hash of every RESUME_CHECKPOINT_BYTES of the first offset bytes, the last one
+// of what there is of its chunk. source_mtime is in microseconds.
+struct ResumeJournal {
+    std::string source;
+    goffset source_size = -1;
+    guint64 source_mtime = 0;
+    goffset offset = 0;
+    std::vector<guint64> chunks;
+};
+
+// Adds data written at journal.offset to the chunk hashes
+static void resume_journal_add(ResumeJournal& journal, const guint8* data, size_t length) {
+    while (length > 0) {
+        goffset in_chunk = journal.offset % RESUME_CHECKPOINT_BYTES;
+        if (in_chunk == 0) {
+            journal.chunks.push_back(FNV1A_OFFSET);
+        }
+        size_t n = std::min<goffset>(length, RESUME_CHECKPOINT_BYTES - in_chunk);
+        journal.chunks.back() = fnv1a_update(journal.chunks.back(), data, n);
+        journal.offset += n;
+        data += n;
+        length -= n;
+    }
+}
+
+static bool load_resume_journal(GFile* file, ResumeJournal& journal, GCancellable* cancellable) {
+
+    char* contents = NULL;
+    gsize length = 0;
+    if (!g_file_load_contents(file, cancellable, &contents, &length, NULL, NULL)) {
+        return false;
+    }
+
+    GKeyFile* key_file = g_key_file_new();
+    bool loaded = g_key_file_load_from_data(key_file, contents, length, G_KEY_FILE_NONE, NULL);
+    for (const char* key : { "source", "source_size", "source_mtime", "offset", "chunks" }) {
+        loaded = loaded && g_key_file_has_key(key_file, "resume", key, NULL);
+    }
+    if (loaded) {
+        char* source = g_key_file_get_string(key_file, "resume", "source", NULL);
+        journal.source = source ? source : "";
+        g_free(source);
+        journal.source_size = g_key_file_get_int64(key_file, "resume", "source_size", NULL);
+        journal.source_mtime = g_key_file_get_uint64(key_file, "resume", "source_mtime", NULL);
+        journal.offset = g_key_file_get_int64(key_file, "resume", "offset", NULL);
+        gsize count = 0;
+        char** chunks = g_key_file_get_string_list(key_file, "resume", "chunks", &count, NULL);
+        for (gsize i = 0; i < count; i++) {
+            journal.chunks.push_back(g_ascii_strtoull(chunks[i], NULL, 16));
+        }
+        g_strfreev(chunks);
+        loaded = journal.offset >= 0 &&
+                 (guint64)journal.chunks.size() == ((guint64)journal.offset + RESUME_CHECKPOINT_BYTES - 1) / RESUME_CHECKPOINT_BYTES;
+    }
+
+    g_key_file_free(key_file);
+    g_free(contents);
+    return loaded;
+
+}
+
+// Written without the cancellable so a cancelled copy still records where it stopped
+static bool save_resume_journal(GFile* file, const ResumeJournal& journal, GError** error) {
+    GKeyFile* key_file = g_key_file_new();
+    g_key_file_set_string(key_file, "resume", "source", journal.source.c_str());
+    g_key_file_set_int64(key_file, "resume", "source_size", journal.source_size);
+    g_key_file_set_uint64(key_file, "resume", "source_mtime", journal.source_mtime);
+    g_key_file_set_int64(key_file, "resume", "offset", journal.offset);
+    std::vector<std::string> hex;
+    std::vector<const char*> chunks;
+    for (guint64 hash : journal.chunks) {
+        char buffer[17];
+        g_snprintf(buffer, sizeof(buffer), "%016" G_GINT64_MODIFIER "x", hash);
+        hex.push_back(buffer);
+    }
+    for (const std::string& chunk : hex) {
+        chunks.push_back(chunk.c_str());
+    }
+    g_key_file_set_string_list(key_file, "resume", "chunks", chunks.data(), chunks.size());
+    gsize length = 0;
+    char* data = g_key_file_to_data(key_file, &length, NULL);
+    bool saved = g_file_replace_contents(file, data, length, NULL, FALSE, G_FILE_CREATE_NONE, NULL, NULL, error);
+    g_free(data);
+    g_key_file_free(key_file);
+    return saved;
+}
+
+// Whether the bytes of part from start to end still hash to hash
+static bool verify_resume_chunk(GFileInputStream* in, goffset start, goffset end, guint64 hash, std::vector<guint8>& buffer,
+                                GCancellable* cancellable) {
+
+    if (!g_seekable_seek(G_SEEKABLE(in), start, G_SEEK_SET, cancellable, NULL)) {
+        return false;
+    }
+    guint64 actual = FNV1A_OFFSET;
+    goffset remaining = end - start;
+    while (remaining > 0) {
+        gssize n = g_input_stream_read(G_INPUT_STREAM(in), buffer.data(), std::min<goffset>(remaining, buffer.size()), cancellable, NULL);
+        if (n <= 0) {
+            return false;
+        }
+        actual = fnv1a_update(actual, buffer.data(), n);
+        remaining -= n;
+    }
+    return actual == hash;
+
+}
+
+// Checks the last chunk of part against the journal, reading one chunk instead of the
+// whole file. An interrupted copy leaves damage at the end of the partial file, so when
+// the last chunk does not match the journal falls back to the last one that does. False
+// when nothing is left to resume from.
+static bool verify_resume_part(GFile* part, ResumeJournal& journal, GCancellable* cancellable) {
+
+    GFileInputStream* in = g_file_read(part, cancellable, NULL);
+    if (in == NULL) {
+        return false;
+    }
+
+    std::vector<guint8> buffer(RESUME_BUFFER_SIZE);
+    while (!journal.chunks.empty()) {
+        goffset start = (goffset)(journal.chunks.size() - 1) * RESUME_CHECKPOINT_BYTES;
+        if (verify_resume_chunk(in, start, journal.offset, journal.chunks.back(), buffer, cancellable) ||
+            g_cancellable_is_cancelled(cancellable)) {
+            break;
+        }
+        journal.chunks.pop_back();
+        journal.offset = start;
+    }
+
+    g_object_unref(in);
+    return !journal.chunks.empty() && !g_cancellable_is_cancelled(cancellable);
+
+}
+
+// Opens the partial file for writing at journal.offset, or empty when it can not be
+// reopened there, which resets the journal. owner is the object to unref when done.
+static GOutputStream* open_resume_part(GFile* part, ResumeJournal& journal, GObject** owner, GCancellable* cancellable, GError** error) {
+
+    if (journal.offset > 0) {
+        GFileIOStream* io = g_file_open_readwrite(part, cancellable, NULL);
+        if (io != NULL) {
+            GSeekable* seekable = G_SEEKABLE(io);
+            if (g_seekable_can_truncate(seekable) && g_seekable_truncate(seekable, journal.offset, cancellable, NULL) &&
+                g_seekable_seek(seekable, journal.offset, G_SEEK_SET, cancellable, NULL)) {
+                *owner = G_OBJECT(io);
+                return g_io_stream_get_output_stream(G_IO_STREAM(io));
+            }
+            g_object_unref(io);
+        }
+        journal.offset = 0;
+        journal.chunks.clear();
+    }
+
+    GFileOutputStream* out = g_file_replace(part, NULL, FALSE, G_FILE_CREATE_NONE, cancellable, error);
+    *owner = G_OBJECT(out);
+    return G_OUTPUT_STREAM(out);
+
+}
+
+// Copies source into part from journal.offset on, saving the journal every
+// RESUME_CHECKPOINT_BYTES and once more when the copy stops early
+static bool copy_resume_data(GFile* src, GFile* part, GFile* journal_file, ResumeJournal& journal, GCancellable* cancellable,
+                             GFileProgressCallback progress, gpointer user_data, GError** error) {
+
+    GObject* owner = NULL;
+    GOutputStream* out = open_resume_part(part, journal, &owner, cancellable, error);
+    if (out == NULL) {
+        return false;
+    }
+
+    GFileInputStream* in = g_file_read(src, cancellable, error);
+    if (in == NULL || (journal.offset > 0 && !g_seekable_seek(G_SEEKABLE(in), journal.offset, G_SEEK_SET, cancellable, error))) {
+        if (in != NULL) {
+            g_object_unref(in);
+        }
+        g_object_unref(owner);
+        return false;
+    }
+
+    std::vector<guint8> buffer(RESUME_BUFFER_SIZE);
+    goffset checkpoint = journal.offset;
+    bool ok = true;
+    while (ok) {
+
+        gssize n = g_input_stream_read(G_INPUT_STREAM(in), buffer.data(), buffer.size(), cancellable, error);
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        // a short write is not in the journal yet and is cut off again when resuming
+        ok = g_output_stream_write_all(out, buffer.data(), n, NULL, cancellable, error);
+        if (!ok) {
+            break;
+        }
+        resume_journal_add(journal, buffer.data(), n);
+
+        if (journal.offset - checkpoint >= RESUME_CHECKPOINT_BYTES) {
+            ok = g_output_stream_flush(out, cancellable, error) && save_resume_journal(journal_file, journal, error);
+            checkpoint = journal.offset;
+        }
+        if (progress != NULL) {
+            progress(journal.offset, journal.source_size, user_data);
+        }
+
+    }
+
+    if (ok) {
+        ok = g_output_stream_close(out, cancellable, error);
+    } else if (journal.offset > checkpoint && g_output_stream_flush(out, NULL, NULL)) {
+        save_resume_journal(journal_file, journal, NULL);
+    }
+
+    g_object_unref(in);
+    g_object_unref(owner);
+    return ok;
+
+}
+
+// Copies a file so an interrupted copy can continue where it stopped. Data goes to a hidden
+// .name.part sibling of dest with its checkpoint in .name.part.journal. A retry with the same
+// source (uri, size and mtime) continues from the checkpoint once the last chunk of the
+// partial file still matches its hash, or from the last chunk that does. The finished file is renamed over dest and the journal deleted. Small
+// files and anything but regular files are copied with copy_file_fast.
+static gboolean copy_file_resumable(GFile* src, GFile* dest, GFileCopyFlags flags, ReflinkMode reflink, GCancellable* cancellable,
+                                    GFileProgressCallback progress, gpointer user_data, GError** error) {
+
+    GFileInfo* info = g_file_query_info(src, G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                                        G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                                        (flags & G_FILE_COPY_NOFOLLOW_SYMLINKS) ? G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS : G_FILE_QUERY_INFO_NONE,
+                                        cancellable, error);
+    if (info == NULL) {
+        return FALSE;
+    }
+    bool regular = g_file_info_get_file_type(info) == G_FILE_TYPE_REGULAR;
+    goffset size = g_file_info_get_size(info);
+    guint64 mtime = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+                    g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+    g_object_unref(info);
+
+    GFile* parent = g_file_get_parent(dest);
+    if (!regular || size < RESUME_MIN_SIZE || parent == NULL) {
+        if (parent != NULL) {
+            g_object_unref(parent);
+        }
+        return copy_file_fast(src, dest, flags, reflink, cancellable, progress, user_data, error);
+    }
+
+    if (!(flags & G_FILE_COPY_OVERWRITE) && g_file_query_exists(dest, cancellable)) {
+        char* location = g_file_get_parse_name(dest);
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_EXISTS, "Error copying file %s: file exists", location);
+        g_free(location);
+        g_object_unref(parent);
+        return FALSE;
+    }
+
+    char* name = g_file_get_basename(dest);
+    std::string part_name = std::string(".") + name + ".part";
+    GFile* part = g_file_get_child(parent, part_name.c_str());
+    GFile* journal_file = g_file_get_child(parent, (part_name + ".journal").c_str());
+    char* uri = g_file_get_uri(src);
+
+    ResumeJournal journal;
+    bool resuming = load_resume_journal(journal_file, journal, cancellable) && journal.source == uri &&
+                    journal.source_size == size && journal.source_mtime == mtime && journal.offset <= size &&
+                    verify_resume_part(part, journal, cancellable);
+    if (!resuming) {
+        journal = ResumeJournal();
+        journal.source = uri;
+        journal.source_size = size;
+        journal.source_mtime = mtime;
+    }
+
+    bool ok = copy_resume_data(src, part, journal_file, journal, cancellable, progress, user_data, error);
+    if (ok) {
+        // attributes are best effort, as they are for g_file_copy without ALL_METADATA
+        g_file_copy_attributes(src, part, (GFileCopyFlags)(flags & G_FILE_COPY_ALL_METADATA), cancellable, NULL);
+        ok = g_file_move(part, dest, (GFileCopyFlags)(G_FILE_COPY_NO_FALLBACK_FOR_MOVE | (flags & G_FILE_COPY_OVERWRITE)),
+                         cancellable, NULL, NULL, error);
+    }
+    if (ok) {
+        g_file_delete(journal_file, NULL, NULL);
+    }
+
+    g_free(uri);
+    g_free(name);
+    g_object_unref(journal_file);
+    g_object_unref(part);
+    g_object_unref(parent);
+    return ok;
+
+}
+
+// Position of a running copy
+struct CopyProgress {
+    goffset current_num_bytes = 0;
+    goffset total_bytes = 0;
+    ProgressRate rate;
+};
+
+static v8::Local<v8::Object> copy_progress_to_object(const CopyProgress& copy_progress) {
+    v8::Local<v8::Object> dataObj = Nan::New<v8::Object>();
+    Nan::Set(dataObj, key(KEY_CURRENT_NUM_BYTES), Nan::New<v8::Number>(copy_progress.current_num_bytes));
+    Nan::Set(dataObj, key(KEY_BYTES_COPIED), Nan::New<v8::Number>(copy_progress.current_num_bytes));
+    Nan::Set(dataObj, key(KEY_TOTAL_BYTES), Nan::New<v8::Number>(copy_progress.total_bytes));
+    set_rate_properties(dataObj, copy_progress.rate);
+    return dataObj;
+}
+
+// Copies one file on the libuv threadpool with copy_file_fast, or copy_file_resumable when
+// resume is set. Progress is sent when the
+// ProgressMeter of the operation says so and only the latest position is delivered to JS.
+// The copy is a "copy" operation, pausing blocks it inside the progress callback.
+class CopyFileWorker : public Nan::AsyncProgressWorkerBase<CopyProgress> {
+public:
+    CopyFileWorker(Nan::Callback *callback, Nan::Callback *progress_callback, const std::string &source, const std::string &destination,
+                   ReflinkMode reflink = REFLINK_AUTO, bool resume = false)
+        : Nan::AsyncProgressWorkerBase<CopyProgress>(callback), progress_callback(progress_callback), source(source), destination(destination),
+          reflink(reflink), resume(resume) {
+        operation = OperationRegistry::create("copy", source);
+    }
+
+    ~CopyFileWorker() {
+        OperationRegistry::remove(operation->id);
+        delete progress_callback;
+    }
+
+    Operation& get_operation() {
+        return *operation;
+    }
+
+    void Execute(const ExecutionProgress& progress) {
+
+        this->progress = &progress;
+        GFile* src = new_file_for(source.c_str());
+        GFile* dest = new_file_for(destination.c_str());
+
+        GError* error = NULL;
+        auto copy = resume ? copy_file_resumable : copy_file_fast;
+        if (!copy(src, dest, G_FILE_COPY_ALL_METADATA, reflink, operation->cancellable, on_progress, this, &error)) {
+            SetErrorMessage(error->message);
+            g_error_free(error);
+        }
+
+        g_object_unref(src);
+        g_object_unref(dest);
+        this->progress = NULL;
+
+    }
+
+    void HandleProgressCallback(const CopyProgress* data, size_t count) {
+        Nan::HandleScope scope;
+
+        if (data == NULL || count == 0 || progress_callback == NULL) {
+            return;
+        }
+        v8::Local<v8::Value> argv[] = { copy_progress_to_object(data[count - 1]) };
+        progress_callback->Call(1, argv);
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(true);
+        v8::Local<v8::Value> argv[] = { Nan::Null(), copy_progress_to_object(position) };
+        callback->Call(2, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(false);
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+
+    static void on_progress(goffset current_num_bytes, goffset total_bytes, gpointer user_data) {
+        CopyFileWorker* worker = static_cast<CopyFileWorker*>(user_data);
+        worker->position.current_num_bytes = current_num_bytes;
+        worker->position.total_bytes = total_bytes;
+        if (worker->operation->progress(current_num_bytes, total_bytes, worker->position.rate) && worker->progress_callback != NULL) {
+            worker->progress->Send(&worker->position, 1);
+        }
+        worker->operation->checkpoint();
+    }
+
+    Nan::Callback* progress_callback;
+    std::string source;
+    std::string destination;
+    ReflinkMode reflink;
+    bool resume;
+    std::shared_ptr<Operation> operation;
+    CopyProgress position;
+    const ExecutionProgress* progress = NULL;
+};
+
+// One entry of a cp_arr job list, size is -1 when the caller did not know it
+struct CopyJob {
+    std::string source;
+    std::string destination;
+    bool is_dir = false;
+    goffset size = -1;
+    size_t item = 0;            // index of the mv_arr item a job belongs to
+};
+
+// Running totals of a batch copy
+struct TransferProgress {
+    guint64 bytes = 0;
+    guint64 total_bytes = 0;
+    guint64 files = 0;
+    guint64 total_files = 0;
+    guint64 errors = 0;
+    ProgressRate rate;
+};
+
+static v8::Local<v8::Object> transfer_progress_to_object(const TransferProgress& totals) {
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, key(KEY_BYTES), Nan::New<v8::Number>(totals.bytes));
+    Nan::Set(obj, key(KEY_TOTAL_BYTES), Nan::New<v8::Number>(totals.total_bytes));
+    Nan::Set(obj, key(KEY_FILES), Nan::New<v8::Number>(totals.files));
+    Nan::Set(obj, key(KEY_TOTAL_FILES), Nan::New<v8::Number>(totals.total_files));
+    Nan::Set(obj, key(KEY_ERRORS), Nan::New<v8::Number>(totals.errors));
+    set_rate_properties(obj, totals.rate);
+    return obj;
+}
+
+// Reads a one line sysfs attribute
+static bool read_sys_value(const std::string& path, std::string& value) {
+    gchar* contents = NULL;
+    if (!g_file_get_contents(path.c_str(), &contents, NULL, NULL)) {
+        return false;
+    }
+    value = g_strstrip(contents);
+    g_free(contents);
+    return true;
+}
+
+// Copy threads for a block device. /sys/dev/block/major:minor is the partition,
+// queue/ and removable belong to the whole disk above it.
+static int block_device_copy_threads(dev_t device) {
+    std::string base = "/sys/dev/block/" + std::to_string(major(device)) + ":" + std::to_string(minor(device));
+    std::string rotational;
+    std::string removable;
+    if (!read_sys_value(base + "/queue/rotational", rotational) &&
+        !read_sys_value(base + "/../queue/rotational", rotational)) {
+        // tmpfs, network and fuse filesystems
+        return 4;
+    }
+    if (!read_sys_value(base + "/removable", removable)) {
+        read_sys_value(base + "/../removable", removable);
+    }
+    return rotational == "1" || removable == "1" ? 2 : 8;
+}
+
+// Copy threads that suit the device a destination directory lives on, device is set to
+// a key shared by all directories on it. Phones and cameras take one transfer at a time,
+// network shares and spinning or removable disks slow down with more than two.
+static int copy_threads_for(const std::string& directory, std::string& device) {
+    GFile* file = new_file_for(directory.c_str());
+    int threads = 4;
+    if (!g_file_is_native(file)) {
+        char* scheme = g_file_get_uri_scheme(file);
+        std::string name = scheme ? scheme : "";
+        g_free(scheme);
+        device = name + ":";
+        threads = name == "mtp" || name == "gphoto2" || name == "afc" ? 1 : 2;
+    } else {
+        char* path = g_file_get_path(file);
+        struct stat st;
+        if (path != NULL && stat(path, &st) == 0) {
+            device = "dev:" + std::to_string(st.st_dev);
+            threads = block_device_copy_threads(st.st_dev);
+        } else {
+            device = directory;
+        }
+        g_free(path);
+    }
+    g_object_unref(file);
+    return threads;
+}
+
+struct CopyBatchOptions {
+    int threads = 0;            // 0 to pick per destination device
+    bool overwrite = false;
+    bool follow_symlinks = true;
+    bool resume = false;        // large files through copy_file_resumable
+    ReflinkMode reflink = REFLINK_AUTO;
+};
+
+// Copy engine of cp_arr and of moves across devices. Directories are created first,
+// parents before children, then the files are copied by one pool of threads per
+// destination device, sized by copy_threads_for unless options.threads is set. Files
+// that fail are skipped and kept in the failed list. report gets the totals whenever
+// the meter of the operation has a report due.
+class BatchCopier {
+public:
+
+    struct Failure {
+        const CopyJob* job;
+        std::string message;
+    };
+
+    BatchCopier(Operation& operation, const CopyBatchOptions& options, const std::function<void(const TransferProgress&)>& report)
+        : operation(operation), options(options), report(report) {}
+
+    // Copies jobs, they have to outlive the copier
+    void run(const std::vector<CopyJob>& jobs) {
+
+        std::vector<const CopyJob*> dirs;
+        std::map<std::string, Pool> pools;
+        std::unordered_map<std::string, Pool*> pool_for_directory;
+        for (const CopyJob& job : jobs) {
+            if (job.is_dir) {
+                dirs.push_back(&job);
+                continue;
+            }
+            char* directory = g_path_get_dirname(job.destination.c_str());
+            auto it = pool_for_directory.find(directory);
+            if (it == pool_for_directory.end()) {
+                std::string device;
+                int threads = copy_threads_for(directory, device);
+                Pool& pool = pools[device];
+                pool.threads = options.threads > 0 ? options.threads : threads;
+                it = pool_for_directory.emplace(directory, &pool).first;
+            }
+            g_free(directory);
+            it->second->files.push_back(&job);
+            add_planned(1, job.size > 0 ? job.size : 0);
+        }
+
+        // shallow destinations first so every parent exists before its children
+        std::stable_sort(dirs.begin(), dirs.end(), [](const CopyJob* a, const CopyJob* b) {
+            return std::count(a->destination.begin(), a->destination.end(), '/') <
+                   std::count(b->destination.begin(), b->destination.end(), '/');
+        });
+        for (const CopyJob* dir : dirs) {
+            if (!operation.checkpoint()) {
+                break;
+            }
+            make_directory(*dir);
+        }
+
+        std::vector<std::thread> threads;
+        for (auto& entry : pools) {
+            Pool& pool = entry.second;
+            int count = std::min<int>(pool.threads, pool.files.size());
+            for (int i = 0; i < count; i++) {
+                threads.emplace_back(&BatchCopier::copy_files, this, &pool);
+            }
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+    }
+
+    // Adds work done outside of run to the totals
+    void add_planned(guint64 count, guint64 size) {
+        total_files += count;
+        total_bytes += size;
+        operation.total_bytes = total_bytes.load();
+    }
+
+    void add_finished(guint64 count) {
+        files += count;
+        operation.items += count;
+        send();
+    }
+
+    TransferProgress snapshot() const {
+        TransferProgress totals;
+        totals.bytes = bytes;
+        totals.total_bytes = total_bytes;
+        totals.files = files;
+        totals.total_files = total_files;
+        totals.errors = errors;
+        totals.rate = operation.meter.get_rate();
+        return totals;
+    }
+
+    const std::vector<Failure>& get_failed() const {
+        return failed;
+    }
+
+private:
+
+    // Files going to one device and the number of threads copying them
+    struct Pool {
+        std::vector<const CopyJob*> files;
+        std::atomic<size_t> next{0};
+        int threads = 1;
+    };
+
+    // Bytes of the current file already added to the totals
+    struct FileProgress {
+        BatchCopier* copier;
+        goffset reported;
+    };
+
+    void copy_files(Pool* pool) {
+        size_t i;
+        while ((i = pool->next++) < pool->files.size()) {
+            if (!operation.checkpoint()) {
+                return;
+            }
+            copy_file(*pool->files[i]);
+        }
+    }
+
+    void copy_file(const CopyJob& job) {
+
+        GFile* src = new_file_for(job.source.c_str());
+        GFile* dest = new_file_for(job.destination.c_str());
+        GFileCopyFlags flags = (GFileCopyFlags)(G_FILE_COPY_ALL_METADATA |
+                                                (options.overwrite ? G_FILE_COPY_OVERWRITE : 0) |
+                                                (options.follow_symlinks ? 0 : G_FILE_COPY_NOFOLLOW_SYMLINKS));
+        FileProgress file_progress = { this, 0 };
+
+        GError* error = NULL;
+        auto copy = options.resume ? copy_file_resumable : copy_file_fast;
+        if (copy(src, dest, flags, options.reflink, operation.cancellable, on_progress, &file_progress, &error)) {
+            // backends that report no progress still count the size of the file
+            if (job.size > file_progress.reported) {
+                bytes += job.size - file_progress.reported;
+            }
+            add_finished(1);
+        } else {
+            fail(job, error);
+        }
+
+        g_object_unref(src);
+        g_object_unref(dest);
+
+    }
+
+    void make_directory(const CopyJob& job) {
+
+        GFile* dest = new_file_for(job.destination.c_str());
+        GError* error = NULL;
+        gboolean made = g_file_make_directory(dest, operation.cancellable, &error);
+        if (!made && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND)) {
+            // the parent was not part of the batch
+            g_clear_error(&error);
+            made = g_file_make_directory_with_parents(dest, operation.cancellable, &error);
+        }
+        if (!made) {
+            if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_EXISTS)) {
+                g_error_free(error);
+            } else {
+                fail(job, error);
+            }
+        }
+        g_object_unref(dest);
+
+    }
+
+    // Records a failed job unless the batch was cancelled, frees error
+    void fail(const CopyJob& job, GError* error) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            std::lock_guard<std::mutex> lock(failed_mutex);
+            failed.push_back({ &job, error->message });
+            errors++;
+        }
+        g_error_free(error);
+    }
+
+    static void on_progress(goffset current_num_bytes, goffset total_bytes, gpointer user_data) {
+        FileProgress* file_progress = static_cast<FileProgress*>(user_data);
+        BatchCopier* copier = file_progress->copier;
+        copier->bytes += current_num_bytes - file_progress->reported;
+        file_progress->reported = current_num_bytes;
+        copier->send();
+        copier->operation.checkpoint();
+    }
+
+    // Reports the totals when the meter of the operation has a report due
+    void send() {
+        TransferProgress totals = snapshot();
+        if (operation.progress(totals.bytes, totals.total_bytes, totals.rate)) {
+            report(totals);
+        }
+    }
+
+    Operation& operation;
+    CopyBatchOptions options;
+    std::function<void(const TransferProgress&)> report;
+    std::atomic<guint64> bytes{0};
+    std::atomic<guint64> files{0};
+    std::atomic<guint64> errors{0};
+    std::atomic<guint64> total_bytes{0};
+    std::atomic<guint64> total_files{0};
+    std::mutex failed_mutex;
+    std::vector<Failure> failed;
+};
+
+// [{source, destination, message}] for the final totals of a batch
+static v8::Local<v8::Array> failures_to_array(const std::vector<BatchCopier::Failure>& failed) {
+    v8::Local<v8::Array> errors = Nan::New<v8::Array>((int)failed.size());
+    for (uint32_t i = 0; i < failed.size(); i++) {
+        v8::Local<v8::Object> error = Nan::New<v8::Object>();
+        Nan::Set(error, key(KEY_SOURCE), Nan::New(failed[i].job->source).ToLocalChecked());
+        Nan::Set(error, key(KEY_DESTINATION), Nan::New(failed[i].job->destination).ToLocalChecked());
+        Nan::Set(error, key(KEY_MESSAGE), Nan::New(failed[i].message).ToLocalChecked());
+        Nan::Set(errors, i, error);
+    }
+    return errors;
+}
+
+// Batch copy behind cp_arr, see BatchCopier. callback(err, totals, done) gets the totals of
+// the whole batch while copying and once more when done with error_list and cancelled.
+class CopyBatchWorker : public Nan::AsyncProgressWorkerBase<TransferProgress> {
+public:
+    CopyBatchWorker(Nan::Callback *callback, std::vector<CopyJob>&& jobs, const CopyBatchOptions& options)
+        : Nan::AsyncProgressWorkerBase<TransferProgress>(callback), jobs(std::move(jobs)), options(options) {
+        operation = OperationRegistry::create("copy", this->jobs.empty() ? "" : this->jobs[0].source);
+    }
+
+    ~CopyBatchWorker() {
+        OperationRegistry::remove(operation->id);
+    }
+
+    Operation& get_operation() {
+        return *operation;
+    }
+
+    void Execute(const ExecutionProgress& progress) {
+        BatchCopier copier(*operation, options, [&](const TransferProgress& totals) {
+            progress.Send(&totals, 1);
+        });
+        copier.run(jobs);
+        totals = copier.snapshot();
+        failed = copier.get_failed();
+    }
+
+    void HandleProgressCallback(const TransferProgress* data, size_t count) {
+        Nan::HandleScope scope;
+
+        if (data == NULL || count == 0 || g_cancellable_is_cancelled(operation->cancellable)) {
+            return;
+        }
+        v8::Local<v8::Value> argv[] = { Nan::Null(), transfer_progress_to_object(data[count - 1]), Nan::False() };
+        v8::Local<v8::Value> res = callback->Call(3, argv);
+        if (!res.IsEmpty() && res->IsFalse()) {
+            operation->cancel();
+        }
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(failed.empty());
+
+        v8::Local<v8::Object> result = transfer_progress_to_object(totals);
+        Nan::Set(result, Nan::New("error_list").ToLocalChecked(), failures_to_array(failed));
+        Nan::Set(result, Nan::New("cancelled").ToLocalChecked(),
+                 Nan::New<v8::Boolean>(operation->get_state() == Operation::CANCELLED));
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result, Nan::True() };
+        callback->Call(3, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(false);
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+    std::vector<CopyJob> jobs;
+    CopyBatchOptions options;
+    std::shared_ptr<Operation> operation;
+    TransferProgress totals;
+    std::vector<BatchCopier::Failure> failed;
+};
+
+struct MoveOptions {
+    bool overwrite = false;
+    int threads = 0;
+};
+
+// Adds a copy job for source and, when it is a directory, for everything below it, with
+// destinations mapped below destination. Links are not followed. Returns false and sets
+// error when source can not be read, directories below it that can not be read are passed
+// to dir_error one at a time, cancellations are not.
+static bool collect_copy_jobs(const std::string& source, const std::string& destination, size_t item, int threads,
+                              Operation* operation, std::vector<CopyJob>& jobs,
+                              const std::function<void(GError*)>& dir_error, GError** error) {
+
+    const char* attributes = G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_SIZE;
+
+    GFile* root = new_file_for(source.c_str());
+    GFileInfo* root_info = g_file_query_info(root, attributes, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, operation->cancellable, error);
+    if (root_info == NULL) {
+        g_object_unref(root);
+        return false;
+    }
+
+    bool is_dir = g_file_info_get_file_type(root_info) == G_FILE_TYPE_DIRECTORY;
+    jobs.push_back({ source, destination, is_dir, is_dir ? -1 : g_file_info_get_size(root_info), item });
+    g_object_unref(root_info);
+
+    if (is_dir) {
+        // destinations of the directories found so far, by source location
+        std::mutex destinations_mutex;
+        std::unordered_map<std::string, std::string> destinations = { { file_location(root), destination } };
+        std::vector<std::vector<CopyJob>> found(threads);
+
+        TreeScanner scanner(threads, attributes, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, operation->cancellable);
+        scanner.operation = operation;
+        scanner.visit = [&](int thread, const TreeScanner::Dir& dir, GFileInfo* file_info) {
+            const char* name = g_file_info_get_name(file_info);
+            bool child_is_dir = g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY;
+            GFile* child = g_file_get_child(dir.file, name);
+            std::string child_source = file_location(child);
+            g_object_unref(child);
+            std::string child_destination;
+            {
+                std::lock_guard<std::mutex> lock(destinations_mutex);
+                child_destination = destinations[dir.location] + "/" + name;
+                if (child_is_dir) {
+                    destinations[child_source] = child_destination;
+                }
+            }
+            found[thread].push_back({ child_source, child_destination, child_is_dir,
+                                      child_is_dir ? -1 : g_file_info_get_size(file_info), item });
+            return child_is_dir;
+        };
+        scanner.error = [&](int thread, const TreeScanner::Dir& dir, GError* scan_error) {
+            if (!g_error_matches(scan_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                std::lock_guard<std::mutex> lock(destinations_mutex);
+                dir_error(scan_error);
+            }
+        };
+        scanner.run(root, file_location(root));
+
+        for (std::vector<CopyJob>& thread_jobs : found) {
+            std::move(thread_jobs.begin(), thread_jobs.end(), std::back_inserter(jobs));
+        }
+    }
+
+    g_object_unref(root);
+    return true;
+
+}
+
+// Bulk move behind mv_arr. Every item is first moved with one rename, or g_file_move for
+// locations that are not local, so moving a folder on the same filesystem never looks at
+// its contents. Items the kernel or backend can not move directly (EXDEV, or a folder on
+// a backend that can not move folders) are copied together with BatchCopier, links as
+// links, and their sources deleted once everything below them was copied.
+// callback(err, totals, done) works as for cp_arr, the final totals add moved, the
+// sources of the items that are now at their destination.
+class MoveBatchWorker : public Nan::AsyncProgressWorkerBase<TransferProgress> {
+public:
+    MoveBatchWorker(Nan::Callback *callback, std::vector<CopyJob>&& items, const MoveOptions& options)
+        : Nan::AsyncProgressWorkerBase<TransferProgress>(callback), items(std::move(items)), options(options) {
+        operation = OperationRegistry::create("move", this->items.empty() ? "" : this->items[0].source);
+        moved.resize(this->items.size(), false);
+    }
+
+    ~MoveBatchWorker() {
+        OperationRegistry::remove(operation->id);
+    }
+
+    Operation& get_operation() {
+        return *operation;
+    }
+
+    void Execute(const ExecutionProgress& progress) {
+
+        CopyBatchOptions copy_options;
+        copy_options.threads = options.threads;
+        copy_options.overwrite = options.overwrite;
+        copy_options.follow_symlinks = false;
+        BatchCopier copier(*operation, copy_options, [&](const TransferProgress& totals) {
+            progress.Send(&totals, 1);
+        });
+
+        std::vector<size_t> across;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (!operation->checkpoint()) {
+                break;
+            }
+            GError* error = NULL;
+            switch (move_item(items[i], &error)) {
+                case MOVE_DONE:
+                    moved[i] = true;
+                    copier.add_planned(1, 0);
+                    copier.add_finished(1);
+                    break;
+                case MOVE_NEEDS_COPY:
+                    across.push_back(i);
+                    break;
+                case MOVE_FAILED:
+                    fail(items[i], error);
+                    break;
+            }
+        }
+
+        if (!across.empty() && !g_cancellable_is_cancelled(operation->cancellable)) {
+
+            for (size_t i : across) {
+                GError* error = NULL;
+                const CopyJob& item = items[i];
+                // a folder that can not be read would be copied incompletely, keep the item
+                bool collected = collect_copy_jobs(item.source, item.destination, i, SCAN_THREADS, operation.get(), jobs,
+                                                   [&](GError* dir_error) { item_failed.push_back({ &item, dir_error->message }); },
+                                                   &error);
+                if (!collected) {
+                    fail(item, error);
+                }
+            }
+
+            copier.run(jobs);
+
+            std::vector<bool> copied(items.size(), false);
+            for (size_t i : across) {
+                copied[i] = true;
+            }
+            for (const BatchCopier::Failure& failure : copier.get_failed()) {
+                copied[failure.job->item] = false;
+                failed.push_back(failure);
+            }
+            for (const Failure& failure : item_failed) {
+                copied[failure.job - items.data()] = false;
+            }
+
+            if (!g_cancellable_is_cancelled(operation->cancellable)) {
+                delete_sources(jobs, copied);
+            }
+        }
+
+        totals = copier.snapshot();
+
+    }
+
+    void HandleProgressCallback(const TransferProgress* data, size_t count) {
+        Nan::HandleScope scope;
+
+        if (data == NULL || count == 0 || g_cancellable_is_cancelled(operation->cancellable)) {
+            return;
+        }
+        v8::Local<v8::Value> argv[] = { Nan::Null(), transfer_progress_to_object(data[count - 1]), Nan::False() };
+        v8::Local<v8::Value> res = callback->Call(3, argv);
+        if (!res.IsEmpty() && res->IsFalse()) {
+            operation->cancel();
+        }
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        failed.insert(failed.end(), item_failed.begin(), item_failed.end());
+        operation->finish(failed.empty());
+
+        v8::Local<v8::Array> sources = Nan::New<v8::Array>();
+        uint32_t index = 0;
+        for (size_t i = 0; i < items.size(); i++) {
+            if (moved[i]) {
+                Nan::Set(sources, index++, Nan::New(items[i].source).ToLocalChecked());
+            }
+        }
+
+        v8::Local<v8::Object> result = transfer_progress_to_object(totals);
+        Nan::Set(result, key(KEY_MOVED), sources);
+        Nan::Set(result, key(KEY_ERROR_LIST), failures_to_array(failed));
+        Nan::Set(result, key(KEY_CANCELLED),
+                 Nan::New<v8::Boolean>(operation->get_state() == Operation::CANCELLED));
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result, Nan::True() };
+        callback->Call(3, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(false);
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+
+    typedef BatchCopier::Failure Failure;
+
+    enum MoveResult { MOVE_DONE, MOVE_NEEDS_COPY, MOVE_FAILED };
+
+    MoveResult move_item(const CopyJob& item, GError** error) {
+
+        GFile* src = new_file_for(item.source.c_str());
+        GFile* dest = new_file_for(item.destination.c_str());
+        char* source = g_file_get_path(src);
+        char* destination = g_file_get_path(dest);
+
+        MoveResult result = MOVE_DONE;
+        if (source != NULL && destination != NULL) {
+            // a rename across filesystems fails with EXDEV, no need to compare st_dev first
+            int res = options.overwrite ? rename(source, destination) : rename_noreplace(source, destination);
+            if (res != 0 && errno == EXDEV) {
+                result = MOVE_NEEDS_COPY;
+            } else if (res != 0) {
+                set_errno_error(error, errno, "Error moving file", source);
+                result = MOVE_FAILED;
+            }
+        } else {
+            GFileCopyFlags flags = (GFileCopyFlags)(G_FILE_COPY_NO_FALLBACK_FOR_MOVE | G_FILE_COPY_NOFOLLOW_SYMLINKS |
+                                                    G_FILE_COPY_ALL_METADATA | (options.overwrite ? G_FILE_COPY_OVERWRITE : 0));
+            if (!g_file_move(src, dest, flags, operation->cancellable, NULL, NULL, error)) {
+                if (g_error_matches(*error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED) ||
+                    g_error_matches(*error, G_IO_ERROR, G_IO_ERROR_WOULD_RECURSE)) {
+                    g_clear_error(error);
+                    result = MOVE_NEEDS_COPY;
+                } else {
+                    result = MOVE_FAILED;
+                }
+            }
+        }
+
+        // the copy creates folders that already exist without complaint, so check here
+        // that it would not merge into an existing destination, as the rename would not
+        if (result == MOVE_NEEDS_COPY && !options.overwrite &&
+            g_file_query_file_type(dest, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, operation->cancellable) != G_FILE_TYPE_UNKNOWN) {
+            set_errno_error(error, EEXIST, "Error moving file", item.source.c_str());
+            result = MOVE_FAILED;
+        }
+
+        g_free(source);
+        g_free(destination);
+        g_object_unref(src);
+        g_object_unref(dest);
+        return result;
+
+    }
+
+    // Deletes the sources of the items that were copied completely, files first, then
+    // directories from the deepest up
+    void delete_sources(const std::vector<CopyJob>& jobs, std::vector<bool>& copied) {
+
+        std::vector<const CopyJob*> dirs;
+        for (const CopyJob& job : jobs) {
+            if (!copied[job.item]) {
+                continue;
+            }
+            if (job.is_dir) {
+                dirs.push_back(&job);
+            } else if (!delete_source(job)) {
+                copied[job.item] = false;
+            }
+        }
+        std::stable_sort(dirs.begin(), dirs.end(), [](const CopyJob* a, const CopyJob* b) {
+            return std::count(a->source.begin(), a->source.end(), '/') >
+                   std::count(b->source.begin(), b->source.end(), '/');
+        });
+        for (const CopyJob* dir : dirs) {
+            if (!delete_source(*dir)) {
+                copied[dir->item] = false;
+            }
+        }
+
+        for (size_t i = 0; i < items.size(); i++) {
+            if (copied[i]) {
+                moved[i] = true;
+            }
+        }
+
+    }
+
+    bool delete_source(const CopyJob& job) {
+        GFile* file = new_file_for(job.source.c_str());
+        GError* error = NULL;
+        bool deleted = g_file_delete(file, NULL, &error);
+        if (!deleted) {
+            failed.push_back({ &job, error->message });
+            g_error_free(error);
+        }
+        g_object_unref(file);
+        return deleted;
+    }
+
+    void fail(const CopyJob& item, GError* error) {
+        if (error != NULL && !g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            item_failed.push_back({ &item, error->message });
+        }
+        if (error != NULL) {
+            g_error_free(error);
+        }
+    }
+
+    static const int SCAN_THREADS = 4;
+
+    std::vector<CopyJob> items;
+    std::vector<CopyJob> jobs;      // copies of the items that could not be renamed
+    MoveOptions options;
+    std::shared_ptr<Operation> operation;
+    std::vector<bool> moved;
+    TransferProgress totals;
+    std::vector<Failure> failed;
+    std::vector<Failure> item_failed;
+};
+
+// Running totals of plan_transfer
+struct PlanTotals {
+    guint64 total_bytes = 0;
+    guint64 files = 0;
+    guint64 dirs = 0;
+    guint64 items = 0;
+    guint64 total_items = 0;
+};
+
+static v8::Local<v8::Object> plan_totals_to_object(const PlanTotals& totals) {
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, key(KEY_TOTAL_BYTES), Nan::New<v8::Number>(totals.total_bytes));
+    Nan::Set(obj, key(KEY_FILES), Nan::New<v8::Number>(totals.files));
+    Nan::Set(obj, key(KEY_DIRS), Nan::New<v8::Number>(totals.dirs));
+    Nan::Set(obj, key(KEY_ITEMS), Nan::New<v8::Number>(totals.items));
+    Nan::Set(obj, key(KEY_TOTAL_ITEMS), Nan::New<v8::Number>(totals.total_items));
+    return obj;
+}
+
+struct PlanOptions {
+    int threads = 4;
+    bool jobs = true;           // return the cp_arr job list
+};
+
+// Pre-flight scan behind plan_transfer. Every item is scanned in parallel with the same
+// walk the copy engine uses, then the destinations of the items are checked for existing
+// files and the filesystem of the target folder for free space. callback(err, totals, done)
+// gets {total_bytes, files, dirs, items, total_items} after every item, the final call adds
+// conflicts, free, size, readonly, enough_space (null when the filesystem does not tell),
+// jobs for cp_arr, error_list and cancelled.
+class PlanTransferWorker : public Nan::AsyncProgressWorkerBase<PlanTotals> {
+public:
+    PlanTransferWorker(Nan::Callback *callback, std::vector<CopyJob>&& items, const std::string& destination, const PlanOptions& options)
+        : Nan::AsyncProgressWorkerBase<PlanTotals>(callback), items(std::move(items)), destination(destination), options(options) {
+        operation = OperationRegistry::create("plan", destination);
+    }
+
+    ~PlanTransferWorker() {
+        OperationRegistry::remove(operation->id);
+    }
+
+    Operation& get_operation() {
+        return *operation;
+    }
+
+    void Execute(const ExecutionProgress& progress) {
+
+        totals.total_items = items.size();
+        for (size_t i = 0; i < items.size(); i++) {
+
+            if (!operation->checkpoint()) {
+                break;
+            }
+
+            const CopyJob& item = items[i];
+            size_t first = jobs.size();
+            GError* error = NULL;
+            bool collected = collect_copy_jobs(item.source, item.destination, i, options.threads, operation.get(), jobs,
+                                               [&](GError* dir_error) { failed.push_back({ &item, dir_error->message }); },
+                                               &error);
+            if (!collected) {
+                if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                    failed.push_back({ &item, error->message });
+                }
+                g_error_free(error);
+            }
+
+            for (size_t j = first; j < jobs.size(); j++) {
+                if (jobs[j].is_dir) {
+                    totals.dirs++;
+                } else {
+                    totals.files++;
+                    totals.total_bytes += jobs[j].size > 0 ? jobs[j].size : 0;
+                }
+            }
+            if (collected) {
+                items[i].is_dir = jobs[first].is_dir;
+                check_conflict(items[i]);
+            }
+
+            totals.items++;
+            operation->items = totals.items;
+            progress.Send(&totals, 1);
+
+        }
+
+        query_space();
+
+    }
+
+    void HandleProgressCallback(const PlanTotals* data, size_t count) {
+        Nan::HandleScope scope;
+
+        if (data == NULL || count == 0 || g_cancellable_is_cancelled(operation->cancellable)) {
+            return;
+        }
+        v8::Local<v8::Value> argv[] = { Nan::Null(), plan_totals_to_object(data[count - 1]), Nan::False() };
+        v8::Local<v8::Value> res = callback->Call(3, argv);
+        if (!res.IsEmpty() && res->IsFalse()) {
+            operation->cancel();
+        }
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(failed.empty());
+
+        v8::Local<v8::Object> result = plan_totals_to_object(totals);
+
+        v8::Local<v8::Array> conflict_arr = Nan::New<v8::Array>((int)conflicts.size());
+        for (uint32_t i = 0; i < conflicts.size(); i++) {
+            v8::Local<v8::Object> conflict = Nan::New<v8::Object>();
+            Nan::Set(conflict, key(KEY_SOURCE), Nan::New(conflicts[i].item->source).ToLocalChecked());
+            Nan::Set(conflict, key(KEY_DESTINATION), Nan::New(conflicts[i].item->destination).ToLocalChecked());
+            Nan::Set(conflict, key(KEY_IS_DIR), Nan::New<v8::Boolean>(conflicts[i].item->is_dir));
+            Nan::Set(conflict, key(KEY_DESTINATION_IS_DIR), Nan::New<v8::Boolean>(conflicts[i].is_dir));
+            Nan::Set(conflict_arr, i, conflict);
+        }
+        Nan::Set(result, key(KEY_CONFLICTS), conflict_arr);
+
+        Nan::Set(result, key(KEY_FREE), Nan::New<v8::Number>(has_free ? (double)free_bytes : -1));
+        Nan::Set(result, key(KEY_SIZE), Nan::New<v8::Number>(has_size ? (double)size_bytes : -1));
+        Nan::Set(result, key(KEY_READONLY), Nan::New<v8::Boolean>(readonly));
+        if (has_free) {
+            Nan::Set(result, key(KEY_ENOUGH_SPACE), Nan::New<v8::Boolean>(free_bytes >= totals.total_bytes));
+        } else {
+            Nan::Set(result, key(KEY_ENOUGH_SPACE), Nan::Null());
+        }
+
+        if (options.jobs) {
+            v8::Local<v8::String> source_key = key(KEY_SOURCE);
+            v8::Local<v8::String> destination_key = key(KEY_DESTINATION);
+            v8::Local<v8::String> is_dir_key = key(KEY_IS_DIR);
+            v8::Local<v8::String> size_key = key(KEY_SIZE);
+            v8::Local<v8::Array> job_arr = Nan::New<v8::Array>((int)jobs.size());
+            for (uint32_t i = 0; i < jobs.size(); i++) {
+                v8::Local<v8::Object> job = Nan::New<v8::Object>();
+                Nan::Set(job, source_key, Nan::New(jobs[i].source).ToLocalChecked());
+                Nan::Set(job, destination_key, Nan::New(jobs[i].destination).ToLocalChecked());
+                Nan::Set(job, is_dir_key, Nan::New<v8::Boolean>(jobs[i].is_dir));
+                Nan::Set(job, size_key, Nan::New<v8::Number>((double)jobs[i].size));
+                Nan::Set(job_arr, i, job);
+            }
+            Nan::Set(result, key(KEY_JOBS), job_arr);
+        }
+
+        Nan::Set(result, key(KEY_ERROR_LIST), failures_to_array(failed));
+        Nan::Set(result, key(KEY_CANCELLED),
+                 Nan::New<v8::Boolean>(operation->get_state() == Operation::CANCELLED));
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result, Nan::True() };
+        callback->Call(3, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(false);
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+
+    struct Conflict {
+        const CopyJob* item;
+        bool is_dir;            // what exists at the destination
+    };
+
+    void check_conflict(const CopyJob& item) {
+        GFile* dest = new_file_for(item.destination.c_str());
+        GFileType type = g_file_query_file_type(dest, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, operation->cancellable);
+        if (type != G_FILE_TYPE_UNKNOWN) {
+            conflicts.push_back({ &item, type == G_FILE_TYPE_DIRECTORY });
+        }
+        g_object_unref(dest);
+    }
+
+    void query_space() {
+        if (destination.empty()) {
+            return;
+        }
+        GFile* dest = new_file_for(destination.c_str());
+        GFileInfo* info = g_file_query_filesystem_info(dest, G_FILE_ATTRIBUTE_FILESYSTEM_FREE "," G_FILE_ATTRIBUTE_FILESYSTEM_SIZE ","
+                                                       G_FILE_ATTRIBUTE_FILESYSTEM_READONLY, operation->cancellable, NULL);
+        if (info != NULL) {
+            has_free = g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+            free_bytes = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_FILESYSTEM_FREE);
+            has_size = g_file_info_has_attribute(info, G_FILE_ATTRIBUTE_FILESYSTEM_SIZE);
+            size_bytes = g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_FILESYSTEM_SIZE);
+            readonly = g_file_info_get_attribute_boolean(info, G_FILE_ATTRIBUTE_FILESYSTEM_READONLY);
+            g_object_unref(info);
+        }
+        g_object_unref(dest);
+    }
+
+    std::vector<CopyJob> items;
+    std::string destination;
+    PlanOptions options;
+    std::shared_ptr<Operation> operation;
+    std::vector<CopyJob> jobs;
+    PlanTotals totals;
+    std::vector<Conflict> conflicts;
+    std::vector<BatchCopier::Failure> failed;
+    bool has_free = false;
+    bool has_size = false;
+    bool readonly = false;
+    guint64 free_bytes = 0;
+    guint64 size_bytes = 0;
+};
+
+struct RemoveOptions {
+    bool trash = false;
+    int threads = 0;            // 0 for one per core, at most 8
+};
+
+// Totals of rm_tree, files counts every removed entry including directories
+struct RemoveProgress {
+    guint64 files = 0;
+    guint64 items = 0;
+    guint64 total_items = 0;
+    guint64 errors = 0;
+    ProgressRate rate;
+};
+
+static v8::Local<v8::Object> remove_progress_to_object(const RemoveProgress& totals) {
+    v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+    Nan::Set(obj, Nan::New("files").ToLocalChecked(), Nan::New<v8::Number>(totals.files));
+    Nan::Set(obj, Nan::New("items").ToLocalChecked(), Nan::New<v8::Number>(totals.items));
+    Nan::Set(obj, Nan::New("total_items").ToLocalChecked(), Nan::New<v8::Number>(totals.total_items));
+    Nan::Set(obj, Nan::New("errors").ToLocalChecked(), Nan::New<v8::Number>(totals.errors));
+    set_rate_properties(obj, totals.rate);
+    return obj;
+}
+
+// Removes local trees bottom-up on a pool of threads. Each directory is read through its
+// own fd and its entries are unlinked relative to it, subdirectories are queued for any
+// thread to take, and the thread releasing the last child of a directory removes it.
+// Symlinks are unlinked, never followed.
+class TreeRemover {
+public:
+
+    struct Failure {
+        std::string path;
+        std::string message;
+    };
+
+    // report is called with the number of removed entries after every batch
+    TreeRemover(Operation& operation, int threads, const std::function<void(guint64)>& report)
+        : operation(operation), threads(std::max(1, threads)), report(report) {}
+
+    // Removes path and everything below it, returns false when anything was kept
+    bool remove(const std::string& path) {
+
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            fail(NULL, path, errno);
+            return false;
+        }
+        if (!S_ISDIR(st.st_mode)) {
+            if (unlink(path.c_str()) != 0) {
+                fail(NULL, path, errno);
+                return false;
+            }
+            add_removed(1);
+            return true;
+        }
+
+        root_kept = false;
+        push(new Node(path, NULL));
+
+        std::vector<std::thread> pool;
+        for (int i = 1; i < threads; i++) {
+            pool.emplace_back(&TreeRemover::work, this);
+        }
+        work();
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+        return !root_kept;
+
+    }
+
+    guint64 get_removed() const {
+        return removed;
+    }
+
+    guint64 get_errors() const {
+        return errors;
+    }
+
+    std::vector<Failure> get_failed() {
+        std::lock_guard<std::mutex> lock(failed_mutex);
+        return failed;
+    }
+
+private:
+
+    struct Node {
+        Node(const std::string& path, Node* parent) : path(path), parent(parent) {}
+        std::string path;
+        Node* parent;
+        std::atomic<int> pending{1};       // children still queued or listed, plus the listing itself
+        std::atomic<bool> kept{false};     // something below could not be removed
+    };
+
+    static const size_t MAX_FAILURES = 1000;
+    static const guint64 REPORT_BATCH = 256;
+
+    void push(Node* node) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push_back(node);
+        outstanding++;
+        queued.notify_one();
+    }
+
+    void work() {
+        while (true) {
+            Node* node;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queued.wait(lock, [this] { return !queue.empty() || outstanding == 0; });
+                if (queue.empty()) {
+                    return;
+                }
+                // newest first keeps the walk depth first and the queue short
+                node = queue.back();
+                queue.pop_back();
+            }
+            list(node);
+            release(node);
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (--outstanding == 0) {
+                queued.notify_all();
+            }
+        }
+    }
+
+    // Unlinks everything in a directory that is not a directory and queues the rest
+    void list(Node* node) {
+
+        int fd = open(node->path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+            fail(node, node->path, errno);
+            return;
+        }
+        DIR* dir = fdopendir(fd);
+        if (dir == NULL) {
+            fail(node, node->path, errno);
+            close(fd);
+            return;
+        }
+
+        guint64 batch = 0;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+
+            const char* name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+            if (!operation.checkpoint()) {
+                node->kept = true;
+                break;
+            }
+
+            bool is_dir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN) {
+                struct stat st;
+                is_dir = fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+            }
+
+            if (is_dir) {
+                node->pending++;
+                push(new Node(node->path + "/" + name, node));
+            } else if (unlinkat(fd, name, 0) == 0) {
+                if (++batch == REPORT_BATCH) {
+                    add_removed(batch);
+                    batch = 0;
+                }
+            } else {
+                fail(node, node->path + "/" + name, errno);
+            }
+
+        }
+        closedir(dir);
+        add_removed(batch);
+
+    }
+
+    // Drops the listing or a child of node, the last one removes the directory and
+    // continues with its parent
+    void release(Node* node) {
+        while (node != NULL && --node->pending == 0) {
+            Node* parent = node->parent;
+            if (node->kept || g_cancellable_is_cancelled(operation.cancellable)) {
+                keep(parent);
+            } else if (rmdir(node->path.c_str()) == 0) {
+                add_removed(1);
+            } else {
+                fail(parent, node->path, errno);
+            }
+            delete node;
+            node = parent;
+        }
+    }
+
+    void keep(Node* node) {
+        if (node != NULL) {
+            node->kept = true;
+        } else {
+            root_kept = true;
+        }
+    }
+
+    void fail(Node* node, const std::string& path, int code) {
+        keep(node);
+        errors++;
+        std::lock_guard<std::mutex> lock(failed_mutex);
+        if (failed.size() < MAX_FAILURES) {
+            failed.push_back({ path, "Error deleting " + path + ": " + g_strerror(code) });
+        }
+    }
+
+    void add_removed(guint64 count) {
+        if (count > 0) {
+            report(removed += count);
+        }
+    }
+
+    Operation& operation;
+    int threads;
+    std::function<void(guint64)> report;
+
+    std::mutex queue_mutex;
+    std::condition_variable queued;
+    std::vector<Node*> queue;
+    size_t outstanding = 0;
+
+    std::atomic<guint64> removed{0};
+    std::atomic<guint64> errors{0};
+    std::atomic<bool> root_kept{false};
+    std::mutex failed_mutex;
+    std::vector<Failure> failed;
+};
+
+// Recursive delete behind rm_tree. Local paths go through TreeRemover, other locations
+// are deleted through GIO one entry at a time, and with options.trash every item is moved
+// to the trash as a whole. callback(err, totals, done) gets {files, items, total_items,
+// errors} with rates in entries per second, the final totals add deleted, the paths that
+// are gone, error_list and cancelled.
+class RemoveTreeWorker : public Nan::AsyncProgressWorkerBase<RemoveProgress> {
+public:
+    RemoveTreeWorker(Nan::Callback *callback, std::vector<std::string>&& paths, const RemoveOptions& options)
+        : Nan::AsyncProgressWorkerBase<RemoveProgress>(callback), paths(std::move(paths)), options(options) {
+        operation = OperationRegistry::create(options.trash ? "trash" : "delete", this->paths.empty() ? "" : this->paths[0]);
+        removed.resize(this->paths.size(), false);
+    }
+
+    ~RemoveTreeWorker() {
+        OperationRegistry::remove(operation->id);
+    }
+
+    Operation& get_operation() {
+        return *operation;
+    }
+
+    void Execute(const ExecutionProgress& progress) {
+
+        int threads = options.threads > 0 ? options.threads : std::clamp((int)std::thread::hardware_concurrency(), 2, 8);
+        guint64 items = 0;
+
+        // the remover's count restarts for every item
+        guint64 base = 0;
+        auto send = [&](guint64 files, bool force) {
+            RemoveProgress totals;
+            totals.files = files;
+            totals.items = items;
+            totals.total_items = paths.size();
+            totals.errors = errors;
+            if (operation->progress(files, 0, totals.rate) || force) {
+                progress.Send(&totals, 1);
+            }
+        };
+
+        for (size_t i = 0; i < paths.size(); i++) {
+
+            if (!operation->checkpoint()) {
+                break;
+            }
+
+            GFile* file = new_file_for(paths[i].c_str());
+            char* local = g_file_get_path(file);
+            GError* error = NULL;
+
+            if (options.trash) {
+                removed[i] = g_file_trash(file, operation->cancellable, &error);
+                if (removed[i]) {
+                    send(base += 1, false);
+                }
+            } else if (local != NULL) {
+                TreeRemover remover(*operation, threads, [&](guint64 count) { send(base + count, false); });
+                removed[i] = remover.remove(local);
+                base += remover.get_removed();
+                errors += remover.get_errors();
+                for (TreeRemover::Failure& failure : remover.get_failed()) {
+                    failed.push_back(std::move(failure));
+                }
+            } else {
+                guint64 count = 0;
+                removed[i] = delete_gfile(file, [&]() { send(base + ++count, false); });
+                base += count;
+            }
+
+            if (error != NULL) {
+                if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                    add_failure(paths[i], error->message);
+                }
+                g_error_free(error);
+            }
+            g_free(local);
+            g_object_unref(file);
+
+            operation->items = ++items;
+            send(base, true);
+
+        }
+
+    }
+
+    void HandleProgressCallback(const RemoveProgress* data, size_t count) {
+        Nan::HandleScope scope;
+
+        if (data == NULL || count == 0 || g_cancellable_is_cancelled(operation->cancellable)) {
+            return;
+        }
+        v8::Local<v8::Value> argv[] = { Nan::Null(), remove_progress_to_object(data[count - 1]), Nan::False() };
+        v8::Local<v8::Value> res = callback->Call(3, argv);
+        if (!res.IsEmpty() && res->IsFalse()) {
+            operation->cancel();
+        }
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(errors == 0);
+
+        RemoveProgress totals;
+        totals.total_items = paths.size();
+        totals.errors = errors;
+        totals.rate = operation->meter.get_rate();
+        totals.files = operation->bytes;
+
+        v8::Local<v8::Array> deleted = Nan::New<v8::Array>();
+        for (size_t i = 0; i < paths.size(); i++) {
+            if (removed[i]) {
+                Nan::Set(deleted, totals.items++, Nan::New(paths[i]).ToLocalChecked());
+            }
+        }
+
+        v8::Local<v8::Array> error_list = Nan::New<v8::Array>();
+        for (size_t i = 0; i < failed.size(); i++) {
+            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+            Nan::Set(obj, Nan::New("source").ToLocalChecked(), Nan::New(failed[i].path).ToLocalChecked());
+            Nan::Set(obj, Nan::New("message").ToLocalChecked(), Nan::New(failed[i].message).ToLocalChecked());
+            Nan::Set(error_list, i, obj);
+        }
+
+        v8::Local<v8::Object> result = remove_progress_to_object(totals);
+        Nan::Set(result, Nan::New("deleted").ToLocalChecked(), deleted);
+        Nan::Set(result, Nan::New("error_list").ToLocalChecked(), error_list);
+        Nan::Set(result, Nan::New("cancelled").ToLocalChecked(),
+                 Nan::New<v8::Boolean>(operation->get_state() == Operation::CANCELLED));
+
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result, Nan::True() };
+        callback->Call(3, argv);
+    }
+
+    void HandleErrorCallback() {
+        Nan::HandleScope scope;
+
+        operation->finish(false);
+        v8::Local<v8::Value> argv[] = {
+            Nan::New(this->ErrorMessage()).ToLocalChecked()
+        };
+        callback->Call(1, argv);
+    }
+
+private:
+
+    // Deletes a location without a local path, children first
+    bool delete_gfile(GFile* file, const std::function<void()>& removed_one) {
+
+        if (!operation->checkpoint()) {
+            return false;
+        }
+
+        bool kept = false;
+        GFileEnumerator* enumerator = g_file_enumerate_children(file, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                                                G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, operation->cancellable, NULL);
+        if (enumerator != NULL) {
+            GFileInfo* info;
+            while (!kept && (info = g_file_enumerator_next_file(enumerator, operation->cancellable, NULL)) != NULL) {
+                GFile* child = g_file_enumerator_get_child(enumerator, info);
+                if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY) {
+                    kept = !delete_gfile(child, removed_one);
+                } else {
+                    kept = !delete_one(child, removed_one);
+                }
+                g_object_unref(child);
+                g_object_unref(info);
+            }
+            g_file_enumerator_close(enumerator, NULL, NULL);
+            g_object_unref(enumerator);
+        }
+
+        return !kept && delete_one(file, removed_one);
+
+    }
+
+    bool delete_one(GFile* file, const std::function<void()>& removed_one) {
+        GError* error = NULL;
+        if (!g_file_delete(file, operation->cancellable, &error)) {
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                add_failure(file_location(file), error->message);
+            }
+            g_error_free(error);
+            return false;
+        }
+        removed_one();
+        return true;
+    }
+
+    void add_failure(const std::string& path, const char* message) {
+        errors++;
+        failed.push_back({ path, message });
+    }
+
+    std::vector<std::string> paths;
+    RemoveOptions options;
+    std::shared_ptr<Operation> operation;
+    std::vector<bool> removed;
+    std::vector<TreeRemover::Failure> failed;
+    guint64 errors = 0;     // every failure, failed keeps the first messages of large trees
+};
+
+// Longer edge of the thumbnails made by thumbnail and thumbnails unless a size is given
+static const int THUMBNAIL_SIZE = 75;
+static const int THUMBNAIL_MIN_SIZE = 16;
+static const int THUMBNAIL_MAX_SIZE = 1024;
+
+// Bytes read from the start of a JPEG file to look for its EXIF block
+static const size_t EXIF_SCAN_BYTES = 128 * 1024;
+
+static guint32 exif_read(const guint8* p, bool little_endian, int bytes) {
+    guint32 value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (guint32)p[little_endian ? i : bytes - 1 - i] << (8 * i);
+    }
+    return value;
+}
+
+// Finds the JPEG thumbnail a camera embedded in the EXIF block (IFD1) of a JPEG file, and
+// the orientation of the image from IFD0. Returns false when there is no thumbnail.
+static bool read_exif_thumbnail(const char* path, std::string& thumbnail, int& orientation) {
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    std::vector<guint8> data(EXIF_SCAN_BYTES);
+    ssize_t length = read(fd, data.data(), data.size());
+    close(fd);
+    if (length < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+
+    // APP1 segment with the Exif header, before the image data starts
+    size_t tiff = 0;
+    size_t tiff_length = 0;
+    for (size_t pos = 2; pos + 4 <= (size_t)length && data[pos] == 0xFF;) {
+        guint8 marker = data[pos + 1];
+        size_t segment = exif_read(&data[pos + 2], false, 2);
+        if (marker == 0xDA) {
+            break;
+        }
+        if (marker == 0xE1 && segment >= 16 && pos + 2 + segment <= (size_t)length && memcmp(&data[pos + 4], "Exif\0\0", 6) == 0) {
+            tiff = pos + 10;
+            tiff_length = segment - 8;
+            break;
+        }
+        pos += 2 + segment;
+    }
+    if (tiff == 0) {
+        return false;
+    }
+
+    const guint8* t = &data[tiff];
+    bool little_endian = t[0] == 'I' && t[1] == 'I';
+    if (!little_endian && !(t[0] == 'M' && t[1] == 'M')) {
+        return false;
+    }
+
+    // offsets come from the file, every check is against the bytes left so none can wrap
+    size_t offset = 0;
+    size_t size = 0;
+    size_t ifd = exif_read(t + 4, little_endian, 4);
+    for (int index = 0; index < 2 && ifd != 0; index++) {
+        if (ifd > tiff_length || tiff_length - ifd < 6) {
+            return false;
+        }
+        size_t count = exif_read(t + ifd, little_endian, 2);
+        if (count > (tiff_length - ifd - 6) / 12) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            const guint8* entry = t + ifd + 2 + i * 12;
+            guint32 tag = exif_read(entry, little_endian, 2);
+            if (index == 0 && tag == 0x0112) {
+                orientation = exif_read(entry + 8, little_endian, 2);
+            } else if (index == 1 && tag == 0x0201) {
+                offset = exif_read(entry + 8, little_endian, 4);
+            } else if (index == 1 && tag == 0x0202) {
+                size = exif_read(entry + 8, little_endian, 4);
+            }
+        }
+        ifd = exif_read(t + ifd + 2 + count * 12, little_endian, 4);
+    }
+
+    if (offset == 0 || size == 0 || offset > tiff_length || size > tiff_length - offset) {
+        return false;
+    }
+    thumbnail.assign(reinterpret_cast<const char*>(t + offset), size);
+    return true;
+
+}
+
+// Decodes path to about size pixels on its longer edge with its orientation applied. The
+// EXIF thumbnail is used when it is big enough, otherwise the loader scales while decoding,
+// which lets JPEG decode at 1/2, 1/4 or 1/8 of its size instead of decoding everything.
+static GdkPixbuf* load_thumbnail_pixbuf(const char* path, int size, GError** error) {
+
+    GdkPixbuf* pixbuf = NULL;
+    std::string exif;
+    int orientation = 0;
+    if (read_exif_thumbnail(path, exif, orientation)) {
+        GdkPixbufLoader* loader = gdk_pixbuf_loader_new_with_type("jpeg", NULL);
+        if (loader != NULL) {
+            bool loaded = gdk_pixbuf_loader_write(loader, reinterpret_cast<const guchar*>(exif.data()), exif.size(), NULL);
+            loaded = gdk_pixbuf_loader_close(loader, NULL) && loaded;
+            GdkPixbuf* embedded = loaded ? gdk_pixbuf_loader_get_pixbuf(loader) : NULL;
+            if (embedded != NULL && std::max(gdk_pixbuf_get_width(embedded), gdk_pixbuf_get_height(embedded)) >= size) {
+                pixbuf = GDK_PIXBUF(g_object_ref(embedded));
+                if (orientation > 1) {
+                    gdk_pixbuf_set_option(pixbuf, "orientation", std::to_string(orientation).c_str());
+                }
+            }
+            g_object_unref(loader);
+        }
+    }
+    if (pixbuf == NULL) {
+        pixbuf = gdk_pixbuf_new_from_file_at_scale(path, size, size, TRUE, error);
+        if (pixbuf == NULL) {
+            return NULL;
+        }
+    }
+
+    GdkPixbuf* oriented = gdk_pixbuf_apply_embedded_orientation(pixbuf);
+    g_object_unref(pixbuf);
+
+    // EXIF thumbnails, and formats the loader can not scale, still come in bigger
+    int width = gdk_pixbuf_get_width(oriented);
+    int height = gdk_pixbuf_get_height(oriented);
+    if (std::max(width, height) <= size) {
+        return oriented;
+    }
+    double scale = (double)size / std::max(width, height);
+    GdkPixbuf* scaled = gdk_pixbuf_scale_simple(oriented, std::max(1, (int)round(width * scale)),
+                                                std::max(1, (int)round(height * scale)), GDK_INTERP_BILINEAR);
+    g_object_unref(oriented);
+    if (scaled == NULL) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Error scaling image");
+    }
+    return scaled;
+
+}
+
+// Makes a thumbnail of source at destination, size pixels on its longer edge, saved in
+// the format of the source or as PNG when that format can not be written.
+static bool make_thumbnail(const std::string& source, const std::string& destination, int size, GError** error) {
+
+    GFile* src = new_file_for(source.c_str());
+    GFile* dest = new_file_for(destination.c_str());
+    char* src_path = g_file_get_path(src);
+    char* dest_path = g_file_get_path(dest);
+    g_object_unref(src);
+    g_object_unref(dest);
+
+    bool made = false;
+    GdkPixbufFormat* format = src_path != NULL ? gdk_pixbuf_get_file_info(src_path, NULL, NULL) : NULL;
+    if (src_path == NULL || dest_path == NULL) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Thumbnails need local files");
+    } else if (format == NULL) {
+        g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE, "Unknown image format: %s", src_path);
+    } else {
+        GdkPixbuf* pixbuf = load_thumbnail_pixbuf(src_path, size, error);
+        if (pixbuf != NULL) {
+            char* type = gdk_pixbuf_format_is_writable(format) ? gdk_pixbuf_format_get_name(format) : g_strdup("png");
+            made = gdk_pixbuf_save(pixbuf, dest_path, type, error, NULL);
+            g_free(type);
+            g_object_unref(pixbuf);
+        }
+    }
+
+    g_free(src_path);
+    g_free(dest_path);
+    return made;
+
+}
+
+// Bytes read from the start of a cached thumbnail to find its tEXt chunks
+static const size_t PNG_TEXT_SCAN_BYTES = 64 * 1024;
+
+// Shared thumbnail cache of the freedesktop thumbnail spec, $XDG_CACHE_HOME/thumbnails.
+// A thumbnail is a PNG named after the md5 of the uri of its file, in the folder for its
+// size, with the uri and mtime of the file in Thumb::URI and Thumb::MTime. It is valid
+// while both still match. Files that can not be thumbnailed get a small entry in fail/sfm
+// so they are not tried again until they change.
+class ThumbnailCache {
+public:
+
+    // Location of the thumbnail of source, mtime is the modification time of source
+    struct Entry {
+        std::string uri;
+        std::string mtime;
+        std::string path;
+        std::string fail_path;
+        int size = 0;           // longer edge of the thumbnails in the folder
+    };
+
+    // Fills entry for source, false when source does not exist
+    static bool lookup(const std::string& source, int size, Entry& entry, GError** error) {
+
+        GFile* file = new_file_for(source.c_str());
+        GFileInfo* info = g_file_query_info(file, G_FILE_ATTRIBUTE_TIME_MODIFIED, G_FILE_QUERY_INFO_NONE, NULL, error);
+        if (info == NULL) {
+            g_object_unref(file);
+            return false;
+        }
+        char* uri = g_file_get_uri(file);
+        entry.uri = uri;
+        entry.mtime = std::to_string(g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED));
+        g_free(uri);
+        g_object_unref(info);
+        g_object_unref(file);
+
+        const char* folder = "xx-large";
+        entry.size = 1024;
+        if (size <= 128) {
+            folder = "normal";
+            entry.size = 128;
+        } else if (size <= 256) {
+            folder = "large";
+            entry.size = 256;
+        } else if (size <= 512) {
+            folder = "x-large";
+            entry.size = 512;
+        }
+
+        char* md5 = g_compute_checksum_for_string(G_CHECKSUM_MD5, entry.uri.c_str(), -1);
+        std::string name = std::string(md5) + ".png";
+        g_free(md5);
+        std::string root = std::string(g_get_user_cache_dir()) + "/thumbnails/";
+        entry.path = root + folder + "/" + name;
+        entry.fail_path = root + "fail/sfm/" + name;
+        return true;
+
+    }
+
+    // Whether the thumbnail at path belongs to the current version of the file
+    static bool is_valid(const std::string& path, const Entry& entry) {
+        std::map<std::string, std::string> text;
+        return read_png_text(path, text) && text["Thumb::URI"] == entry.uri && text["Thumb::MTime"] == entry.mtime;
+    }
+
+    // Saves pixbuf as the thumbnail of entry, or as its fail entry
+    static bool save(GdkPixbuf* pixbuf, const Entry& entry, bool failed, GError** error) {
+
+        const std::string& path = failed ? entry.fail_path : entry.path;
+        char* dir = g_path_get_dirname(path.c_str());
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+
+        // written next to its final name and renamed so readers never see half a file
+        std::ostringstream temp;
+        temp << path << "." << getpid() << "." << std::this_thread::get_id();
+        bool saved = gdk_pixbuf_save(pixbuf, temp.str().c_str(), "png", error,
+                                     "tEXt::Thumb::URI", entry.uri.c_str(),
+                                     "tEXt::Thumb::MTime", entry.mtime.c_str(),
+                                     "tEXt::Software", "sfm", NULL);
+        if (saved) {
+            chmod(temp.str().c_str(), 0600);
+            if (rename(temp.str().c_str(), path.c_str()) != 0) {
+                set_errno_error(error, errno, "Error saving thumbnail", path.c_str());
+                saved = false;
+            }
+        }
+        if (!saved) {
+            unlink(temp.str().c_str());
+        }
+        return saved;
+
+    }
+
+private:
+
+    // Reads the tEXt chunks in front of the image data of a PNG file
+    static bool read_png_text(const std::string& path, std::map<std::string, std::string>& text) {
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        std::vector<guint8> data(PNG_TEXT_SCAN_BYTES);
+        ssize_t length = read(fd, data.data(), data.size());
+        close(fd);
+        if (length < 8 || memcmp(data.data(), "\x89PNG\r\n\x1a\n", 8) != 0) {
+            return false;
+        }
+
+        for (size_t pos = 8; pos + 8 <= (size_t)length;) {
+            size_t chunk = exif_read(&data[pos], false, 4);
+            const char* type = reinterpret_cast<const char*>(&data[pos + 4]);
+            if (memcmp(type, "IDAT", 4) == 0 || memcmp(type, "IEND", 4) == 0 || pos + 12 + chunk > (size_t)length) {
+                break;
+            }
+            if (memcmp(type, "tEXt", 4) == 0) {
+                const char* start = reinterpret_cast<const char*>(&data[pos + 8]);
+                const char* separator = static_cast<const char*>(memchr(start, '\0', chunk));
+                if (separator != NULL) {
+                    text[std::string(start, separator)] = std::string(separator + 1, start + chunk);
+                }
+            }
+            pos += 12 + chunk;
+        }
+        return true;
+
+    }
+
+};
+
+// Thumbnail of source from the shared cache, made and stored first when the cache has no
+// valid one. path is set to the cached file. Fails without decoding again for files that
+// failed before and did not change since.
+static bool make_cached_thumbnail(const std::string& source, int size, std::string& path, GError** error) {
+
+    ThumbnailCache::Entry entry;
+    if (!ThumbnailCache::lookup(source, size, entry, error)) {
+        return false;
+    }
+    path = entry.path;
+    if (ThumbnailCache::is_valid(entry.path, entry)) {
+        return true;
+    }
+    if (ThumbnailCache::is_valid(entry.fail_path, entry)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "No thumbnail for %s", source.c_str());
+        return false;
+    }
+
+    GFile* file = new_file_for(source.c_str());
+    char* local = g_file_get_path(file);
+    g_object_unref(file);
+    if (local == NULL) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Thumbnails need local files");
+        return false;
+    }
+
+    bool made = false;
+    GdkPixbuf* pixbuf = load_thumbnail_pixbuf(local, entry.size, error);
+    if (pixbuf != NULL) {
+        made = ThumbnailCache::save(pixbuf, entry, false, error);
+        g_object_unref(pixbuf);
+    } else {
+        GdkPixbuf* marker = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, 1, 1);
+        if (marker != NULL) {
+            gdk_pixbuf_fill(marker, 0);
+            ThumbnailCache::save(marker, entry, true, NULL);
+            g_object_unref(marker);
+        }
+    }
+    g_free(local);
+    return made;
+
+}
+
+// Requests of one thumbnails() call. The batch is an operation, cancelling it drops the
+// requests that did not start yet, priority orders it against the other batches.
+struct ThumbnailBatch {
+    std::shared_ptr<Operation> operation;
+    int priority = 0;           // the queue is ordered by it, changed under queue_mutex once submitted
+    int size = THUMBNAIL_SIZE;
+    size_t total = 0;
+    size_t pending = 0;         // requests not delivered yet, JS thread only
+    size_t failed = 0;
+    Nan::Callback* callback = NULL;
+    Nan::AsyncResource* resource = NULL;
+};
+
+struct ThumbnailRequest {
+    std::shared_ptr<ThumbnailBatch> batch;
+    size_t index;
+    std::string source;
+    std::string destination;    // empty for the shared cache
+    guint64 sequence;           // first come first served within a priority
+};
+
+struct ThumbnailResult {
+    std::shared_ptr<ThumbnailBatch> batch;
+    size_t index;
+    std::string source;
+    std::string destination;
+    std::string error;
+    bool skipped;               // the batch was cancelled before the request started
+};
+
+// Makes thumbnails on a small pool of threads owned by the isolate that started them.
+// Requests wait in one priority queue, higher batch priority first, and results are
+// handed back to the JS thread through a uv_async handle as soon as each one is done.
+// The handle only keeps the loop alive while batches are running.
+class ThumbnailService {
+public:
+
+    static ThumbnailService& get() {
+        v8::Isolate* isolate = v8::Isolate::GetCurrent();
+        if (instance == NULL || instance->isolate != isolate) {
+            instance = new ThumbnailService(isolate);
+            node::AddEnvironmentCleanupHook(isolate, cleanup, instance);
+        }
+        return *instance;
+    }
+
+    static int pool_size() {
+        return std::clamp((int)std::thread::hardware_concurrency() / 2, 2, 4);
+    }
+
+    // Queues the requests of a batch, called on the JS thread
+    void submit(const std::shared_ptr<ThumbnailBatch>& batch, std::vector<ThumbnailRequest>&& requests) {
+
+        batch->total = requests.size();
+        batch->pending = requests.size();
+        if (batches.empty()) {
+            uv_ref(reinterpret_cast<uv_handle_t*>(&async));
+        }
+        batches.push_back(batch);
+
+        if (requests.empty()) {
+            uv_async_send(&async);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        for (ThumbnailRequest& request : requests) {
+            request.sequence = sequence++;
+            queue.push_back(std::move(request));
+            std::push_heap(queue.begin(), queue.end(), compare);
+        }
+        while ((int)pool.size() < pool_size()) {
+            pool.emplace_back(&ThumbnailService::work, this);
+        }
+        queued.notify_all();
+
+    }
+
+    // Changes the priority of a submitted batch and reorders the queue for it
+    void reprioritize(const std::shared_ptr<ThumbnailBatch>& batch, int priority) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        batch->priority = priority;
+        std::make_heap(queue.begin(), queue.end(), compare);
+    }
+
+    std::shared_ptr<ThumbnailBatch> find(guint32 id) {
+        for (const std::shared_ptr<ThumbnailBatch>& batch : batches) {
+            if (batch->operation->id == id) {
+                return batch;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+
+    explicit ThumbnailService(v8::Isolate* isolate) : isolate(isolate) {
+        uv_async_init(Nan::GetCurrentEventLoop(), &async, on_async);
+        async.data = this;
+        uv_unref(reinterpret_cast<uv_handle_t*>(&async));
+    }
+
+    static void cleanup(void* arg) {
+        ThumbnailService* service = static_cast<ThumbnailService*>(arg);
+        if (instance == service) {
+            instance = NULL;
+        }
+        {
+            std::lock_guard<std::mutex> lock(service->queue_mutex);
+            service->stopping = true;
+            service->queued.notify_all();
+        }
+        for (std::thread& thread : service->pool) {
+            thread.join();
+        }
+        uv_close(reinterpret_cast<uv_handle_t*>(&service->async), [](uv_handle_t* handle) {
+            delete static_cast<ThumbnailService*>(handle->data);
+        });
+    }
+
+    // Lower comes out of the heap last, called with queue_mutex held
+    static bool compare(const ThumbnailRequest& a, const ThumbnailRequest& b) {
+        if (a.batch->priority != b.batch->priority) {
+            return a.batch->priority < b.batch->priority;
+        }
+        return a.sequence > b.sequence;
+    }
+
+    void work() {
+        while (true) {
+
+            ThumbnailRequest request;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queued.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping) {
+                    return;
+                }
+                std::pop_heap(queue.begin(), queue.end(), compare);
+                request = std::move(queue.back());
+                queue.pop_back();
+            }
+
+            ThumbnailResult result = { request.batch, request.index, request.source, request.destination, "", false };
+            // pausing a batch would hold a pool thread, only cancelling is honoured here
+            Operation& operation = *request.batch->operation;
+            if (g_cancellable_is_cancelled(operation.cancellable)) {
+                result.skipped = true;
+            } else {
+                GError* error = NULL;
+                bool made = request.destination.empty()
+                            ? make_cached_thumbnail(request.source, request.batch->size, result.destination, &error)
+                            : make_thumbnail(request.source, request.destination, request.batch->size, &error);
+                if (!made) {
+                    result.error = error != NULL ? error->message : "Error creating thumbnail";
+                    g_clear_error(&error);
+                }
+                operation.items++;
+            }
+
+            std::lock_guard<std::mutex> lock(results_mutex);
+            results.push_back(std::move(result));
+            uv_async_send(&async);
+
+        }
+    }
+
+    static void on_async(uv_async_t* handle) {
+        static_cast<ThumbnailService*>(handle->data)->deliver();
+    }
+
+    // Calls back JS with everything finished since the last wake up
+    void deliver() {
+
+        Nan::HandleScope scope;
+
+        std::vector<ThumbnailResult> done;
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            done.swap(results);
+        }
+
+        for (ThumbnailResult& result : done) {
+            ThumbnailBatch& batch = *result.batch;
+            batch.pending--;
+            if (!result.error.empty()) {
+                batch.failed++;
+            }
+            if (result.skipped || g_cancellable_is_cancelled(batch.operation->cancellable)) {
+                continue;
+            }
+            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
+            Nan::Set(obj, Nan::New("index").ToLocalChecked(), Nan::New<v8::Number>((double)result.index));
+            Nan::Set(obj, Nan::New("source").ToLocalChecked(), Nan::New(result.source).ToLocalChecked());
+            Nan::Set(obj, Nan::New("destination").ToLocalChecked(), Nan::New(result.destination).ToLocalChecked());
+            if (!result.error.empty()) {
+                Nan::Set(obj, Nan::New("error").ToLocalChecked(), Nan::New(result.error).ToLocalChecked());
+            }
+            v8::Local<v8::Value> argv[] = { Nan::Null(), obj, Nan::False() };
+            v8::Local<v8::Value> res;
+            if (batch.callback->Call(3, argv, batch.resource).ToLocal(&res) && res->IsFalse()) {
+                batch.operation->cancel();
+            }
+        }
+
+        // finished batches get their last call in the order they were started
+        for (auto it = batches.begin(); it != batches.end();) {
+            std::shared_ptr<ThumbnailBatch> batch = *it;
+            if (batch->pending > 0) {
+                ++it;
+                continue;
+            }
+            it = batches.erase(it);
+            batch->operation->finish(batch->failed == 0);
+
+            v8::Local<v8::Object> totals = Nan::New<v8::Object>();
+            Nan::Set(totals, Nan::New("total").ToLocalChecked(), Nan::New<v8::Number>((double)batch->total));
+            Nan::Set(totals, Nan::New("done").ToLocalChecked(), Nan::New<v8::Number>((double)batch->operation->items.load()));
+            Nan::Set(totals, Nan::New("failed").ToLocalChecked(), Nan::New<v8::Number>((double)batch->failed));
+            Nan::Set(totals, Nan::New("cancelled").ToLocalChecked(),
+                     Nan::New<v8::Boolean>(batch->operation->get_state() == Operation::CANCELLED));
+            v8::Local<v8::Value> argv[] = { Nan::Null(), totals, Nan::True() };
+            batch->callback->Call(3, argv, batch->resource);
+
+            OperationRegistry::remove(batch->operation->id);
+            delete batch->callback;
+            delete batch->resource;
+            batch->callback = NULL;
+            batch->resource = NULL;
+        }
+
+        if (batches.empty()) {
+            uv_unref(reinterpret_cast<uv_handle_t*>(&async));
+        }
+
+    }
 
-class ListFilesWorker : public Nan::AsyncWorker {
+    static thread_local ThumbnailService* instance;
+    v8::Isolate* isolate;
+    uv_async_t async;
+    std::list<std::shared_ptr<ThumbnailBatch>> batches;     // JS thread only
+
+    std::mutex queue_mutex;
+    std::condition_variable queued;
+    std::vector<ThumbnailRequest> queue;                    // heap ordered by compare
+    guint64 sequence = 0;
+    std::vector<std::thread> pool;
+    bool stopping = false;
+
+    std::mutex results_mutex;
+    std::vector<ThumbnailResult> results;
+};
+
+thread_local ThumbnailService* ThumbnailService::instance = NULL;
+
+// Icon sizes accepted by get_file_icon_data_url
+static const int ICON_SIZE = 32;
+static const int ICON_MIN_SIZE = 8;
+static const int ICON_MAX_SIZE = 512;
+
+// A folder of an icon theme with the icon files found in it, see index.theme
+struct IconThemeDir {
+
+    enum Type { FIXED, SCALABLE, THRESHOLD };
+
+    std::string path;
+    Type type = THRESHOLD;
+    int size = 0;
+    int min_size = 0;
+    int max_size = 0;
+    int threshold = 2;
+    int scale = 1;
+    std::unordered_set<std::string> files;
+
+    bool matches(int want) const {
+        if (scale != 1) {
+            return false;
+        }
+        switch (type) {
+            case FIXED:
+                return want == size;
+            case SCALABLE:
+                return want >= min_size && want <= max_size;
+            default:
+                return want >= size - threshold && want <= size + threshold;
+        }
+    }
+
+    int distance(int want) const {
+        int low = size;
+        int high = size;
+        if (type == SCALABLE) {
+            low = min_size;
+            high = max_size;
+        } else if (type == THRESHOLD) {
+            low = size - threshold;
+            high = size + threshold;
+        }
+        if (want * scale < low * scale) {
+            return low * scale - want * scale;
+        }
+        if (want * scale > high * scale) {
+            return want * scale - high * scale;
+        }
+        return 0;
+    }
+
+};
+
+struct IconTheme {
+    std::string name;
+    std::vector<std::string> inherits;
+    std::vector<IconThemeDir> dirs;
+};
+
+// Themed icons resolved through the freedesktop icon theme spec without GTK. Themes are
+// read once from index.theme and their folders listed, so finding an icon does not touch
+// the disk. Rendered icons are kept as PNG in an LRU keyed by icon, size and theme, so
+// every file of a content type after the first is a cache hit. Used from any thread.
+class IconLookup {
 public:
-    ListFilesWorker(Nan::Callback *callback, const std::string &source)
-        : Nan::AsyncWorker(callback), source(source) {}
 
-    ~ListFilesWorker() {}
+    static IconLookup& get() {
+        static IconLookup lookup;
+        return lookup;
+    }
 
-    void Execute() {
-        GFile* src = g_file_new_for_path(source.c_str());
-        const char *src_scheme = g_uri_parse_scheme(source.c_str());
-        if (src_scheme != NULL) {
-            src = g_file_new_for_uri(source.c_str());
+    // PNG of icon at size in the current icon theme. Icons that were not found are
+    // remembered as well and fail again without a lookup.
+    bool render(GIcon* icon, int size, std::string& png, GError** error) {
+
+        if (G_IS_EMBLEMED_ICON(icon)) {
+            icon = g_emblemed_icon_get_icon(G_EMBLEMED_ICON(icon));
+        }
+        char* icon_string = g_icon_to_string(icon);
+        if (icon_string == NULL) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Unsupported icon");
+            return false;
         }
 
-        GError* error = NULL;
-        GFileEnumerator* enumerator = g_file_enumerate_children(src,
-                                    FILE_INFO_ATTRIBUTES,
-                                                                G_FILE_QUERY_INFO_NONE,
-                                                                NULL,
-                                                                &error);
+        std::string theme = theme_name();
+        std::string cache_key = std::string(icon_string) + "\n" + std::to_string(size) + "\n" + theme;
+        g_free(icon_string);
+
+        if (!find(cache_key, png)) {
+            std::string path;
+            if (G_IS_FILE_ICON(icon)) {
+                char* file_path = g_file_get_path(g_file_icon_get_file(G_FILE_ICON(icon)));
+                path = file_path != NULL ? file_path : "";
+                g_free(file_path);
+            } else if (G_IS_THEMED_ICON(icon)) {
+                path = find_file(g_themed_icon_get_names(G_THEMED_ICON(icon)), size, theme);
+            }
+            png.clear();
+            if (!path.empty()) {
+                GdkPixbuf* pixbuf = gdk_pixbuf_new_from_file_at_size(path.c_str(), size, size, NULL);
+                gchar* buffer = NULL;
+                gsize length = 0;
+                if (pixbuf != NULL && gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &length, "png", NULL, NULL)) {
+                    png.assign(buffer, length);
+                }
+                g_free(buffer);
+                if (pixbuf != NULL) {
+                    g_object_unref(pixbuf);
+                }
+            }
+            put(cache_key, png);
+        }
 
-        if (enumerator == NULL) {
-            if (error != NULL) {
-                SetErrorMessage(error->message);
-                g_error_free(error);
-                g_object_unref(src);
-                return;
-            } else {
-                SetErrorMessage("Unknown error occurred");
-                g_object_unref(src);
-                return;
+        if (png.empty()) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "Icon not found in theme %s", theme.c_str());
+            return false;
+        }
+        return true;
+
+    }
+
+    // Forgets rendered icons and parsed themes, for theme changes and installed icons
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+        index.clear();
+        themes.clear();
+    }
+
+private:
+
+    static const size_t MAX_ENTRIES = 512;
+
+    IconLookup() {
+        GSettingsSchemaSource* source = g_settings_schema_source_get_default();
+        GSettingsSchema* schema = source ? g_settings_schema_source_lookup(source, "org.gnome.desktop.interface", TRUE) : NULL;
+        if (schema != NULL) {
+            settings = g_settings_new("org.gnome.desktop.interface");
+            g_settings_schema_unref(schema);
+        }
+    }
+
+    std::string theme_name() {
+        std::string name = "hicolor";
+        if (settings != NULL) {
+            char* value = g_settings_get_string(settings, "icon-theme");
+            if (value != NULL && *value != '\0') {
+                name = value;
             }
+            g_free(value);
         }
+        return name;
+    }
 
-        GFileInfo* file_info = NULL;
-        while ((file_info = g_file_enumerator_next_file(enumerator, NULL, &error)) != NULL) {
-            FileResult fileResult;
+    bool find(const std::string& cache_key, std::string& png) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(cache_key);
+        if (it == index.end()) {
+            return false;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        png = it->second->second;
+        return true;
+    }
+
+    void put(const std::string& cache_key, const std::string& png) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(cache_key);
+        if (it != index.end()) {
+            entries.erase(it->second);
+            index.erase(it);
+        }
+        entries.emplace_front(cache_key, png);
+        index[cache_key] = entries.begin();
+        while (entries.size() > MAX_ENTRIES) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+    }
+
+    // Folders searched for themes and unthemed icons, in order of precedence
+    static std::vector<std::string> base_dirs() {
+        std::vector<std::string> dirs;
+        dirs.push_back(std::string(g_get_home_dir()) + "/.icons");
+        dirs.push_back(std::string(g_get_user_data_dir()) + "/icons");
+        for (const gchar* const* dir = g_get_system_data_dirs(); *dir != NULL; dir++) {
+            dirs.push_back(std::string(*dir) + "/icons");
+        }
+        dirs.push_back("/usr/share/pixmaps");
+        return dirs;
+    }
+
+    static void list_files(IconThemeDir& dir) {
+        GDir* handle = g_dir_open(dir.path.c_str(), 0, NULL);
+        if (handle == NULL) {
+            return;
+        }
+        while (const char* name = g_dir_read_name(handle)) {
+            dir.files.insert(name);
+        }
+        g_dir_close(handle);
+    }
 
-            fileResult.name = g_file_info_get_name(file_info);
-            fileResult.display_name = g_file_info_get_display_name(file_info);
-            fileResult.href = g_file_get_path(g_file_get_child(src, fileResult.name.c_str()));
-            fileResult.location = g_file_get_path(g_file_get_parent(g_file_get_child(src, fileResult.name.c_str())));
-            fileResult.is_hidden = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
-                                  ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
-                                  : FALSE;
-            fileResult.is_directory = g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY;
-            fileResult.mimetype = g_file_info_get_content_type(file_info);
-            fileResult.is_symlink = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
-                                   ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
-                                   : FALSE;
-            fileResult.is_writeable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE);
-            fileResult.is_readable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ);
-            fileResult.filesystem = g_file_info_get_attribute_string(file_info, G_FILE_ATTRIBUTE_FILESYSTEM_TYPE)
-                                    ? g_file_info_get_attribute_string(file_info, G_FILE_ATTRIBUTE_FILESYSTEM_TYPE)
-                                    : "unknown";
-            fileResult.size = g_file_info_get_size(file_info);
-
-            GDateTime* mtime_dt = g_file_info_get_modification_date_time(file_info);
-            if (mtime_dt != NULL) {
-                fileResult.mtime = g_date_time_to_unix(mtime_dt);
-                g_date_time_unref(mtime_dt);
-            }
-
-            GDateTime* atime_dt = g_file_info_get_access_date_time(file_info);
-            if (atime_dt != NULL) {
-                fileResult.atime = g_date_time_to_unix(atime_dt);
-                g_date_time_unref(atime_dt);
-            }
-
-            GDateTime* ctime_dt = g_file_info_get_creation_date_time(file_info);
-            if (ctime_dt != NULL) {
-                fileResult.ctime = g_date_time_to_unix(ctime_dt);
-                g_date_time_unref(ctime_dt);
+    // Reads the theme from the first base folder with its index.theme. Folders of the
+    // theme in the other base folders are merged in, as the spec asks.
+    static std::shared_ptr<IconTheme> load_theme(const std::string& name) {
+
+        std::vector<std::string> bases = base_dirs();
+        GKeyFile* key_file = g_key_file_new();
+        bool found = false;
+        for (const auto& base : bases) {
+            if (g_key_file_load_from_file(key_file, (base + "/" + name + "/index.theme").c_str(), G_KEY_FILE_NONE, NULL)) {
+                found = true;
+                break;
             }
+        }
+        if (!found) {
+            g_key_file_free(key_file);
+            return nullptr;
+        }
 
-            results.push_back(fileResult);
-            g_object_unref(file_info);
+        auto theme = std::make_shared<IconTheme>();
+        theme->name = name;
+        gchar** inherits = g_key_file_get_string_list(key_file, "Icon Theme", "Inherits", NULL, NULL);
+        for (gchar** parent = inherits; parent != NULL && *parent != NULL; parent++) {
+            theme->inherits.push_back(*parent);
         }
+        g_strfreev(inherits);
 
-        if (error != NULL) {
-            SetErrorMessage(error->message);
-            g_error_free(error);
+        gchar** directories = g_key_file_get_string_list(key_file, "Icon Theme", "Directories", NULL, NULL);
+        for (gchar** directory = directories; directory != NULL && *directory != NULL; directory++) {
+            IconThemeDir dir;
+            dir.size = g_key_file_get_integer(key_file, *directory, "Size", NULL);
+            if (dir.size <= 0) {
+                continue;
+            }
+            dir.min_size = dir.max_size = dir.size;
+            if (g_key_file_has_key(key_file, *directory, "MinSize", NULL)) {
+                dir.min_size = g_key_file_get_integer(key_file, *directory, "MinSize", NULL);
+            }
+            if (g_key_file_has_key(key_file, *directory, "MaxSize", NULL)) {
+                dir.max_size = g_key_file_get_integer(key_file, *directory, "MaxSize", NULL);
+            }
+            if (g_key_file_has_key(key_file, *directory, "Threshold", NULL)) {
+                dir.threshold = g_key_file_get_integer(key_file, *directory, "Threshold", NULL);
+            }
+            if (g_key_file_has_key(key_file, *directory, "Scale", NULL)) {
+                dir.scale = std::max(1, g_key_file_get_integer(key_file, *directory, "Scale", NULL));
+            }
+            gchar* type = g_key_file_get_string(key_file, *directory, "Type", NULL);
+            if (g_strcmp0(type, "Fixed") == 0) {
+                dir.type = IconThemeDir::FIXED;
+            } else if (g_strcmp0(type, "Scalable") == 0) {
+                dir.type = IconThemeDir::SCALABLE;
+            }
+            g_free(type);
+
+            for (const auto& base : bases) {
+                IconThemeDir located = dir;
+                located.path = base + "/" + name + "/" + *directory;
+                list_files(located);
+                if (!located.files.empty()) {
+                    theme->dirs.push_back(std::move(located));
+                }
+            }
         }
+        g_strfreev(directories);
+        g_key_file_free(key_file);
+        return theme;
 
-        g_object_unref(enumerator);
-        g_object_unref(src);
     }
 
-    void HandleOKCallback() {
-        Nan::HandleScope scope;
+    std::shared_ptr<IconTheme> theme_for(const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = themes.find(name);
+        if (it == themes.end()) {
+            it = themes.emplace(name, load_theme(name)).first;
+        }
+        return it->second;
+    }
 
-        v8::Local<v8::Array> resultArray = Nan::New<v8::Array>(results.size());
-        for (size_t i = 0; i < results.size(); i++) {
-            v8::Local<v8::Object> fileObj = Nan::New<v8::Object>();
-            Nan::Set(fileObj, Nan::New("name").ToLocalChecked(), Nan::New(results[i].name).ToLocalChecked());
-            Nan::Set(fileObj, Nan::New("display_name").ToLocalChecked(), Nan::New(results[i].display_name).ToLocalChecked());
-            Nan::Set(fileObj, Nan::New("href").ToLocalChecked(), Nan::New(results[i].href).ToLocalChecked());
-            Nan::Set(fileObj, Nan::New("location").ToLocalChecked(), Nan::New(results[i].location).ToLocalChecked());
-            Nan::Set(fileObj, Nan::New("is_dir").ToLocalChecked(), Nan::New<v8::Boolean>(results[i].is_directory));
-            Nan::Set(fileObj, Nan::New("is_hidden").ToLocalChecked(), Nan::New<v8::Boolean>(results[i].is_hidden));
-            Nan::Set(fileObj, Nan::New("is_readable").ToLocalChecked(), Nan::New<v8::Boolean>(results[i].is_readable));
-            Nan::Set(fileObj, Nan::New("is_writable").ToLocalChecked(), Nan::New<v8::Boolean>(results[i].is_writeable));
-            Nan::Set(fileObj, Nan::New("is_symlink").ToLocalChecked(), Nan::New<v8::Boolean>(results[i].is_symlink));
-            Nan::Set(fileObj, Nan::New("filesystem").ToLocalChecked(), Nan::New(results[i].filesystem).ToLocalChecked());
-            Nan::Set(fileObj, Nan::New("content_type").ToLocalChecked(), Nan::New(results[i].mimetype).ToLocalChecked());
-            Nan::Set(fileObj, Nan::New("size").ToLocalChecked(), Nan::New<v8::Number>(results[i].size));
-            Nan::Set(fileObj, Nan::New("mtime").ToLocalChecked(), Nan::New<v8::Number>(results[i].mtime));
-            Nan::Set(fileObj, Nan::New("atime").ToLocalChecked(), Nan::New<v8::Number>(results[i].atime));
-            Nan::Set(fileObj, Nan::New("ctime").ToLocalChecked(), Nan::New<v8::Number>(results[i].ctime));
-
-            Nan::Set(resultArray, i, fileObj);
+    // Theme, the themes it inherits from depth first, then Adwaita and hicolor
+    void theme_chain(const std::string& name, std::vector<std::shared_ptr<IconTheme>>& chain, std::set<std::string>& seen) {
+        if (!seen.insert(name).second) {
+            return;
+        }
+        std::shared_ptr<IconTheme> theme = theme_for(name);
+        if (!theme) {
+            return;
+        }
+        chain.push_back(theme);
+        for (const auto& parent : theme->inherits) {
+            theme_chain(parent, chain, seen);
         }
+    }
 
-        v8::Local<v8::Value> argv[] = { Nan::Null(), resultArray };
-        callback->Call(2, argv);
+    // Closest match of name in theme, an exact size match ends the search
+    static std::string find_in_theme(const IconTheme& theme, const std::string& name, int size) {
+        static const char* extensions[] = { ".png", ".svg", ".xpm" };
+        std::string best;
+        int best_distance = INT_MAX;
+        for (const auto& dir : theme.dirs) {
+            for (const char* extension : extensions) {
+                std::string file = name + extension;
+                if (dir.files.count(file) == 0) {
+                    continue;
+                }
+                if (dir.matches(size)) {
+                    return dir.path + "/" + file;
+                }
+                int distance = dir.distance(size);
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = dir.path + "/" + file;
+                }
+                break;
+            }
+        }
+        return best;
     }
 
-    void HandleErrorCallback() {
+    // File of the first of names found in the theme chain, then in the unthemed folders
+    std::string find_file(const gchar* const* names, int size, const std::string& theme) {
+
+        std::vector<std::shared_ptr<IconTheme>> chain;
+        std::set<std::string> seen;
+        theme_chain(theme, chain, seen);
+        theme_chain("Adwaita", chain, seen);
+        theme_chain("hicolor", chain, seen);
+
+        for (const gchar* const* name = names; name != NULL && *name != NULL; name++) {
+            for (const auto& item : chain) {
+                std::string path = find_in_theme(*item, *name, size);
+                if (!path.empty()) {
+                    return path;
+                }
+            }
+        }
+
+        std::vector<std::string> bases = base_dirs();
+        for (const gchar* const* name = names; name != NULL && *name != NULL; name++) {
+            for (const auto& base : bases) {
+                for (const char* extension : { ".png", ".svg", ".xpm" }) {
+                    std::string path = base + "/" + *name + extension;
+                    if (g_file_test(path.c_str(), G_FILE_TEST_IS_REGULAR)) {
+                        return path;
+                    }
+                }
+            }
+        }
+        return "";
+
+    }
+
+    GSettings* settings = NULL;
+    std::mutex mutex;
+    std::map<std::string, std::shared_ptr<IconTheme>> themes;     // null for themes not installed
+    std::list<std::pair<std::string, std::string>> entries;       // cache key, PNG, most recent first
+    std::unordered_map<std::string, std::list<std::pair<std::string, std::string>>::iterator> index;
+};
+
+// PNG of the icon of source at size, from IconLookup
+static bool file_icon_png(const std::string& source, int size, std::string& png, GError** error) {
+    GFile* file = new_file_for(source.c_str());
+    GFileInfo* file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_ICON, G_FILE_QUERY_INFO_NONE, NULL, error);
+    g_object_unref(file);
+    if (file_info == NULL) {
+        return false;
+    }
+    GIcon* icon = g_file_info_get_icon(file_info);
+    bool rendered = false;
+    if (icon == NULL) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "No icon for %s", source.c_str());
+    } else {
+        rendered = IconLookup::get().render(icon, size, png, error);
+    }
+    g_object_unref(file_info);
+    return rendered;
+}
+
+static std::string png_data_url(const std::string& png) {
+    gchar* encoded = g_base64_encode(reinterpret_cast<const guchar*>(png.data()), png.size());
+    std::string url = std::string("data:image/png;base64,") + encoded;
+    g_free(encoded);
+    return url;
+}
+
+// Key get_icons shares the icon of item under: its content type, inode/directory for every
+// folder. Paths and uris are read for their type and guessed content type, anything else is
+// taken as a content type already. Empty when the file can not be read.
+static std::string icon_key(const std::string& item) {
+
+    char* scheme = g_uri_parse_scheme(item.c_str());
+    bool is_file = scheme != NULL || (!item.empty() && item[0] == '/');
+    g_free(scheme);
+    if (!is_file) {
+        return item;
+    }
+    GFile* file = new_file_for(item.c_str());
+    GFileInfo* file_info = g_file_query_info(file, G_FILE_ATTRIBUTE_STANDARD_TYPE "," G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE,
+                                             G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    g_object_unref(file);
+    if (file_info == NULL) {
+        return "";
+    }
+    std::string key = "application/octet-stream";
+    const char* content_type = g_file_info_get_attribute_string(file_info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE);
+    if (g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY) {
+        key = "inode/directory";
+    } else if (content_type != NULL) {
+        key = content_type;
+    }
+    g_object_unref(file_info);
+    return key;
+
+}
+
+// Resolves the icons of get_icons off the JS thread. Each distinct key is rendered once,
+// through the same cache as get_file_icon_data_url.
+class IconsWorker : public Nan::AsyncWorker {
+public:
+    IconsWorker(Nan::Callback *callback, std::vector<std::string>&& items, int size)
+        : Nan::AsyncWorker(callback), items(std::move(items)), size(size) {}
+
+    void Execute() {
+        std::unordered_set<std::string> seen;
+        keys.reserve(items.size());
+        for (const auto& item : items) {
+            keys.push_back(icon_key(item));
+            const std::string& key = keys.back();
+            if (key.empty() || !seen.insert(key).second) {
+                continue;
+            }
+            GIcon* icon = g_content_type_get_icon(key.c_str());
+            std::string png;
+            IconLookup::get().render(icon, size, png, NULL);
+            g_object_unref(icon);
+            icons.emplace_back(key, png);
+        }
+    }
+
+    void HandleOKCallback() {
         Nan::HandleScope scope;
 
-        v8::Local<v8::Value> argv[] = {
-            Nan::New(this->ErrorMessage()).ToLocalChecked()
-        };
-        callback->Call(1, argv);
+        v8::Local<v8::Object> icon_map = Nan::New<v8::Object>();
+        for (const auto& icon : icons) {
+            v8::Local<v8::Value> url = Nan::Null();
+            if (!icon.second.empty()) {
+                url = Nan::New(png_data_url(icon.second)).ToLocalChecked();
+            }
+            Nan::Set(icon_map, Nan::New(icon.first).ToLocalChecked(), url);
+        }
+        v8::Local<v8::Array> item_keys = Nan::New<v8::Array>(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            v8::Local<v8::Value> key = Nan::Null();
+            if (!keys[i].empty()) {
+                key = Nan::New(keys[i]).ToLocalChecked();
+            }
+            Nan::Set(item_keys, i, key);
+        }
+
+        v8::Local<v8::Object> result = Nan::New<v8::Object>();
+        Nan::Set(result, Nan::New("icons").ToLocalChecked(), icon_map);
+        Nan::Set(result, Nan::New("items").ToLocalChecked(), item_keys);
+        v8::Local<v8::Value> argv[] = { Nan::Null(), result };
+        callback->Call(2, argv);
     }
 
 private:
-    struct FileResult {
-        std::string name;
-        std::string display_name;
-        std::string href;
-        std::string location;
-        bool is_hidden;
-        bool is_directory;
-        std::string mimetype;
-        bool is_symlink;
-        bool is_writeable;
-        bool is_readable;
-        std::string filesystem;
-        gint64 size;
-        gint64 mtime;
-        gint64 atime;
-        gint64 ctime;
-    };
-
-    std::string source;
-    std::vector<FileResult> results;
+    std::vector<std::string> items;
+    int size;
+    std::vector<std::string> keys;                              // per item
+    std::vector<std::pair<std::string, std::string>> icons;     // key, PNG, in first seen order
 };
 
+// Feeds a file monitor event into the open index covering the file
+static void index_update(GFile* file, bool exists) {
+    std::string location = file_location(file);
+    std::shared_ptr<FileIndex> index = IndexRegistry::find(location);
+    if (!index || location == index->get_root()) {
+        return;
+    }
+    bool is_dir = exists && g_file_query_file_type(file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) == G_FILE_TYPE_DIRECTORY;
+    index->changed(location, exists, is_dir);
+}
+
+static void index_file_changed(GFile* file, GFile* other_file, GFileMonitorEvent event_type) {
+    switch (event_type) {
+        case G_FILE_MONITOR_EVENT_CREATED:
+        case G_FILE_MONITOR_EVENT_MOVED_IN:
+            index_update(file, true);
+            break;
+        case G_FILE_MONITOR_EVENT_DELETED:
+        case G_FILE_MONITOR_EVENT_MOVED_OUT:
+            index_update(file, false);
+            break;
+        case G_FILE_MONITOR_EVENT_MOVED:
+        case G_FILE_MONITOR_EVENT_RENAMED:
+            index_update(file, false);
+            if (other_file != NULL) {
+                index_update(other_file, true);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
 namespace gio {
 
     using v8::FunctionCallbackInfo;
@@ -215,18 +6373,23 @@ namespace gio {
 
         public:
 
-        static NAN_METHOD(ls) {
+        // Synchronous listing, runs the enumerator on the calling thread
+        // ls_sync(path, [options], callback)
+        static NAN_METHOD(ls_sync) {
 
             Nan::HandleScope scope;
 
-            // start time
-            // auto start = std::chrono::high_resolution_clock::now();
-
-            if (info.Length() < 2 || !info[1]->IsFunction()) {
+            if (info.Length() < 2 || !info[info.Length() - 1]->IsFunction()) {
                 return Nan::ThrowError("Wrong arguments. Expected callback function.");
             }
 
-            Nan::Callback callback(info[1].As<v8::Function>());
+            Nan::Callback callback(info[info.Length() - 1].As<v8::Function>());
+
+            guint32 fields;
+            std::string fields_error;
+            if (!get_fields_option(info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>(), LS_FIELDS, fields, fields_error)) {
+                return Nan::ThrowTypeError(fields_error.c_str());
+            }
 
             v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
             v8::Isolate* isolate = info.GetIsolate();
@@ -236,143 +6399,68 @@ namespace gio {
             v8::String::Utf8Value sourceFile(context->GetIsolate(), sourceString);
             v8::Local<v8::Array> resultArray = Nan::New<v8::Array>();
 
-            GFile* src = g_file_new_for_path(*sourceFile);
-
-            const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-            if (src_scheme != NULL) {
-                src = g_file_new_for_uri(*sourceFile);
-            }
+            GFile* src = new_file_for(*sourceFile);
 
             GError* error = NULL;
             guint index = 0;
             GFileEnumerator* enumerator = g_file_enumerate_children(src,
-                                                                    FILE_INFO_ATTRIBUTES,
+                                                                    fields_to_attributes(fields).c_str(),
                                                                     G_FILE_QUERY_INFO_NONE,
                                                                     NULL,
                                                                     &error);
 
-            // auto t1 = std::chrono::high_resolution_clock::now();
-            // auto t1_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - start);
-            // printf("Elapsed time 1: %ld milliseconds\n", t1_elapsed.count());
-
             if (enumerator == NULL) {
-                // Error handling
+                g_object_unref(src);
                 if (error != NULL) {
-                    return Nan::ThrowError(error->message);
-                } else {
-                    return Nan::ThrowError("Unknown error occurred");
+                    std::string message = error->message;
+                    g_error_free(error);
+                    return Nan::ThrowError(message.c_str());
                 }
-
-                // Clean up resources
-                g_object_unref(src);
-                return; // Return an error code
+                return Nan::ThrowError("Unknown error occurred");
             }
 
-            if (error != NULL) {
-                g_error_free(error);
-                g_object_unref(src);
-                return Nan::ThrowError(error->message);
-            }
+            char* location = g_file_get_path(src);
+            std::string src_location = location ? location : *sourceFile;
+            g_free(location);
 
-            // auto t2 = std::chrono::high_resolution_clock::now();
-            // auto t2_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
-            // printf("Elapsed time 2: %ld milliseconds\n", t2_elapsed.count());
+            bool columns = info.Length() > 2 && get_columns_option(info[1]);
+            FileBatch results;
 
             GFileInfo* file_info = NULL;
             while ((file_info = g_file_enumerator_next_file(enumerator, NULL, &error)) != NULL) {
 
-                const char* filename = g_file_info_get_name(file_info);
-                const char* display_name = g_file_info_get_display_name(file_info);
-                GFile* file = g_file_get_child(src, filename);
-                const char* href = g_file_get_path(file);
-                GFile* parent = g_file_get_parent(file);
-                const char* location = g_file_get_path(parent);
-                gboolean is_hidden = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
-                                     ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
-                                     : FALSE;
-                gboolean is_directory = g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY;
-                const char* mimetype = g_file_info_get_content_type(file_info);
-                gboolean is_symlink = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
-                                      ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
-                                      : FALSE;
-                gboolean  is_writeable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE);
-                gboolean is_readable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ);
-                const char* fs_type = g_file_info_get_attribute_string(file_info, G_FILE_ATTRIBUTE_FILESYSTEM_TYPE);
-                std::string filesystem = fs_type ? fs_type : "unknown";
-
-                v8::Local<v8::Object> fileObj = Nan::New<v8::Object>();
-                Nan::Set(fileObj, Nan::New("name").ToLocalChecked(), Nan::New(filename).ToLocalChecked());
-                Nan::Set(fileObj, Nan::New("display_name").ToLocalChecked(), Nan::New(display_name).ToLocalChecked());
-                Nan::Set(fileObj, Nan::New("href").ToLocalChecked(), Nan::New(href).ToLocalChecked());
-                Nan::Set(fileObj, Nan::New("location").ToLocalChecked(), Nan::New(location).ToLocalChecked());
-                Nan::Set(fileObj, Nan::New("is_dir").ToLocalChecked(), Nan::New<v8::Boolean>(is_directory));
-                Nan::Set(fileObj, Nan::New("is_hidden").ToLocalChecked(), Nan::New<v8::Boolean>(is_hidden));
-                Nan::Set(fileObj, Nan::New("is_readable").ToLocalChecked(), Nan::New<v8::Boolean>(is_readable));
-                Nan::Set(fileObj, Nan::New("is_writable").ToLocalChecked(), Nan::New<v8::Boolean>(is_writeable));
-                Nan::Set(fileObj, Nan::New("is_symlink").ToLocalChecked(), Nan::New<v8::Boolean>(is_symlink));
-                Nan::Set(fileObj, Nan::New("filesystem").ToLocalChecked(), Nan::New(filesystem).ToLocalChecked());
-
-                if (mimetype != nullptr) {
-                    Nan::Set(fileObj, Nan::New("content_type").ToLocalChecked(), Nan::New(mimetype).ToLocalChecked());
-                }
-
-                gint64 size = g_file_info_get_size(file_info);
-                Nan::Set(fileObj, Nan::New("size").ToLocalChecked(), Nan::New<v8::Number>(size));
-
-                // GTimeVal mtime_val;
-                GDateTime* mtime_dt = g_file_info_get_modification_date_time(file_info);
-                if (mtime_dt != NULL) {
-                    gint64 mtime = g_date_time_to_unix(mtime_dt);
-                    Nan::Set(fileObj, Nan::New("mtime").ToLocalChecked(), Nan::New<v8::Number>(mtime));
-                    g_date_time_unref(mtime_dt);
-                }
-
-                // Get the access time (atime)
-                GDateTime* atime_dt = g_file_info_get_access_date_time(file_info);
-                if (atime_dt != NULL) {
-                    gint64 atime = g_date_time_to_unix(atime_dt);
-                    Nan::Set(fileObj, Nan::New("atime").ToLocalChecked(), Nan::New<v8::Number>(atime));
-                    g_date_time_unref(atime_dt);
-                }
-
-                // // Get the change time (ctime)
-                GDateTime* ctime_dt = g_file_info_get_creation_date_time(file_info);
-                if (ctime_dt != NULL) {
-                    gint64 ctime = g_date_time_to_unix(ctime_dt);
-                    Nan::Set(fileObj, Nan::New("ctime").ToLocalChecked(), Nan::New<v8::Number>(ctime));
-                    g_date_time_unref(ctime_dt);
-                }
-
-                Nan::Set(resultArray, index++, fileObj);
-
-                g_object_unref(file);
-                g_object_unref(parent);
+                FileResult fileResult;
+                get_child_result(src, src_location, file_info, fields, fileResult);
+                if (columns) {
+                    results.push_back(fileResult);
+                } else {
+                    Nan::Set(resultArray, index++, file_result_to_object(fileResult));
+                }
                 g_object_unref(file_info);
 
             }
 
+            g_file_enumerator_close(enumerator, NULL, NULL);
+            g_object_unref(enumerator);
+            g_object_unref(src);
+
             if (error != NULL) {
+                std::string message = error->message;
                 g_error_free(error);
-                return Nan::ThrowError(error->message);
+                return Nan::ThrowError(message.c_str());
             }
 
-            // auto t3 = std::chrono::high_resolution_clock::now();
-            // auto t3_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t2);
-            // printf("Elapsed time 3: %ld milliseconds\n", t3_elapsed.count());
-
-            g_object_unref(enumerator);
-            g_object_unref(src);
-
-            // end time
-            // auto end = std::chrono::high_resolution_clock::now();
-            // std::chrono::duration<double> elapsed = end - start;
-            // printf("total elapsed time: %f seconds\n", elapsed.count());
+            v8::Local<v8::Value> result = resultArray;
+            if (columns) {
+                result = file_batch_to_columns(results, src_location, fields);
+            }
 
-            v8::Local<v8::Value> argv[] = { Nan::Null(), resultArray };
+            v8::Local<v8::Value> argv[] = { Nan::Null(), result };
             callback.Call(2, argv);
 
         }
 
+        // get_file(path, [options])
         static NAN_METHOD(get_file) {
 
             Nan::HandleScope scope;
@@ -381,145 +6469,63 @@ namespace gio {
                 return Nan::ThrowError("Wrong number of arguments");
             }
 
+            guint32 fields;
+            std::string fields_error;
+            if (!get_fields_option(info.Length() > 1 ? info[1] : Nan::Undefined().As<v8::Value>(), GET_FILE_FIELDS, fields, fields_error)) {
+                return Nan::ThrowTypeError(fields_error.c_str());
+            }
+
             v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
             v8::Isolate* isolate = info.GetIsolate();
 
-            Nan::Callback callback(info[1].As<v8::Function>());
-
             // Get the current context from the execution context
             v8::Local<v8::Context> context = isolate->GetCurrentContext();
             v8::String::Utf8Value sourceFile(context->GetIsolate(), sourceString);
-            v8::Local<v8::Array> resultArray = Nan::New<v8::Array>();
-
-            // if (!g_file_test(*sourceFile, G_FILE_TEST_IS_REGULAR) && !g_file_test(*sourceFile, G_FILE_TEST_IS_DIR)) {
-            //     return Nan::ThrowError("Error: File does not exist.");
-            // }
-
-            GFile* src = g_file_new_for_path(*sourceFile);
 
-            const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-            if (src_scheme != NULL) {
-                src = g_file_new_for_uri(*sourceFile);
-            }
+            GFile* src = new_file_for(*sourceFile);
 
             GError* error = NULL;
             GFileInfo* file_info = g_file_query_info(src,
-                                                    FILE_INFO_ATTRIBUTES,
+                                                    fields_to_attributes(fields).c_str(),
                                                     G_FILE_QUERY_INFO_NONE,
                                                     NULL,
                                                     &error);
 
             if (!file_info) {
-                return Nan::ThrowError("Error: Could not get file info.");
-            }
-
-            if (error != NULL) {
                 g_object_unref(src);
-                return Nan::ThrowError(error->message);
+                if (error != NULL) {
+                    g_error_free(error);
+                }
+                return Nan::ThrowError("Error: Could not get file info.");
             }
 
             const char* filename = g_file_info_get_name(file_info);
             if (filename != nullptr) {
 
-                const char* display_name = g_file_info_get_display_name(file_info);
-                const char* href = g_file_get_path(src);
-                gboolean is_hidden = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
-                                     ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN)
-                                     : FALSE;
-                gboolean is_directory = g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY;
-                const char* mimetype = g_file_info_get_content_type(file_info);
-                GFile* parent = g_file_get_parent(src);
-                gboolean is_writeable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE);
-                gboolean is_readable = g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ);
-                gboolean is_symlink = g_file_info_has_attribute(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
-                                      ? g_file_info_get_attribute_boolean(file_info, G_FILE_ATTRIBUTE_STANDARD_IS_SYMLINK)
-                                      : FALSE;
-
-                v8::Local<v8::Object> fileObj = Nan::New<v8::Object>();
-                Nan::Set(fileObj, Nan::New("name").ToLocalChecked(), Nan::New(filename).ToLocalChecked());
-                Nan::Set(fileObj, Nan::New("display_name").ToLocalChecked(), Nan::New(display_name).ToLocalChecked());
-                Nan::Set(fileObj, Nan::New("href").ToLocalChecked(), Nan::New(href).ToLocalChecked());
-                Nan::Set(fileObj, Nan::New("is_dir").ToLocalChecked(), Nan::New<v8::Boolean>(is_directory));
-                Nan::Set(fileObj, Nan::New("is_hidden").ToLocalChecked(), Nan::New<v8::Boolean>(is_hidden));
-                Nan::Set(fileObj, Nan::New("is_writable").ToLocalChecked(), Nan::New<v8::Boolean>(is_writeable));
-                Nan::Set(fileObj, Nan::New("is_readable").ToLocalChecked(), Nan::New<v8::Boolean>(is_readable));
-                Nan::Set(fileObj, Nan::New("is_symlink").ToLocalChecked(), Nan::New<v8::Boolean>(is_symlink));
-
-                if (parent != nullptr) {
-                    const char* location = g_file_get_path(parent);
-                    if (location != nullptr) {
-                        Nan::Set(fileObj, Nan::New("location").ToLocalChecked(), Nan::New(location).ToLocalChecked());
-                    }
-                }
-
-                const char* owner = g_file_info_get_attribute_as_string(file_info, G_FILE_ATTRIBUTE_OWNER_USER);
-                if (!owner) {
-                    owner = "Unknown";
-                }
-                Nan::Set(fileObj, Nan::New("owner").ToLocalChecked(), Nan::New(owner).ToLocalChecked());
-
-                const char* group = g_file_info_get_attribute_as_string(file_info, G_FILE_ATTRIBUTE_OWNER_GROUP);
-                if (!group) {
-                    group = "Unknown";
-                }
-                Nan::Set(fileObj, Nan::New("group").ToLocalChecked(), Nan::New(group).ToLocalChecked());
-
-                gint32 permissions;
-                permissions = g_file_info_get_attribute_uint32 (file_info, G_FILE_ATTRIBUTE_UNIX_MODE);
-                // permissions & (S_IRWXU | S_IRWXG | S_IRWXO);
-                Nan::Set(fileObj, Nan::New("permissions").ToLocalChecked(), Nan::New<v8::Int32>(permissions));
-
-                // Check if execution bit is set
-                gboolean is_execute = g_file_info_get_attribute_boolean(file_info,
-                                                                        G_FILE_ATTRIBUTE_ACCESS_CAN_EXECUTE);
+                FileResult fileResult;
+                get_file_result(file_info, fields, fileResult);
 
-                Nan::Set(fileObj, Nan::New("is_execute").ToLocalChecked(), Nan::New<v8::Boolean>(is_execute));
+                char* href = g_file_get_path(src);
+                fileResult.href = href ? href : *sourceFile;
+                g_free(href);
 
-                // // Nan::Set(fileObj, Nan::New("is_writable").ToLocalChecked(), Nan::New<v8::Boolean>(is_writable));
-                // // Nan::Set(fileObj, Nan::New("content_type").ToLocalChecked(), Nan::New(mimetype).ToLocalChecked());
-                if (mimetype != nullptr) {
-                Nan::Set(fileObj, Nan::New("content_type").ToLocalChecked(), Nan::New(mimetype).ToLocalChecked());
+                GFile* parent = g_file_get_parent(src);
+                if (parent != nullptr) {
+                    char* location = g_file_get_path(parent);
+                    fileResult.location = location ? location : "";
+                    g_free(location);
+                    g_object_unref(parent);
                 } else {
-                    Nan::Set(fileObj, Nan::New("content_type").ToLocalChecked(), Nan::Null());
-                }
-
-                gint64 size = g_file_info_get_size(file_info);
-                Nan::Set(fileObj, Nan::New("size").ToLocalChecked(), Nan::New<v8::Number>(size));
-
-                // GTimeVal mtime_val;
-                GDateTime* mtime_dt = g_file_info_get_modification_date_time(file_info);
-                if (mtime_dt != NULL) {
-                    gint64 mtime = g_date_time_to_unix(mtime_dt);
-                    Nan::Set(fileObj, Nan::New("mtime").ToLocalChecked(), Nan::New<v8::Number>(mtime));
-                    g_date_time_unref(mtime_dt);
-                }
-
-                // Get the access time (atime)
-                GDateTime* atime_dt = g_file_info_get_access_date_time(file_info);
-                if (atime_dt != NULL) {
-                    gint64 atime = g_date_time_to_unix(atime_dt);
-                    Nan::Set(fileObj, Nan::New("atime").ToLocalChecked(), Nan::New<v8::Number>(atime));
-                    g_date_time_unref(atime_dt);
-                }
-
-                // // Get the change time (ctime)
-                GDateTime* ctime_dt = g_file_info_get_creation_date_time(file_info);
-                if (ctime_dt != NULL) {
-                    gint64 ctime = g_date_time_to_unix(ctime_dt);
-                    Nan::Set(fileObj, Nan::New("ctime").ToLocalChecked(), Nan::New<v8::Number>(ctime));
-                    g_date_time_unref(ctime_dt);
+                    // the root of a filesystem has no location
+                    fileResult.fields &= ~FIELD_LOCATION;
                 }
 
-                g_object_unref(file_info);
-                g_object_unref(src);
-                info.GetReturnValue().Set(fileObj);
+                info.GetReturnValue().Set(file_result_to_object(fileResult));
 
             }
 
-            // g_object_unref(src);
-
-            // v8::Local<v8::Value> argv[] = { Nan::Null(), resultArray };
-            // callback.Call(2, argv);
+            g_object_unref(file_info);
+            g_object_unref(src);
 
         }
 
@@ -775,392 +6781,483 @@ namespace gio {
 
         }
 
+        // thumbnail(source, destination, [size]) makes a thumbnail of size pixels (75 by default)
+        // on its longer edge on the calling thread, thumbnails() does the same on a thread pool
         static NAN_METHOD(thumbnail) {
 
             if (info.Length() < 2) {
                 return Nan::ThrowError("Wrong number of arguments");
             }
-            v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
-            v8::Local<v8::String> destString = Nan::To<v8::String>(info[1]).ToLocalChecked();
-            v8::Isolate* isolate = info.GetIsolate();
-            v8::String::Utf8Value sourceFile(isolate, sourceString);
-            v8::String::Utf8Value destFile(isolate, destString);
+            Nan::Utf8String sourceFile(info[0]);
+            Nan::Utf8String destFile(info[1]);
+            if (*sourceFile == NULL || *destFile == NULL) {
+                return Nan::ThrowTypeError("Expected source and destination strings");
+            }
 
-            GFile* src = g_file_new_for_path(*sourceFile);
-            GFile* dest = g_file_new_for_path(*destFile);
+            int size = info.Length() > 2 && info[2]->IsNumber() ? Nan::To<int32_t>(info[2]).FromJust() : THUMBNAIL_SIZE;
+            size = std::clamp(size, THUMBNAIL_MIN_SIZE, THUMBNAIL_MAX_SIZE);
 
-            const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-            const char *dest_scheme = g_uri_parse_scheme(*destFile);
-            if (src_scheme != NULL) {
-                src = g_file_new_for_uri(*sourceFile);
+            GError* error = NULL;
+            if (!make_thumbnail(*sourceFile, *destFile, size, &error)) {
+                std::string message = error != NULL ? error->message : "Error creating thumbnail";
+                g_clear_error(&error);
+                return Nan::ThrowError(message.c_str());
             }
+        }
 
-            if (dest_scheme != NULL) {
-                dest = g_file_new_for_uri(*destFile);
-            }
+        // thumbnail_path(source, [size]) returns the cached thumbnail of source when the shared
+        // cache has one for the current version of the file, null otherwise. Nothing is decoded.
+        static NAN_METHOD(thumbnail_path) {
 
-            GdkPixbuf *inputPixbuf = gdk_pixbuf_new_from_file(g_file_get_path(src), NULL);
-            if (inputPixbuf == nullptr) {
-                return;
+            if (info.Length() < 1) {
+                return Nan::ThrowError("Wrong number of arguments");
             }
-            int thumbnailWidth = 75;  // Adjust the width as per your requirements
-            int thumbnailHeight = 75; // Adjust the height as per your requirements
-
-            GdkPixbuf* oriented_pixbuf = gdk_pixbuf_apply_embedded_orientation(inputPixbuf);
-            GdkPixbuf *thumbnailPixbuf = gdk_pixbuf_scale_simple(oriented_pixbuf,
-                                                                thumbnailWidth,
-                                                                thumbnailHeight,
-                                                                GDK_INTERP_BILINEAR);
+            Nan::Utf8String sourceFile(info[0]);
+            if (*sourceFile == NULL) {
+                return Nan::ThrowTypeError("Expected a source string");
+            }
+            int size = info.Length() > 1 && info[1]->IsNumber() ? Nan::To<int32_t>(info[1]).FromJust() : THUMBNAIL_SIZE;
 
-            if (thumbnailPixbuf == nullptr) {
-                return;
+            ThumbnailCache::Entry entry;
+            if (ThumbnailCache::lookup(*sourceFile, size, entry, NULL) && ThumbnailCache::is_valid(entry.path, entry)) {
+                info.GetReturnValue().Set(Nan::New(entry.path).ToLocalChecked());
+            } else {
+                info.GetReturnValue().SetNull();
             }
 
-            GError* error = NULL;
-            GdkPixbufFormat* fileType = gdk_pixbuf_get_file_info(g_file_get_path(src), NULL, NULL);
-            if (fileType != NULL) {
-                // const char *outputFile = dest; // Adjust the file extension as per your requirements
-                gdk_pixbuf_save(thumbnailPixbuf,
-                                g_file_get_path(dest),
-                                gdk_pixbuf_format_get_name(fileType),
-                                NULL,
-                                NULL,
-                                &error);
-
-                // g_object_unref(thumbnailPixbuf);
-            }
-
-            g_object_unref(oriented_pixbuf);
-            g_object_unref(thumbnailPixbuf);
-            g_object_unref(inputPixbuf);
-            g_object_unref(src);
-            g_object_unref(dest);
         }
 
-        static thread_local goffset bytes_copied;
-        static thread_local goffset bytes_copied0;
-
-        static void
-        progress_callback(goffset current_num_bytes,
-                        goffset total_bytes,
-                        gpointer user_data) {
+        // thumbnail_prioritize(id, priority) moves the waiting thumbnails of a batch ahead of
+        // or behind the others, also available as prioritize(priority) on the batch handle
+        static NAN_METHOD(thumbnail_prioritize) {
 
-            Nan::HandleScope scope;
-            if (user_data == NULL) {
-                printf("User data is NULL\n");
-                return;
+            v8::Local<v8::Value> id = info.Data()->IsNumber() ? info.Data() : info[0];
+            v8::Local<v8::Value> priority = info.Data()->IsNumber() ? info[0] : info[1];
+            if (!id->IsNumber() || !priority->IsNumber()) {
+                return Nan::ThrowTypeError("Expected an operation id and a priority");
             }
 
-            bytes_copied = current_num_bytes - bytes_copied0;
-            bytes_copied0 = current_num_bytes;
-            v8::Local<v8::Object> dataObj = Nan::New<v8::Object>();
-            Nan::Set(dataObj, Nan::New("current_num_bytes").ToLocalChecked(), Nan::New<v8::Number>(current_num_bytes));
-            Nan::Set(dataObj, Nan::New("bytes_copied").ToLocalChecked(), Nan::New<v8::Number>(bytes_copied));
-            Nan::Set(dataObj, Nan::New("total_bytes").ToLocalChecked(), Nan::New<v8::Number>(total_bytes));
+            ThumbnailService& service = ThumbnailService::get();
+            std::shared_ptr<ThumbnailBatch> batch = service.find(Nan::To<uint32_t>(id).FromJust());
+            if (batch) {
+                service.reprioritize(batch, Nan::To<int32_t>(priority).FromJust());
+            }
+            info.GetReturnValue().Set(Nan::New<v8::Boolean>(batch != nullptr));
 
-            Nan::Callback* callback = static_cast<Nan::Callback*>(user_data);
-            const unsigned argc = 2;
-            v8::Local<v8::Value> argv[argc] = { Nan::Null(), dataObj };
-            callback->Call(argc, argv);
         }
 
-        static thread_local Nan::Persistent<v8::Object> persistentHandle;
-
-        static
-        NAN_METHOD(cp_async) {
+        // Makes thumbnails on a background thread pool, thumbnails(items, [options], callback)
+        // with items [{source, destination}], options.priority (higher first, default 0) and
+        // options.size (longer edge in pixels, default 75). Items given as a path, or without
+        // a destination, go through the shared thumbnail cache and report the cached file.
+        // callback(err, {index, source, destination, error}, done) is called as each thumbnail
+        // is done and once more with {total, done, failed, cancelled}. Returns the operation
+        // handle of the batch with prioritize(priority) added, cancelling it drops the
+        // thumbnails that were not started.
+        static NAN_METHOD(thumbnails) {
 
             Nan::HandleScope scope;
 
-            if (info.Length() < 3) {
-                return Nan::ThrowError("Wrong number of arguments");
+            if (info.Length() < 2 || !info[0]->IsArray() || !info[info.Length() - 1]->IsFunction()) {
+                return Nan::ThrowError("Wrong arguments. Expected thumbnails(items, [options], callback).");
             }
 
-            v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
-            v8::Local<v8::String> destString = Nan::To<v8::String>(info[1]).ToLocalChecked();
-            Nan::Callback* callback = new Nan::Callback(info[2].As<v8::Function>());
+            v8::Local<v8::Value> options = info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>();
+            v8::Local<v8::Array> item_arr = info[0].As<v8::Array>();
+            v8::Local<v8::String> source_key = Nan::New("source").ToLocalChecked();
+            v8::Local<v8::String> destination_key = Nan::New("destination").ToLocalChecked();
+
+            std::shared_ptr<ThumbnailBatch> batch = std::make_shared<ThumbnailBatch>();
+            std::vector<ThumbnailRequest> requests;
+            requests.reserve(item_arr->Length());
+            for (uint32_t i = 0; i < item_arr->Length(); i++) {
+                v8::Local<v8::Value> element = Nan::Get(item_arr, i).ToLocalChecked();
+                if (element->IsString()) {
+                    requests.push_back({ batch, i, *Nan::Utf8String(element), "", 0 });
+                    continue;
+                }
+                if (!element->IsObject()) {
+                    return Nan::ThrowTypeError("Expected an array of paths or {source, destination} objects");
+                }
+                v8::Local<v8::Object> obj = element.As<v8::Object>();
+                Nan::Utf8String sourceFile(Nan::Get(obj, source_key).ToLocalChecked());
+                v8::Local<v8::Value> destination = Nan::Get(obj, destination_key).ToLocalChecked();
+                if (*sourceFile == NULL || !(destination->IsString() || destination->IsUndefined())) {
+                    return Nan::ThrowTypeError("Expected source and destination strings");
+                }
+                requests.push_back({ batch, i, *sourceFile, destination->IsString() ? *Nan::Utf8String(destination) : "", 0 });
+            }
 
-            v8::Isolate* isolate = info.GetIsolate();
-            v8::String::Utf8Value sourceFile(isolate, sourceString);
-            v8::String::Utf8Value destFile(isolate, destString);
+            batch->priority = get_int_option(options, "priority", 0);
+            batch->size = std::clamp(get_int_option(options, "size", THUMBNAIL_SIZE), THUMBNAIL_MIN_SIZE, THUMBNAIL_MAX_SIZE);
+            batch->operation = OperationRegistry::create("thumbnail", requests.empty() ? "" : requests[0].source);
+            batch->callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+            batch->resource = new Nan::AsyncResource("gio::thumbnails");
 
-            GFile* src = g_file_new_for_path(*sourceFile);
-            GFile* dest = g_file_new_for_path(*destFile);
+            v8::Local<v8::Object> handle = operation_handle(*batch->operation);
+            v8::Local<v8::Value> id = Nan::New<v8::Uint32>(batch->operation->id);
+            Nan::Set(handle, Nan::New("prioritize").ToLocalChecked(),
+                     Nan::GetFunction(Nan::New<v8::FunctionTemplate>(thumbnail_prioritize, id)).ToLocalChecked());
 
-            const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-            const char *dest_scheme = g_uri_parse_scheme(*destFile);
-            if (src_scheme != NULL) {
-                src = g_file_new_for_uri(*sourceFile);
-            }
-            if (dest_scheme != NULL) {
-                dest = g_file_new_for_uri(*destFile);
-            }
+            ThumbnailService::get().submit(batch, std::move(requests));
+            info.GetReturnValue().Set(handle);
 
-            GCancellable* cancellable = g_cancellable_new();
+        }
 
-            v8::Local<v8::Object> obj = Nan::New<v8::Object>();
-            Nan::Set(obj, Nan::New("cancellable").ToLocalChecked(), Nan::New<v8::External>(cancellable));
-            persistentHandle.Reset(obj);
+        // State of a move running on the JS thread
+        struct MoveProgress {
+            Nan::Callback* callback;
+            Operation* operation;
+            goffset reported;
+        };
 
-            GError* error = nullptr;
-            gboolean result = g_file_copy(src,
-                                        dest,
-                                        G_FILE_COPY_ALL_METADATA,
-                                        cancellable,
-                                        (GFileProgressCallback) gio::progress_callback,
-                                        callback,
-                                        // new Nan::Callback(info[info.Length() - 1].As<v8::Function>()),
-                                        &error);
+        // Calls into JS only when the meter of the move has a report due, bytes_copied
+        // is the number of bytes moved since the previous report
+        static void move_progress(goffset current_num_bytes, goffset total_bytes, gpointer user_data) {
 
-            if (!result) {
+            MoveProgress* move = static_cast<MoveProgress*>(user_data);
+            ProgressRate rate;
+            if (!move->operation->progress(current_num_bytes, total_bytes, rate)) {
+                return;
+            }
 
-                v8::Local<v8::Value> argv[] = {
-                    Nan::New(error->message).ToLocalChecked()
-                };
-                callback->Call(1, argv);
-                g_error_free(error);
+            Nan::HandleScope scope;
+            v8::Local<v8::Object> dataObj = Nan::New<v8::Object>();
+            Nan::Set(dataObj, key(KEY_CURRENT_NUM_BYTES), Nan::New<v8::Number>(current_num_bytes));
+            Nan::Set(dataObj, key(KEY_BYTES_COPIED), Nan::New<v8::Number>(current_num_bytes - move->reported));
+            Nan::Set(dataObj, key(KEY_TOTAL_BYTES), Nan::New<v8::Number>(total_bytes));
+            set_rate_properties(dataObj, rate);
+            move->reported = current_num_bytes;
+
+            v8::Local<v8::Value> argv[] = { Nan::Null(), dataObj };
+            move->callback->Call(2, argv);
+        }
 
-            } else {
+        // Copies a file on the libuv threadpool, cp_async(source, destination, [options], callback, [progress])
+        // with options.reflink ('auto', 'always' or 'never'), options.resume, options.progress_interval and
+        // options.progress_bytes. callback(err, {current_num_bytes, bytes_copied, total_bytes, rate, smoothed_rate, eta}) is called
+        // once when the copy is done, progress receives the same object while copying. Returns the operation
+        // handle of the copy.
+        static
+        NAN_METHOD(cp_async) {
 
-                v8::Local<v8::Object> dataObj = Nan::New<v8::Object>();
-                Nan::Set(dataObj, Nan::New("current_num_bytes").ToLocalChecked(), Nan::New<v8::Number>(0));
-                Nan::Set(dataObj, Nan::New("bytes_copied").ToLocalChecked(), Nan::New<v8::Number>(0));
-                Nan::Set(dataObj, Nan::New("total_bytes").ToLocalChecked(), Nan::New<v8::Number>(0));
+            Nan::HandleScope scope;
 
-                v8::Local<v8::Value> argv[] = {
-                    Nan::Null(),
-                    dataObj
-                };
-                callback->Call(2, argv);
+            int arg = info.Length() > 2 && info[2]->IsObject() && !info[2]->IsFunction() ? 3 : 2;
+            if (info.Length() <= arg || !info[arg]->IsFunction()) {
+                return Nan::ThrowError("Wrong number of arguments");
             }
 
+            Nan::Utf8String sourceFile(info[0]);
+            Nan::Utf8String destFile(info[1]);
+            if (*sourceFile == NULL || *destFile == NULL) {
+                return Nan::ThrowTypeError("Expected source and destination strings");
+            }
 
-            bytes_copied0 = 0;
-            bytes_copied = 0;
+            ReflinkMode reflink = REFLINK_AUTO;
+            std::string reflink_error;
+            if (arg == 3 && !get_reflink_option(info[2], reflink, reflink_error)) {
+                return Nan::ThrowTypeError(reflink_error.c_str());
+            }
+            bool resume = arg == 3 && get_bool_option(info[2], "resume", false);
 
-            g_object_unref(src);
-            g_object_unref(dest);
+            Nan::Callback* callback = new Nan::Callback(info[arg].As<v8::Function>());
+            Nan::Callback* progress = info.Length() > arg + 1 && info[arg + 1]->IsFunction()
+                                      ? new Nan::Callback(info[arg + 1].As<v8::Function>())
+                                      : NULL;
+
+            CopyFileWorker* worker = new CopyFileWorker(callback, progress, *sourceFile, *destFile, reflink, resume);
+            if (arg == 3) {
+                get_progress_options(info[2], worker->get_operation().meter);
+            }
+            v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+            Nan::AsyncQueueWorker(worker);
+            info.GetReturnValue().Set(handle);
 
         }
 
+        // cp_cancel([id]) cancels one operation, without an id every running copy is cancelled
         static NAN_METHOD(cp_cancel) {
             Nan::HandleScope scope;
-            v8::Local<v8::Object> obj = Nan::New(persistentHandle);
-            GCancellable* cancellable =
-                static_cast<GCancellable*>(v8::Local<v8::External>::Cast(Nan::Get(obj,
-                                            Nan::New("cancellable").ToLocalChecked()).ToLocalChecked())->Value());
 
-            g_cancellable_cancel(cancellable);
+            if (info.Length() > 0 && info[0]->IsNumber()) {
+                return operation_cancel(info);
+            }
+            OperationRegistry::cancel_type("copy");
         }
 
+        // Copies a list of {source, destination, is_dir, size} entries on background threads,
+        // cp_arr(jobs, [options], callback) with options.threads (per destination device,
+        // picked from the device when 0), overwrite, follow_symlinks, resume, reflink,
+        // progress_interval and progress_bytes.
+        // callback(err, totals, done) gets {bytes, total_bytes, files, total_files, errors, rate,
+        // smoothed_rate, eta} while copying, the final totals add error_list and cancelled.
+        // Returns the operation handle of the batch.
         static
         NAN_METHOD(cp_arr) {
 
             Nan::HandleScope scope;
 
-            if (info.Length() < 2) {
-                printf("Wrong number of arguments\n");
-                return Nan::ThrowError("Wrong number of arguments");
+            if (info.Length() < 2 || !info[0]->IsArray() || !info[info.Length() - 1]->IsFunction()) {
+                return Nan::ThrowError("Wrong arguments. Expected cp_arr(jobs, [options], callback).");
             }
 
-            v8::Local<v8::Array> copy_arr = v8::Local<v8::Array>::Cast(info[0]);
-
-            v8::Isolate* isolate = info.GetIsolate();
-            v8::Local<v8::Context> context = isolate->GetCurrentContext();
+            v8::Local<v8::Value> options = info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>();
+            CopyBatchOptions batch_options;
+            batch_options.threads = std::clamp(get_int_option(options, "threads", batch_options.threads), 0, 64);
+            batch_options.overwrite = get_bool_option(options, "overwrite", batch_options.overwrite);
+            batch_options.follow_symlinks = get_bool_option(options, "follow_symlinks", batch_options.follow_symlinks);
+            batch_options.resume = get_bool_option(options, "resume", batch_options.resume);
+            std::string reflink_error;
+            if (!get_reflink_option(options, batch_options.reflink, reflink_error)) {
+                return Nan::ThrowTypeError(reflink_error.c_str());
+            }
 
-            GError* error = NULL;
-            gboolean r = FALSE;
+            v8::Local<v8::Array> copy_arr = info[0].As<v8::Array>();
+            v8::Local<v8::String> source_key = Nan::New("source").ToLocalChecked();
+            v8::Local<v8::String> destination_key = Nan::New("destination").ToLocalChecked();
+            v8::Local<v8::String> is_dir_key = Nan::New("is_dir").ToLocalChecked();
+            v8::Local<v8::String> size_key = Nan::New("size").ToLocalChecked();
 
-            for (unsigned int i = 0; i < copy_arr->Length(); i++) {
+            std::vector<CopyJob> jobs;
+            jobs.reserve(copy_arr->Length());
+            for (uint32_t i = 0; i < copy_arr->Length(); i++) {
 
-                v8::Local<v8::Value> element = copy_arr->Get(context, i).ToLocalChecked();
+                v8::Local<v8::Value> element = Nan::Get(copy_arr, i).ToLocalChecked();
+                if (!element->IsObject()) {
+                    return Nan::ThrowTypeError("Expected an array of {source, destination} objects");
+                }
                 v8::Local<v8::Object> obj = element.As<v8::Object>();
 
-                // Get the 'source' property
-                v8::Local<v8::String> sourceKey = v8::String::NewFromUtf8(isolate, "source").ToLocalChecked();
-                v8::Local<v8::Value> sourceValue = obj->Get(context, sourceKey).ToLocalChecked();
-
-                // Get the 'destination' property
-                v8::Local<v8::String> destKey = v8::String::NewFromUtf8(isolate, "destination").ToLocalChecked();
-                v8::Local<v8::Value> destValue = obj->Get(context, destKey).ToLocalChecked();
-
-                // get is_dir property as boolean
-                v8::Local<v8::String> isDirKey = v8::String::NewFromUtf8(isolate, "is_dir").ToLocalChecked();
-                v8::Local<v8::Value> isDirValue = obj->Get(context, isDirKey).ToLocalChecked();
-                gboolean is_directory = isDirValue->BooleanValue(isolate);
-
-                // print string
-                v8::String::Utf8Value sourceFile(isolate, sourceValue);
-                v8::String::Utf8Value destFile(isolate, destValue);
-
-                GFile* src = g_file_new_for_path(*sourceFile);
-                GFile* dest = g_file_new_for_path(*destFile);
-
-                const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-                const char *dest_scheme = g_uri_parse_scheme(*destFile);
-
-                if (src_scheme != NULL) {
-                    src = g_file_new_for_uri(*sourceFile);
+                Nan::Utf8String sourceFile(Nan::Get(obj, source_key).ToLocalChecked());
+                Nan::Utf8String destFile(Nan::Get(obj, destination_key).ToLocalChecked());
+                if (*sourceFile == NULL || *destFile == NULL) {
+                    return Nan::ThrowTypeError("Expected source and destination strings");
                 }
 
-                if (dest_scheme != NULL) {
-                    dest = g_file_new_for_uri(*destFile);
+                CopyJob job;
+                job.source = *sourceFile;
+                job.destination = *destFile;
+                job.is_dir = Nan::To<bool>(Nan::Get(obj, is_dir_key).ToLocalChecked()).FromMaybe(false);
+                v8::Local<v8::Value> size = Nan::Get(obj, size_key).ToLocalChecked();
+                if (size->IsNumber() || size->IsString()) {
+                    job.size = (goffset)Nan::To<double>(size).FromMaybe(-1);
                 }
+                jobs.push_back(std::move(job));
 
-                // // print file names
-                // printf("Source: %s\n", g_file_get_path(src));
-                // printf("Destination: %s\n", g_file_get_path(dest));
-
-                GCancellable* cancellable = g_cancellable_new();
-                Nan::Callback* callback = new Nan::Callback(info[1].As<v8::Function>());
-                Nan::Set(obj, Nan::New("cancellable").ToLocalChecked(), Nan::New<v8::External>(cancellable));
-                persistentHandle.Reset(obj);
+            }
 
-                // // check if source is a directory
-                // GFileInfo* file_info = g_file_query_info(src,
-                //                                         "*",
-                //                                         G_FILE_QUERY_INFO_NONE,
-                //                                         NULL,
-                //                                         &error);
+            Nan::Callback* callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+            CopyBatchWorker* worker = new CopyBatchWorker(callback, std::move(jobs), batch_options);
+            get_progress_options(options, worker->get_operation().meter);
+            v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+            Nan::AsyncQueueWorker(worker);
+            info.GetReturnValue().Set(handle);
 
-                // if (file_info) {
+        }
 
-                    // gboolean is_directory = g_file_info_get_file_type(file_info) == G_FILE_TYPE_DIRECTORY;
-                    if (is_directory) {
+        // mv(source, destination, [options], callback) moves a file on the calling thread, callback
+        // gets the progress of moves that have to copy, paced by options.progress_interval and
+        // options.progress_bytes. Registered as a "move" operation.
+        static NAN_METHOD(mv) {
 
-                        r = g_file_make_directory_with_parents(dest, cancellable, &error);
+            if (info.Length() < 3 || !info[info.Length() - 1]->IsFunction()) {
+                return Nan::ThrowError("Wrong number of arguments");
+            }
 
-                        if (!r) {
+            Nan::Utf8String sourceFile(info[0]);
+            Nan::Utf8String destFile(info[1]);
+            if (*sourceFile == NULL || *destFile == NULL) {
+                return Nan::ThrowTypeError("Expected source and destination strings");
+            }
 
-                            char err[100];
-                            sprintf(err, "error creating directory: %s", g_file_get_path(dest));
+            GFile* src = new_file_for(*sourceFile);
+            GFile* dest = new_file_for(*destFile);
+            Nan::Callback callback(info[info.Length() - 1].As<v8::Function>());
+            std::shared_ptr<Operation> operation = OperationRegistry::create("move", *sourceFile);
+            if (info.Length() > 3) {
+                get_progress_options(info[2], operation->meter);
+            }
+            MoveProgress move = { &callback, operation.get(), 0 };
 
-                            v8::Local<v8::Value> argv[] = {
-                                Nan::New(err).ToLocalChecked()
-                            };
-                            callback->Call(1, argv);
-                        }
+            GError *error = NULL;
+            gboolean res = g_file_move(
+                src,
+                dest,
+                G_FILE_COPY_NONE,
+                operation->cancellable,
+                move_progress,
+                &move,
+                &error
+            );
 
-                        if (error) {
-                            v8::Local<v8::Value> argv[] = {
-                                Nan::New(error->message).ToLocalChecked()
-                            };
-                            callback->Call(1, argv);
-                            g_error_free(error);
-                        }
+            g_object_unref(src);
+            g_object_unref(dest);
+            operation->finish(res);
+            OperationRegistry::remove(operation->id);
 
-                    } else {
-                        r = g_file_copy(src,
-                                        dest,
-                                        G_FILE_COPY_ALL_METADATA,
-                                        cancellable,
-                                        (GFileProgressCallback) gio::progress_callback,
-                                        callback,
-                                        &error);
-                        if (r) {
+            if (res == FALSE) {
+                std::string message = error->message;
+                g_error_free(error);
+                return Nan::ThrowError(message.c_str());
+            }
 
-                            v8::Local<v8::Object> dataObj = Nan::New<v8::Object>();
-                            Nan::Set(dataObj, Nan::New("current_num_bytes").ToLocalChecked(), Nan::New<v8::Number>(0));
-                            Nan::Set(dataObj, Nan::New("bytes_copied").ToLocalChecked(), Nan::New<v8::Number>(0));
-                            Nan::Set(dataObj, Nan::New("total_bytes").ToLocalChecked(), Nan::New<v8::Number>(0));
+            info.GetReturnValue().Set(Nan::True());
 
-                            v8::Local<v8::Value> argv[] = {
-                                Nan::Null(),
-                                dataObj
-                            };
-                            callback->Call(2, argv);
+        }
 
-                        } else {
+        // Moves a list of {source, destination} items on a background thread,
+        // mv_arr(items, [options], callback) with options.overwrite, threads (for the copies
+        // across devices), progress_interval and progress_bytes. Items on the same filesystem
+        // are renamed, the others are copied and their sources deleted. callback(err, totals,
+        // done) gets the same totals as cp_arr, the final totals add moved, the sources that
+        // were moved. Returns the operation handle of the move.
+        static
+        NAN_METHOD(mv_arr) {
 
-                            // char err[150];
-                            // sprintf(err, "{\"filename\": \"%s\", \"err\": \"%s\"}", g_file_get_path(src), error->message);
-                            v8::Local<v8::Value> argv[] = {
-                                Nan::New(error->message).ToLocalChecked()
-                            };
-                            callback->Call(1, argv);
+            Nan::HandleScope scope;
 
-                        }
+            if (info.Length() < 2 || !info[0]->IsArray() || !info[info.Length() - 1]->IsFunction()) {
+                return Nan::ThrowError("Wrong arguments. Expected mv_arr(items, [options], callback).");
+            }
 
-                    }
+            v8::Local<v8::Value> options = info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>();
+            MoveOptions move_options;
+            move_options.threads = std::clamp(get_int_option(options, "threads", move_options.threads), 0, 64);
+            move_options.overwrite = get_bool_option(options, "overwrite", move_options.overwrite);
 
+            v8::Local<v8::Array> move_arr = info[0].As<v8::Array>();
+            v8::Local<v8::String> source_key = Nan::New("source").ToLocalChecked();
+            v8::Local<v8::String> destination_key = Nan::New("destination").ToLocalChecked();
 
-                    // g_object_unref(file_info);
+            std::vector<CopyJob> items;
+            items.reserve(move_arr->Length());
+            for (uint32_t i = 0; i < move_arr->Length(); i++) {
 
-                // }
+                v8::Local<v8::Value> element = Nan::Get(move_arr, i).ToLocalChecked();
+                if (!element->IsObject()) {
+                    return Nan::ThrowTypeError("Expected an array of {source, destination} objects");
+                }
+                v8::Local<v8::Object> obj = element.As<v8::Object>();
 
-                bytes_copied0 = 0;
-                bytes_copied = 0;
+                Nan::Utf8String sourceFile(Nan::Get(obj, source_key).ToLocalChecked());
+                Nan::Utf8String destFile(Nan::Get(obj, destination_key).ToLocalChecked());
+                if (*sourceFile == NULL || *destFile == NULL) {
+                    return Nan::ThrowTypeError("Expected source and destination strings");
+                }
 
-                g_object_unref(src);
-                g_object_unref(dest);
+                CopyJob item;
+                item.source = *sourceFile;
+                item.destination = *destFile;
+                item.item = i;
+                items.push_back(std::move(item));
 
             }
 
-            // if (error) {
-            //     // Print the error message
-            //     fprintf(stderr, "Error: %s\n", error->message);
-
-            //     // Free the GError object
-            //     g_error_free(error);
-            // } else {
-            //     printf("Operation succeeded.\n");
-            // }
-
-            // if (res == FALSE) {
-            //     return Nan::ThrowError(error->message);
-            // }
-
-            info.GetReturnValue().Set(Nan::True());
-
+            Nan::Callback* callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+            MoveBatchWorker* worker = new MoveBatchWorker(callback, std::move(items), move_options);
+            get_progress_options(options, worker->get_operation().meter);
+            v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+            Nan::AsyncQueueWorker(worker);
+            info.GetReturnValue().Set(handle);
 
         }
 
-        static NAN_METHOD(mv) {
-
-            if (info.Length() < 2) {
-                return Nan::ThrowError("Wrong number of arguments");
-            }
-
-            v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
-            v8::Local<v8::String> destString = Nan::To<v8::String>(info[1]).ToLocalChecked();
-
-            v8::Isolate* isolate = info.GetIsolate();
-            v8::String::Utf8Value sourceFile(isolate, sourceString);
-            v8::String::Utf8Value destFile(isolate, destString);
+        // Scans what a paste would copy before it starts, plan_transfer(sources, [destination],
+        // [options], callback). sources are paths or uris copied into the destination folder
+        // under their own name, or {source, destination} objects. The folder may be left out
+        // (undefined or null) when every source is an object, free space is then checked where
+        // the first one goes. options.threads (scanner threads per item, default 4) and
+        // options.jobs (false to leave out the job list).
+        // See PlanTransferWorker for the callback. Returns the operation handle of the scan.
+        static
+        NAN_METHOD(plan_transfer) {
 
-            GFile* src = g_file_new_for_path(*sourceFile);
-            GFile* dest = g_file_new_for_path(*destFile);
+            Nan::HandleScope scope;
 
-            const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-            const char *dest_scheme = g_uri_parse_scheme(*destFile);
-            if (src_scheme != NULL) {
-                src = g_file_new_for_uri(*sourceFile);
-            }
-            if (dest_scheme != NULL) {
-                dest = g_file_new_for_uri(*destFile);
+            if (info.Length() < 2 || !info[0]->IsArray() || !info[info.Length() - 1]->IsFunction()) {
+                return Nan::ThrowError("Wrong arguments. Expected plan_transfer(sources, [destination], [options], callback).");
             }
 
-            GError *error = NULL;
-            gboolean res = g_file_move(
-                src,
-                dest,
-                G_FILE_COPY_NONE,
-                NULL,
-                (GFileProgressCallback) gio::progress_callback,
-                new Nan::Callback(info[info.Length() - 1].As<v8::Function>()),
-                &error
-            );
-
-            bytes_copied0 = 0;
-            bytes_copied = 0;
+            // plan_transfer(sources, options, callback) without a folder
+            bool has_folder = info.Length() > 2 && info[1]->IsString();
+            bool options_second = info.Length() == 3 && info[1]->IsObject();
+            if (info.Length() > 2 && !has_folder && !options_second && !info[1]->IsNullOrUndefined()) {
+                return Nan::ThrowTypeError("Expected a destination string");
+            }
+            std::string destination = has_folder ? *Nan::Utf8String(info[1]) : "";
 
-            g_object_unref(src);
-            g_object_unref(dest);
+            v8::Local<v8::Value> options = Nan::Undefined();
+            if (options_second) {
+                options = info[1];
+            } else if (info.Length() > 3) {
+                options = info[2];
+            }
+            PlanOptions plan_options;
+            plan_options.threads = std::clamp(get_int_option(options, "threads", plan_options.threads), 1, TreeScanner::max_threads());
+            plan_options.jobs = get_bool_option(options, "jobs", plan_options.jobs);
+
+            v8::Local<v8::Array> source_arr = info[0].As<v8::Array>();
+            v8::Local<v8::String> source_key = Nan::New("source").ToLocalChecked();
+            v8::Local<v8::String> destination_key = Nan::New("destination").ToLocalChecked();
+            GFile* dest_dir = has_folder ? new_file_for(destination.c_str()) : NULL;
+
+            std::vector<CopyJob> items;
+            items.reserve(source_arr->Length());
+            for (uint32_t i = 0; i < source_arr->Length(); i++) {
+
+                v8::Local<v8::Value> element = Nan::Get(source_arr, i).ToLocalChecked();
+                CopyJob item;
+                if (element->IsString() && dest_dir == NULL) {
+                    return Nan::ThrowTypeError("Expected a destination string for sources given as paths");
+                } else if (element->IsString()) {
+                    item.source = *Nan::Utf8String(element);
+                    GFile* src = new_file_for(item.source.c_str());
+                    char* name = g_file_get_basename(src);
+                    GFile* dest = g_file_get_child(dest_dir, name);
+                    item.destination = file_location(dest);
+                    g_object_unref(dest);
+                    g_free(name);
+                    g_object_unref(src);
+                } else if (element->IsObject()) {
+                    v8::Local<v8::Object> obj = element.As<v8::Object>();
+                    Nan::Utf8String sourceFile(Nan::Get(obj, source_key).ToLocalChecked());
+                    Nan::Utf8String destFile(Nan::Get(obj, destination_key).ToLocalChecked());
+                    if (*sourceFile == NULL || *destFile == NULL) {
+                        if (dest_dir != NULL) {
+                            g_object_unref(dest_dir);
+                        }
+                        return Nan::ThrowTypeError("Expected source and destination strings");
+                    }
+                    item.source = *sourceFile;
+                    item.destination = *destFile;
+                } else {
+                    if (dest_dir != NULL) {
+                        g_object_unref(dest_dir);
+                    }
+                    return Nan::ThrowTypeError("Expected an array of paths or {source, destination} objects");
+                }
+                item.item = i;
+                items.push_back(std::move(item));
 
-            if (res == FALSE) {
-                return Nan::ThrowError(error->message);
+            }
+            if (dest_dir != NULL) {
+                g_object_unref(dest_dir);
+            } else if (!items.empty()) {
+                GFile* first = new_file_for(items[0].destination.c_str());
+                GFile* parent = g_file_get_parent(first);
+                destination = file_location(parent != NULL ? parent : first);
+                if (parent != NULL) {
+                    g_object_unref(parent);
+                }
+                g_object_unref(first);
             }
 
-            info.GetReturnValue().Set(Nan::True());
+            Nan::Callback* callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+            PlanTransferWorker* worker = new PlanTransferWorker(callback, std::move(items), destination, plan_options);
+            v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+            Nan::AsyncQueueWorker(worker);
+            info.GetReturnValue().Set(handle);
 
         }
 
@@ -1189,7 +7286,7 @@ namespace gio {
 
                 const unsigned argc = 2;
                 v8::Local<v8::Object> dataObj = Nan::New<v8::Object>();
-                Nan::Set(dataObj, Nan::New("name").ToLocalChecked(), Nan::New("connected").ToLocalChecked());
+                Nan::Set(dataObj, key(KEY_NAME), Nan::New("connected").ToLocalChecked());
                 v8::Local<v8::Value> argv[argc] = { Nan::Null(), dataObj };
                 callback->Call(argc, argv);
 
@@ -1304,36 +7401,298 @@ namespace gio {
             //     location = g_file_new_for_uri(uri);
             //     g_free(uri);
 
-            }
+            }
+
+            // g_object_unref(location);
+            g_object_unref(mount_operation);
+
+            // info.GetReturnValue().SetUndefined();
+
+        }
+
+        private:
+
+    };
+
+    // Asynchronous listing, the enumerator runs on the libuv threadpool
+    // ls(path, [options], callback) where options.fields limits the attributes queried
+    // and options.format = 'columns' returns typed arrays instead of an array of objects
+    NAN_METHOD(ls) {
+        if (info.Length() < 2 || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowError("Wrong arguments. Expected callback function.");
+        }
+
+        guint32 fields;
+        std::string fields_error;
+        if (!get_fields_option(info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>(), LS_FIELDS, fields, fields_error)) {
+            return Nan::ThrowTypeError(fields_error.c_str());
+        }
+
+        v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
+        v8::String::Utf8Value sourceFile(info.GetIsolate(), sourceString);
+        Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+
+        bool columns = info.Length() > 2 && get_columns_option(info[1]);
+
+        Nan::AsyncQueueWorker(new ListFilesWorker(callback, std::string(*sourceFile), fields, columns));
+    }
+
+    // Streaming listing, ls_stream(path, [options], callback) where options.batch_size
+    // sets the number of entries per chunk and options.fields limits the attributes queried.
+    // Returns the operation handle of the listing.
+    NAN_METHOD(ls_stream) {
+        if (info.Length() < 2 || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowError("Wrong arguments. Expected callback function.");
+        }
+
+        guint32 fields;
+        std::string fields_error;
+        if (!get_fields_option(info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>(), LS_FIELDS, fields, fields_error)) {
+            return Nan::ThrowTypeError(fields_error.c_str());
+        }
+
+        int batch_size = 512;
+        if (info.Length() > 2) {
+            batch_size = std::max(1, get_int_option(info[1], "batch_size", batch_size));
+        }
+
+        v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
+        v8::String::Utf8Value sourceFile(info.GetIsolate(), sourceString);
+        Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+
+        ListStreamWorker* worker = new ListStreamWorker(callback, std::string(*sourceFile), batch_size, fields);
+        v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+        Nan::AsyncQueueWorker(worker);
+        info.GetReturnValue().Set(handle);
+    }
+
+    // Recursive traversal, walk(root, [options], callback) calls callback(err, files, done)
+    // with batches of entries. Options: max_depth, symlinks ('skip', 'list' or 'follow'),
+    // show_hidden, include_root, batch_size, threads and fields. Entries carry their depth below root.
+    // Returns the operation handle of the walk.
+    NAN_METHOD(walk) {
+        if (info.Length() < 2 || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowError("Wrong arguments. Expected callback function.");
+        }
+
+        v8::Local<v8::Value> options = info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>();
+
+        WalkOptions walk_options;
+        std::string fields_error;
+        if (!get_fields_option(options, WALK_FIELDS, walk_options.fields, fields_error)) {
+            return Nan::ThrowTypeError(fields_error.c_str());
+        }
+
+        std::string symlinks = get_string_option(options, "symlinks", "list");
+        if (symlinks == "skip") {
+            walk_options.symlinks = SYMLINKS_SKIP;
+        } else if (symlinks == "follow") {
+            walk_options.symlinks = SYMLINKS_FOLLOW;
+        } else if (symlinks != "list") {
+            return Nan::ThrowTypeError("options.symlinks must be 'skip', 'list' or 'follow'");
+        }
+
+        walk_options.max_depth = get_int_option(options, "max_depth", walk_options.max_depth);
+        walk_options.show_hidden = get_bool_option(options, "show_hidden", walk_options.show_hidden);
+        walk_options.include_root = get_bool_option(options, "include_root", walk_options.include_root);
+        walk_options.batch_size = std::max(1, get_int_option(options, "batch_size", walk_options.batch_size));
+        walk_options.threads = std::clamp(get_int_option(options, "threads", walk_options.threads), 1, TreeScanner::max_threads());
+
+        v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
+        v8::String::Utf8Value sourceFile(info.GetIsolate(), sourceString);
+        Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+
+        WalkWorker* worker = new WalkWorker(callback, std::string(*sourceFile), walk_options);
+        v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+        Nan::AsyncQueueWorker(worker);
+        info.GetReturnValue().Set(handle);
+    }
+
+    // Search, find(query, location, [options], callback) calls callback(err, files, done) with
+    // batches of hits, the last call also gets {root, built} when an index answered, else null.
+    // Options: match ('substring', 'glob' or 'regex'), case_sensitive, show_hidden, type ('file'
+    // or 'dir'), min_size, max_size, mtime_from, mtime_to (unix seconds), max_results, batch_size,
+    // threads, use_index, max_index_age (seconds) and fields. Returning false stops the search.
+    // Returns the operation handle of the search.
+    NAN_METHOD(find) {
+        if (info.Length() < 3 || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowError("Wrong arguments. Expected find(query, location, [options], callback).");
+        }
+
+        v8::Local<v8::Value> options = info.Length() > 3 ? info[2] : Nan::Undefined().As<v8::Value>();
+
+        FindOptions find_options;
+        std::string fields_error;
+        if (!get_fields_option(options, FIND_FIELDS, find_options.fields, fields_error)) {
+            return Nan::ThrowTypeError(fields_error.c_str());
+        }
+
+        std::string match = get_string_option(options, "match", "substring");
+        if (match == "glob") {
+            find_options.mode = NameMatcher::GLOB;
+        } else if (match == "regex") {
+            find_options.mode = NameMatcher::REGEX;
+        } else if (match != "substring") {
+            return Nan::ThrowTypeError("options.match must be 'substring', 'glob' or 'regex'");
+        }
+
+        std::string type = get_string_option(options, "type", "");
+        if (type == "file") {
+            find_options.type = G_FILE_TYPE_REGULAR;
+        } else if (type == "dir") {
+            find_options.type = G_FILE_TYPE_DIRECTORY;
+        } else if (!type.empty()) {
+            return Nan::ThrowTypeError("options.type must be 'file' or 'dir'");
+        }
+
+        find_options.case_sensitive = get_bool_option(options, "case_sensitive", find_options.case_sensitive);
+        find_options.show_hidden = get_bool_option(options, "show_hidden", find_options.show_hidden);
+        find_options.min_size = get_int64_option(options, "min_size", find_options.min_size);
+        find_options.max_size = get_int64_option(options, "max_size", find_options.max_size);
+        find_options.mtime_from = get_int64_option(options, "mtime_from", find_options.mtime_from);
+        find_options.mtime_to = get_int64_option(options, "mtime_to", find_options.mtime_to);
+        find_options.max_results = std::max(1, get_int_option(options, "max_results", find_options.max_results));
+        find_options.batch_size = std::max(1, get_int_option(options, "batch_size", find_options.batch_size));
+        find_options.threads = std::clamp(get_int_option(options, "threads", find_options.threads), 1, TreeScanner::max_threads());
+        find_options.use_index = get_bool_option(options, "use_index", find_options.use_index);
+        find_options.max_index_age = get_int64_option(options, "max_index_age", find_options.max_index_age);
+
+        Nan::Utf8String query(info[0]);
+        Nan::Utf8String location(info[1]);
+        if (*query == NULL || *location == NULL) {
+            return Nan::ThrowTypeError("Wrong arguments. Expected strings for query and location.");
+        }
+
+        Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+        FindWorker* worker = new FindWorker(callback, *query, *location, find_options);
+        if (!worker->get_matcher().valid()) {
+            std::string error = "Invalid pattern: " + worker->get_matcher().error();
+            delete worker;
+            return Nan::ThrowError(error.c_str());
+        }
+
+        v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+        Nan::AsyncQueueWorker(worker);
+        info.GetReturnValue().Set(handle);
+    }
+
+    // Live operations started by copy, move, walk, find and ls_stream, operations() returns
+    // their status objects
+    NAN_METHOD(operations) {
+        v8::Local<v8::Array> result = Nan::New<v8::Array>();
+        uint32_t index = 0;
+        for (const std::shared_ptr<Operation>& operation : OperationRegistry::list()) {
+            Nan::Set(result, index++, operation_to_object(*operation));
+        }
+        info.GetReturnValue().Set(result);
+    }
+
+    // Builds the search index of a tree, index_build(root, [options], callback) with
+    // options.file (defaults to the user cache dir) and options.threads. The index is
+    // opened when done, callback(err, {root, file, count, built}).
+    NAN_METHOD(index_build) {
+        if (info.Length() < 2 || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowError("Wrong arguments. Expected callback function.");
+        }
+
+        v8::Local<v8::Value> options = info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>();
+        std::string file = get_string_option(options, "file", "");
+        int threads = std::clamp(get_int_option(options, "threads", 4), 1, TreeScanner::max_threads());
+
+        Nan::Utf8String root(info[0]);
+        Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+        Nan::AsyncQueueWorker(new IndexBuildWorker(callback, *root ? *root : "", file, threads));
+    }
+
+    // Maps an existing index of root, index_open(root, [file]) returns false when there is none
+    NAN_METHOD(index_open) {
+        if (info.Length() < 1 || !info[0]->IsString()) {
+            return Nan::ThrowTypeError("Wrong arguments. Expected index_open(root, [file]).");
+        }
+
+        Nan::Utf8String source(info[0]);
+        GFile* src = new_file_for(*source);
+        std::string root = file_location(src);
+        g_object_unref(src);
 
-            // g_object_unref(location);
-            g_object_unref(mount_operation);
+        std::string file = FileIndex::default_file(root);
+        if (info.Length() > 1 && info[1]->IsString()) {
+            Nan::Utf8String file_arg(info[1]);
+            file = *file_arg;
+        }
 
-            // info.GetReturnValue().SetUndefined();
+        std::shared_ptr<FileIndex> index = std::make_shared<FileIndex>(root, file);
+        std::string error;
+        if (!index->open(error)) {
+            info.GetReturnValue().Set(Nan::False());
+            return;
+        }
+        IndexRegistry::add(index);
+        info.GetReturnValue().Set(Nan::True());
+    }
 
+    // Stops using the index of root, the file stays on disk
+    NAN_METHOD(index_close) {
+        if (info.Length() < 1 || !info[0]->IsString()) {
+            return Nan::ThrowTypeError("Wrong arguments. Expected index_close(root).");
         }
 
-        private:
+        Nan::Utf8String source(info[0]);
+        GFile* src = new_file_for(*source);
+        std::string root = file_location(src);
+        g_object_unref(src);
 
-    };
+        info.GetReturnValue().Set(Nan::New<v8::Boolean>(IndexRegistry::remove(root)));
+    }
 
-    NAN_METHOD(ls) {
-        if (info.Length() < 2 || !info[1]->IsFunction()) {
-            return Nan::ThrowError("Wrong arguments. Expected callback function.");
+    // Writes the changes seen since the index was built to its file, index_save(root, callback)
+    NAN_METHOD(index_save) {
+        if (info.Length() < 2 || !info[0]->IsString() || !info[1]->IsFunction()) {
+            return Nan::ThrowTypeError("Wrong arguments. Expected index_save(root, callback).");
         }
 
-        printf("ls called\n");
+        Nan::Utf8String source(info[0]);
+        GFile* src = new_file_for(*source);
+        std::shared_ptr<FileIndex> index = IndexRegistry::find(file_location(src));
+        g_object_unref(src);
+        if (!index) {
+            return Nan::ThrowError("No index is open for this location.");
+        }
 
-        v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
-        v8::String::Utf8Value sourceFile(info.GetIsolate(), sourceString);
         Nan::Callback *callback = new Nan::Callback(info[1].As<v8::Function>());
+        Nan::AsyncQueueWorker(new IndexCompactWorker(callback, index));
+    }
+
+    // index_stats(location) returns {root, file, count, added, removed, needs_save, built} of
+    // the index covering location, or undefined
+    NAN_METHOD(index_stats) {
+        if (info.Length() < 1 || !info[0]->IsString()) {
+            return Nan::ThrowTypeError("Wrong arguments. Expected index_stats(location).");
+        }
+
+        Nan::Utf8String source(info[0]);
+        GFile* src = new_file_for(*source);
+        std::shared_ptr<FileIndex> index = IndexRegistry::find(file_location(src));
+        g_object_unref(src);
+        if (!index) {
+            return;
+        }
 
-        Nan::AsyncQueueWorker(new ListFilesWorker(callback, std::string(*sourceFile)));
+        guint32 count = 0;
+        size_t added = 0, removed = 0;
+        index->stats(count, added, removed);
+
+        v8::Local<v8::Object> result = Nan::New<v8::Object>();
+        Nan::Set(result, key(KEY_ROOT), Nan::New(index->get_root()).ToLocalChecked());
+        Nan::Set(result, key(KEY_FILE), Nan::New(index->get_file()).ToLocalChecked());
+        Nan::Set(result, key(KEY_COUNT), Nan::New<v8::Number>(count));
+        Nan::Set(result, key(KEY_ADDED), Nan::New<v8::Number>(added));
+        Nan::Set(result, key(KEY_REMOVED), Nan::New<v8::Number>(removed));
+        Nan::Set(result, key(KEY_NEEDS_SAVE), Nan::New<v8::Boolean>(index->needs_compact()));
+        Nan::Set(result, key(KEY_BUILT), Nan::New<v8::Number>(index->get_built()));
+        info.GetReturnValue().Set(result);
     }
 
-    thread_local Nan::Persistent<v8::Object> gio::persistentHandle;
-    thread_local goffset gio::bytes_copied = 0;
-    thread_local goffset gio::bytes_copied0 = 0;
 
     NAN_METHOD(get_drives) {
 
@@ -1376,8 +7735,8 @@ namespace gio {
                 // printf("name: %s, uri: %s  \n", name, path);
 
                 v8::Local<v8::Object> dataObj = Nan::New<v8::Object>();
-                Nan::Set(dataObj, Nan::New("name").ToLocalChecked(), Nan::New(name).ToLocalChecked());
-                Nan::Set(dataObj, Nan::New("path").ToLocalChecked(), Nan::New(path).ToLocalChecked());
+                Nan::Set(dataObj, key(KEY_NAME), Nan::New(name).ToLocalChecked());
+                Nan::Set(dataObj, key(KEY_PATH), Nan::New(path).ToLocalChecked());
 
                 if (volume != NULL) {
                     type = g_volume_get_identifier(volume, G_VOLUME_IDENTIFIER_KIND_CLASS);
@@ -1392,7 +7751,7 @@ namespace gio {
                     type = "network";
                 }
 
-                Nan::Set(dataObj, Nan::New("type").ToLocalChecked(), Nan::New(type).ToLocalChecked());
+                Nan::Set(dataObj, key(KEY_TYPE), Nan::New(type).ToLocalChecked());
                 Nan::Set(resultArray, c, dataObj);
                 c++;
 
@@ -1470,8 +7829,8 @@ namespace gio {
                 // uuid = g_volume_get_identifier(volume, G_VOLUME_IDENTIFIER_KIND_UUID);
 
                 v8::Local<v8::Object> deviceObj = Nan::New<v8::Object>();
-                Nan::Set(deviceObj, Nan::New("name").ToLocalChecked(), Nan::New(name).ToLocalChecked());
-                Nan::Set(deviceObj, Nan::New("path").ToLocalChecked(), Nan::New(path).ToLocalChecked());
+                Nan::Set(deviceObj, key(KEY_NAME), Nan::New(name).ToLocalChecked());
+                Nan::Set(deviceObj, key(KEY_PATH), Nan::New(path).ToLocalChecked());
                 // Nan::Set(deviceObj, Nan::New("root").ToLocalChecked(), Nan::New(root).ToLocalChecked());
 
                 // if (uuid != NULL) {
@@ -1481,7 +7840,7 @@ namespace gio {
                 // get type of volume
                 type = g_volume_get_identifier(volume, G_VOLUME_IDENTIFIER_KIND_CLASS);
                 if (type != NULL) {
-                    Nan::Set(deviceObj, Nan::New("type").ToLocalChecked(), Nan::New(type).ToLocalChecked());
+                    Nan::Set(deviceObj, key(KEY_TYPE), Nan::New(type).ToLocalChecked());
                 }
 
                 Nan::Set(resultArray, c, deviceObj);
@@ -1534,16 +7893,16 @@ namespace gio {
                 if (uuid == "" && root == "") {
 
                     v8::Local<v8::Object> deviceObj = Nan::New<v8::Object>();
-                    Nan::Set(deviceObj, Nan::New("name").ToLocalChecked(), Nan::New(name).ToLocalChecked());
-                    Nan::Set(deviceObj, Nan::New("path").ToLocalChecked(), Nan::New(path).ToLocalChecked());
-                    Nan::Set(deviceObj, Nan::New("uuid").ToLocalChecked(), Nan::New(uuid).ToLocalChecked());
-                    Nan::Set(deviceObj, Nan::New("root").ToLocalChecked(), Nan::New(root).ToLocalChecked());
+                    Nan::Set(deviceObj, key(KEY_NAME), Nan::New(name).ToLocalChecked());
+                    Nan::Set(deviceObj, key(KEY_PATH), Nan::New(path).ToLocalChecked());
+                    Nan::Set(deviceObj, key(KEY_UUID), Nan::New(uuid).ToLocalChecked());
+                    Nan::Set(deviceObj, key(KEY_ROOT), Nan::New(root).ToLocalChecked());
 
                     type = g_volume_get_identifier(volume, G_VOLUME_IDENTIFIER_KIND_CLASS);
                     if (type == nullptr) {
                         type = "network";
                     }
-                    Nan::Set(deviceObj, Nan::New("type").ToLocalChecked(), Nan::New(type).ToLocalChecked());
+                    Nan::Set(deviceObj, key(KEY_TYPE), Nan::New(type).ToLocalChecked());
                     Nan::Set(resultArray, c, deviceObj);
                     ++c;
                 }
@@ -1713,11 +8072,22 @@ namespace gio {
             eventName = "unknown"; // Unknown event type, ignore
         }
 
-        const char* filename = g_file_get_path(file);
+        // keep open search indexes current
+        if (!IndexRegistry::empty()) {
+            index_file_changed(file, other_file, event_type);
+        }
+        // and cached du totals honest
+        DuCache::get().changed(file_location(file));
+        if (other_file != NULL) {
+            DuCache::get().changed(file_location(other_file));
+        }
+
+        char* filename = g_file_get_path(file);
 
         v8::Local<v8::Object> watcherObj = Nan::New<v8::Object>();
         Nan::Set(watcherObj, Nan::New("event").ToLocalChecked(), Nan::New(eventName).ToLocalChecked());
-        Nan::Set(watcherObj, Nan::New("filename").ToLocalChecked(), Nan::New(filename).ToLocalChecked());
+        Nan::Set(watcherObj, Nan::New("filename").ToLocalChecked(), Nan::New(filename ? filename : "").ToLocalChecked());
+        g_free(filename);
 
 
         Nan::Callback* callback = static_cast<Nan::Callback*>(user_data);
@@ -2055,12 +8425,12 @@ namespace gio {
             const char *app_id = g_app_info_get_id(app);
 
             v8::Local<v8::Object> file_obj = Nan::New<v8::Object>();
-            Nan::Set(file_obj, Nan::New("name").ToLocalChecked(), Nan::New(app_name).ToLocalChecked());
-            Nan::Set(file_obj, Nan::New("display").ToLocalChecked(), Nan::New(app_display_name).ToLocalChecked());
-            Nan::Set(file_obj, Nan::New("exec").ToLocalChecked(), Nan::New(app_exec).ToLocalChecked());
-            Nan::Set(file_obj, Nan::New("cmd").ToLocalChecked(), Nan::New(cmd).ToLocalChecked());
-            Nan::Set(file_obj, Nan::New("mimetype").ToLocalChecked(), Nan::New(mimetype).ToLocalChecked());
-            Nan::Set(file_obj, Nan::New("appid").ToLocalChecked(), Nan::New(app_id).ToLocalChecked());
+            Nan::Set(file_obj, key(KEY_NAME), Nan::New(app_name).ToLocalChecked());
+            Nan::Set(file_obj, key(KEY_DISPLAY), Nan::New(app_display_name).ToLocalChecked());
+            Nan::Set(file_obj, key(KEY_EXEC), Nan::New(app_exec).ToLocalChecked());
+            Nan::Set(file_obj, key(KEY_CMD), Nan::New(cmd).ToLocalChecked());
+            Nan::Set(file_obj, key(KEY_MIMETYPE), Nan::New(mimetype).ToLocalChecked());
+            Nan::Set(file_obj, key(KEY_APPID), Nan::New(app_id).ToLocalChecked());
             // Nan::Set(result, i, Nan::New(appName).ToLocalChecked());
             Nan::Set(result, i, file_obj);
             i++;
@@ -2072,6 +8442,11 @@ namespace gio {
         info.GetReturnValue().Set(result);
     }
 
+    // du(path, [options], [callback]) returns {size, allocated, files, folders, cached} for a
+    // whole tree. Options: one_file_system, threads and cache (results are reused until a
+    // watch event below the path drops them, or a directory mtime is seen to change when
+    // they are rechecked). With a callback it runs on the libuv threadpool, see DuWorker,
+    // without one it runs synchronously.
     NAN_METHOD(du) {
 
         if (info.Length() < 1) {
@@ -2079,24 +8454,49 @@ namespace gio {
             return;
         }
 
+        v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
+        v8::String::Utf8Value sourceFile(info.GetIsolate(), sourceString);
+
+        v8::Local<v8::Value> options = info.Length() > 1 && info[1]->IsObject() ? info[1] : Nan::Undefined().As<v8::Value>();
+        DuOptions du_options;
+        du_options.one_file_system = get_bool_option(options, "one_file_system", du_options.one_file_system);
+        du_options.cache = get_bool_option(options, "cache", du_options.cache);
+        du_options.threads = std::clamp(get_int_option(options, "threads", du_options.threads), 1, TreeScanner::max_threads());
+
+        if (info.Length() > 1 && info[info.Length() - 1]->IsFunction()) {
+            Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+            Nan::AsyncQueueWorker(new DuWorker(callback, std::string(*sourceFile), du_options));
+            return;
+        }
+
+        DuResult result;
+        std::string error;
+        if (!du_tree(std::string(*sourceFile), du_options, NULL, nullptr, result, error)) {
+            return Nan::ThrowError(error.c_str());
+        }
+        info.GetReturnValue().Set(du_result_to_object(result));
+
+    }
+
+    // Filesystem totals of the volume holding path, {total, used, free}
+    NAN_METHOD(disk_stats) {
+
+        if (info.Length() < 1) {
+            Nan::ThrowTypeError("Invalid arguments. Expected a string for the target directory.");
+            return;
+        }
+
         v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
         v8::Isolate* isolate = info.GetIsolate();
 
         // Get the current context from the execution context
         v8::Local<v8::Context> context = isolate->GetCurrentContext();
         v8::String::Utf8Value sourceFile(context->GetIsolate(), sourceString);
-        v8::Local<v8::Array> resultArray = Nan::New<v8::Array>();
-
-        GFile* src = g_file_new_for_path(*sourceFile);
 
-        const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-        if (src_scheme != NULL) {
-            src = g_file_new_for_uri(*sourceFile);
-        }
+        GFile* src = new_file_for(*sourceFile);
 
         GFileInfo* file_info = g_file_query_filesystem_info(src, "*", NULL, NULL);
         if (!file_info) {
-            g_object_unref(file_info);
             g_object_unref(src);
             return;
         }
@@ -2114,9 +8514,9 @@ namespace gio {
         g_object_unref(src);
 
         v8::Local<v8::Object> result = Nan::New<v8::Object>();
-        Nan::Set(result, Nan::New("total").ToLocalChecked(), Nan::New<v8::Number>(totalSpace));
-        Nan::Set(result, Nan::New("used").ToLocalChecked(), Nan::New<v8::Number>(usedSpace));
-        Nan::Set(result, Nan::New("free").ToLocalChecked(), Nan::New<v8::Number>(freeSpace));
+        Nan::Set(result, key(KEY_TOTAL), Nan::New<v8::Number>(totalSpace));
+        Nan::Set(result, key(KEY_USED), Nan::New<v8::Number>(usedSpace));
+        Nan::Set(result, key(KEY_FREE), Nan::New<v8::Number>(freeSpace));
 
         info.GetReturnValue().Set(result);
 
@@ -2159,6 +8559,9 @@ namespace gio {
 
     }
 
+    // count(path, [options], [callback]) returns {files, folders, total}. Only the immediate
+    // children are counted unless options.recursive, options.threads scans the tree in parallel.
+    // With a callback the count runs on the libuv threadpool, callback(err, counts).
     NAN_METHOD(count) {
 
         Nan:: HandleScope scope;
@@ -2168,57 +8571,24 @@ namespace gio {
         }
 
         v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
+        v8::String::Utf8Value sourceFile(info.GetIsolate(), sourceString);
 
-        v8::Isolate* isolate = info.GetIsolate();
-        v8::String::Utf8Value sourceFile(isolate, sourceString);
-
-        GFile* src = g_file_new_for_path(*sourceFile);
-
-        const char *src_scheme = g_uri_parse_scheme(*sourceFile);
-        if (src_scheme != NULL) {
-            src = g_file_new_for_uri(*sourceFile);
-        }
-
-        GError* error = NULL;
-        GFileEnumerator* enumerator = g_file_enumerate_children(src,
-                                                                G_FILE_ATTRIBUTE_STANDARD_NAME,
-                                                                G_FILE_QUERY_INFO_NONE,
-                                                                NULL,
-                                                                &error);
+        v8::Local<v8::Value> options = info.Length() > 1 && info[1]->IsObject() ? info[1] : Nan::Undefined().As<v8::Value>();
+        bool recursive = get_bool_option(options, "recursive", false);
+        int threads = std::clamp(get_int_option(options, "threads", 1), 1, TreeScanner::max_threads());
 
-        if (error) {
-            g_error_free(error);
-            g_object_unref(src);
+        if (info.Length() > 1 && info[info.Length() - 1]->IsFunction()) {
+            Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+            Nan::AsyncQueueWorker(new CountWorker(callback, std::string(*sourceFile), recursive, threads));
             return;
         }
 
-        guint item_count = 0;
-        GFileInfo* file_info;
-        while (file_info = g_file_enumerator_next_file(enumerator, NULL, &error)) {
-
-            if (error) {
-                g_error_free(error);
-                break;
-            }
-
-            if (file_info == NULL) {
-                break;
-            }
-
-            item_count++;
-
-            g_object_unref(file_info);
+        CountResult result;
+        std::string error;
+        if (!count_tree(std::string(*sourceFile), recursive, threads, NULL, result, error)) {
+            return Nan::ThrowError(error.c_str());
         }
-
-        g_file_enumerator_close(enumerator, NULL, NULL);
-        g_object_unref(enumerator);
-        g_object_unref(src);
-
-        // Create a new Boolean value in the current context
-        v8::Local<v8::Integer> resultValue = v8::Integer::New(isolate, item_count);
-
-        // Return the Boolean value
-        info.GetReturnValue().Set(resultValue);
+        info.GetReturnValue().Set(count_result_to_object(result));
 
     }
 
@@ -2278,6 +8648,72 @@ namespace gio {
 
     }
 
+    // get_file_icon_data_url(href, [size | options]) renders the theme icon of href as a PNG
+    // data url, or null when it has none. options: size (default 32) and buffer to get the
+    // PNG bytes in a Buffer instead. Icons are cached per icon name, size and theme. Runs on
+    // the calling thread, get_icons does the same lookup on the threadpool.
+    NAN_METHOD(get_file_icon_data_url) {
+
+        if (info.Length() < 1 || !info[0]->IsString()) {
+            return Nan::ThrowTypeError("Invalid arguments. Expected a string for the file.");
+        }
+
+        Nan::Utf8String source(info[0]);
+        int size = ICON_SIZE;
+        bool buffer = false;
+        if (info.Length() > 1 && info[1]->IsNumber()) {
+            size = Nan::To<int32_t>(info[1]).FromJust();
+        } else if (info.Length() > 1 && info[1]->IsObject()) {
+            size = get_int_option(info[1], "size", size);
+            buffer = get_bool_option(info[1], "buffer", buffer);
+        }
+        size = std::clamp(size, ICON_MIN_SIZE, ICON_MAX_SIZE);
+
+        std::string png;
+        if (!file_icon_png(*source, size, png, NULL)) {
+            info.GetReturnValue().Set(Nan::Null());
+            return;
+        }
+        if (buffer) {
+            info.GetReturnValue().Set(Nan::CopyBuffer(png.data(), png.size()).ToLocalChecked());
+        } else {
+            info.GetReturnValue().Set(Nan::New(png_data_url(png)).ToLocalChecked());
+        }
+
+    }
+
+    // get_icons(items, [options], callback) resolves the icons of many files at once on the
+    // libuv threadpool. items are paths, uris or content types, options.size as for
+    // get_file_icon_data_url. callback(err, {icons, items}): icons maps each distinct content
+    // type to a data url or null, items holds the content type of every item, null when it
+    // could not be read. All folders share inode/directory.
+    NAN_METHOD(get_icons) {
+
+        if (info.Length() < 2 || !info[0]->IsArray() || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowTypeError("Invalid arguments. Expected an array of items and a callback.");
+        }
+
+        v8::Local<v8::Array> array = info[0].As<v8::Array>();
+        std::vector<std::string> items;
+        items.reserve(array->Length());
+        for (uint32_t i = 0; i < array->Length(); i++) {
+            v8::Local<v8::Value> item = Nan::Get(array, i).ToLocalChecked();
+            items.push_back(item->IsString() ? *Nan::Utf8String(item) : "");
+        }
+
+        v8::Local<v8::Value> options = info.Length() > 2 && info[1]->IsObject() ? info[1] : Nan::Undefined().As<v8::Value>();
+        int size = std::clamp(get_int_option(options, "size", ICON_SIZE), ICON_MIN_SIZE, ICON_MAX_SIZE);
+
+        Nan::Callback *callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+        Nan::AsyncQueueWorker(new IconsWorker(callback, std::move(items), size));
+
+    }
+
+    // Drops the rendered icons and parsed themes of get_file_icon_data_url
+    NAN_METHOD(icon_cache_clear) {
+        IconLookup::get().clear();
+    }
+
     NAN_METHOD(is_dir) {
 
         Nan:: HandleScope scope;
@@ -2409,127 +8845,442 @@ namespace gio {
 
     }
 
-    class CopyWorker : public Nan::AsyncWorker {
+    struct StreamCopyOptions {
+        size_t buffer_size = 4 * 1024 * 1024;
+        int buffers = 4;
+        bool fadvise = true;
+    };
+
+    // Streaming copy behind cp_stream. A reader thread fills a ring of aligned buffers while
+    // this worker writes them out, so reading and writing overlap. Local files go through
+    // file descriptors with posix_fadvise hints that keep large copies from flushing the page
+    // cache, other locations through GIO streams. The destination is only replaced once the
+    // copy is complete and kept when it fails. Progress is paced by the ProgressMeter of the operation.
+    class CopyWorker : public Nan::AsyncProgressWorkerBase<CopyProgress> {
 
         public:
-            CopyWorker(Nan::Callback *callback, const char* sourceFile, const char* destFile)
-                : Nan::AsyncWorker(callback), sourceFile(sourceFile), destFile(destFile) {}
+            CopyWorker(Nan::Callback *callback, const std::string& source, const std::string& destination, const StreamCopyOptions& options)
+                : Nan::AsyncProgressWorkerBase<CopyProgress>(callback), source(source), destination(destination), options(options) {
+                operation = OperationRegistry::create("copy", source);
+            }
 
-            ~CopyWorker() {}
+            ~CopyWorker() {
+                OperationRegistry::remove(operation->id);
+                for (Buffer& buffer : ring) {
+                    free(buffer.data);
+                }
+            }
 
-            void Execute() {
+            Operation& get_operation() {
+                return *operation;
+            }
 
-                // Nan:: HandleScope scope;
+            void Execute(const ExecutionProgress& progress) {
 
-                // if (info.Length() < 2) {
-                //     return Nan::ThrowError("Wrong number of arguments");
-                // }
+                src = new_file_for(source.c_str());
+                dest = new_file_for(destination.c_str());
+
+                GError* error = NULL;
+                if (open_streams(&error) && allocate()) {
+                    std::thread reader(&CopyWorker::read_loop, this);
+                    write_loop(progress, &error);
+                    {
+                        std::lock_guard<std::mutex> lock(ring_mutex);
+                        stopped = true;
+                    }
+                    ring_cv.notify_all();
+                    reader.join();
+                    if (error == NULL && read_error != NULL) {
+                        error = read_error;
+                        read_error = NULL;
+                    }
+                } else if (error == NULL) {
+                    g_set_error_literal(&error, G_IO_ERROR, G_IO_ERROR_FAILED, "Out of memory for copy buffers");
+                }
+
+                // a file GIO created for the copy is removed again, a replaced one is kept
+                bool created = output != NULL && !dest_existed;
+                bool closed = close_streams(error == NULL, error == NULL ? &error : NULL);
+                if (created && (!closed || error != NULL)) {
+                    g_file_delete(dest, NULL, NULL);
+                }
+                if (error != NULL) {
+                    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+                        SetErrorMessage(error->message);
+                    }
+                    g_error_free(error);
+                }
+                if (read_error != NULL) {
+                    g_error_free(read_error);
+                }
 
-                // Nan::Callback* callback = new Nan::Callback(info[2].As<v8::Function>());
+                g_object_unref(src);
+                g_object_unref(dest);
 
-                // v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
-                // v8::Local<v8::String> destString = Nan::To<v8::String>(info[1]).ToLocalChecked();
+            }
 
-                // v8::Isolate* isolate = info.GetIsolate();
-                // v8::String::Utf8Value sourceFile(isolate, sourceString);
-                // v8::String::Utf8Value destFile(isolate, destString);
+            void HandleProgressCallback(const CopyProgress* data, size_t count) {
+                Nan::HandleScope scope;
 
-                printf("Source exec: %s\n", sourceFile);
-                printf("Destination: %s\n", destFile);
+                if (data == NULL || count == 0 || g_cancellable_is_cancelled(operation->cancellable)) {
+                    return;
+                }
+                v8::Local<v8::Value> argv[] = { Nan::Null(), copy_progress_to_object(data[count - 1]), Nan::False() };
+                v8::Local<v8::Value> res = callback->Call(3, argv);
+                if (!res.IsEmpty() && res->IsFalse()) {
+                    operation->cancel();
+                }
+            }
 
-                GFile* src = g_file_new_for_path(sourceFile);
-                GFile* dest = g_file_new_for_path(destFile);
+            void HandleOKCallback() {
+                Nan::HandleScope scope;
 
+                operation->finish(true);
+                v8::Local<v8::Value> argv[] = { Nan::Null(), copy_progress_to_object(position), Nan::True() };
+                callback->Call(3, argv);
+            }
 
+            void HandleErrorCallback() {
+                Nan::HandleScope scope;
 
-                const char *src_scheme = g_uri_parse_scheme(sourceFile);
-                const char *dest_scheme = g_uri_parse_scheme(destFile);
-                if (src_scheme != NULL) {
-                    src = g_file_new_for_uri(sourceFile);
-                }
-                if (dest_scheme != NULL) {
-                    dest = g_file_new_for_uri(destFile);
+                operation->finish(false);
+                v8::Local<v8::Value> argv[] = {
+                    Nan::New(this->ErrorMessage()).ToLocalChecked()
+                };
+                callback->Call(1, argv);
+            }
+
+        private:
+
+            static const size_t BUFFER_ALIGNMENT = 4096;
+
+            struct Buffer {
+                char* data = NULL;
+                size_t length = 0;
+            };
+
+            bool open_streams(GError** error) {
+
+                char* source_path = g_file_get_path(src);
+                char* destination_path = g_file_get_path(dest);
+
+                if (source_path != NULL) {
+                    // opening a FIFO or device for reading can block forever, so special files
+                    // are refused before the open and O_NONBLOCK covers one swapped in after
+                    struct stat st;
+                    if (stat(source_path, &st) != 0) {
+                        set_errno_error(error, errno, "Error opening file", source_path);
+                    } else if (S_ISREG(st.st_mode)) {
+                        in_fd = open(source_path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+                        if (in_fd < 0) {
+                            set_errno_error(error, errno, "Error opening file", source_path);
+                        } else if (fstat(in_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+                            close(in_fd);
+                            in_fd = -1;
+                        }
+                    }
+                    if (in_fd >= 0) {
+                        position.total_bytes = st.st_size;
+                        mode = st.st_mode & 07777;
+                    } else if (error != NULL && *error == NULL) {
+                        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Can not copy special file %s", source_path);
+                    }
+                    if (in_fd >= 0 && options.fadvise) {
+                        posix_fadvise(in_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                    }
+                } else {
+                    GFileInfo* info = g_file_query_info(src, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_FILE_QUERY_INFO_NONE,
+                                                        operation->cancellable, NULL);
+                    if (info != NULL) {
+                        position.total_bytes = g_file_info_get_size(info);
+                        g_object_unref(info);
+                    }
+                    input = g_file_read(src, operation->cancellable, error);
                 }
 
-                GError* error = nullptr;
-                GFileInputStream* input_stream = g_file_read(src, nullptr, &error);
-                if (error) {
-                    // return Nan::ThrowError(error->message);
+                bool opened = in_fd >= 0 || input != NULL;
+                if (opened && destination_path != NULL) {
+                    // written to a temporary file that replaces the destination when complete
+                    struct stat in_st, out_st;
+                    if (in_fd >= 0 && fstat(in_fd, &in_st) == 0 && stat(destination_path, &out_st) == 0 &&
+                        in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+                        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Can not copy %s onto itself", source_path);
+                        opened = false;
+                    } else {
+                        out_fd = open_temp_beside(destination_path, temp, error);
+                        opened = out_fd >= 0;
+                    }
+                    if (out_fd >= 0) {
+                        fchmod(out_fd, mode);
+                        target = destination_path;
+                    }
+                } else if (opened) {
+                    // GIO writes over an existing file aside as well, see close_streams
+                    dest_existed = g_file_query_exists(dest, operation->cancellable);
+                    output = g_file_replace(dest, NULL, FALSE, G_FILE_CREATE_NONE, operation->cancellable, error);
+                    opened = output != NULL;
                 }
 
-                GFileOutputStream* output_stream = g_file_replace(dest, nullptr, FALSE, G_FILE_CREATE_NONE, nullptr, &error);
-                if (error) {
-                    // return Nan::ThrowError(error->message);
+                g_free(source_path);
+                g_free(destination_path);
+                operation->total_bytes = position.total_bytes;
+                return opened;
+
+            }
+
+            // Closes everything that was opened. A complete copy replaces the destination, an
+            // incomplete one is dropped and the destination left as it was. Reports a failed
+            // close or rename of the destination when error is set.
+            bool close_streams(bool complete, GError** error) {
+                bool ok = true;
+                if (in_fd >= 0) {
+                    close(in_fd);
+                }
+                if (input != NULL) {
+                    g_input_stream_close(G_INPUT_STREAM(input), NULL, NULL);
+                    g_object_unref(input);
+                }
+                if (out_fd >= 0) {
+                    if (close(out_fd) != 0) {
+                        if (error != NULL) {
+                            set_errno_error(error, errno, "Error closing file", destination.c_str());
+                        }
+                        ok = false;
+                    }
+                    if (complete && ok) {
+                        ok = commit_temp_file(temp, target.c_str(), true, error);
+                    } else {
+                        unlink(temp.c_str());
+                    }
                 }
+                if (output != NULL) {
+                    if (complete) {
+                        ok = g_output_stream_close(G_OUTPUT_STREAM(output), operation->cancellable, error) && ok;
+                    } else {
+                        // closing with a cancelled cancellable drops what GIO wrote aside
+                        GCancellable* abandon = g_cancellable_new();
+                        g_cancellable_cancel(abandon);
+                        g_output_stream_close(G_OUTPUT_STREAM(output), abandon, NULL);
+                        g_object_unref(abandon);
+                        ok = false;
+                    }
+                    g_object_unref(output);
+                }
+                return ok;
+            }
 
-                int64_t bytes_read = 0;
-                char buffer[4096];
+            bool allocate() {
+                ring.resize(options.buffers);
+                for (size_t i = 0; i < ring.size(); i++) {
+                    void* data = NULL;
+                    if (posix_memalign(&data, BUFFER_ALIGNMENT, options.buffer_size) != 0) {
+                        return false;
+                    }
+                    ring[i].data = static_cast<char*>(data);
+                    empty.push_back(i);
+                }
+                return true;
+            }
 
-                while ((bytes_read = g_input_stream_read(G_INPUT_STREAM(input_stream), buffer, sizeof(buffer), nullptr, &error)) > 0) {
+            // Reads into empty buffers until the end of the source, an error or a stop
+            void read_loop() {
 
-                    g_output_stream_write(G_OUTPUT_STREAM(output_stream), buffer, bytes_read, nullptr, &error);
+                goffset offset = 0;
+                while (true) {
 
-                    if (error) {
-                        // return Nan::ThrowError(error->message);
+                    size_t index;
+                    {
+                        std::unique_lock<std::mutex> lock(ring_mutex);
+                        ring_cv.wait(lock, [this] { return stopped || !empty.empty(); });
+                        if (stopped) {
+                            return;
+                        }
+                        index = empty.front();
+                        empty.pop_front();
                     }
 
-                    printf("Bytes read: %ld\n", bytes_read);
+                    Buffer& buffer = ring[index];
+                    buffer.length = 0;
+                    bool done = !read_buffer(buffer, &read_error);
+                    if (!done && in_fd >= 0 && options.fadvise) {
+                        posix_fadvise(in_fd, offset, buffer.length, POSIX_FADV_DONTNEED);
+                    }
+                    offset += buffer.length;
+                    done = done || buffer.length == 0;
 
-                    v8::Local<v8::Object> resultObj = Nan::New<v8::Object>();
-                    Nan::Set(resultObj, Nan::New("bytes_read").ToLocalChecked(), Nan::New<v8::Number>(bytes_read));
-                    v8::Local<v8::Value> argv[] = { Nan::Null(), resultObj };
-                    callback->Call(2, argv);
+                    {
+                        std::lock_guard<std::mutex> lock(ring_mutex);
+                        full.push_back(index);
+                        reading = !done;
+                    }
+                    ring_cv.notify_all();
+                    if (done) {
+                        return;
+                    }
 
                 }
 
-                if (error) {
-                    // return Nan::ThrowError(error->message);
+            }
+
+            // Fills a buffer, a short buffer is the end of the source. Returns false on errors.
+            bool read_buffer(Buffer& buffer, GError** error) {
+                if (g_cancellable_set_error_if_cancelled(operation->cancellable, error)) {
+                    return false;
+                }
+                while (buffer.length < options.buffer_size) {
+                    gssize count;
+                    if (in_fd >= 0) {
+                        count = read(in_fd, buffer.data + buffer.length, options.buffer_size - buffer.length);
+                        if (count < 0 && errno == EINTR) {
+                            continue;
+                        }
+                        if (count < 0) {
+                            set_errno_error(error, errno, "Error reading file", source.c_str());
+                            return false;
+                        }
+                    } else {
+                        count = g_input_stream_read(G_INPUT_STREAM(input), buffer.data + buffer.length,
+                                                    options.buffer_size - buffer.length, operation->cancellable, error);
+                        if (count < 0) {
+                            return false;
+                        }
+                    }
+                    if (count == 0) {
+                        break;
+                    }
+                    buffer.length += count;
                 }
+                return true;
+            }
 
-                g_object_unref(input_stream);
-                g_object_unref(output_stream);
-                g_object_unref(src);
-                g_object_unref(dest);
+            // Writes full buffers in order until the reader is done
+            void write_loop(const ExecutionProgress& progress, GError** error) {
 
-            }
+                while (true) {
 
-            void HandleOKCallback() {
-                Nan::HandleScope scope;
-                v8::Local<v8::Value> argv[] = {
-                    Nan::Null(),  // no error
-                    Nan::New("File copied successfully").ToLocalChecked()
-                };
+                    size_t index;
+                    {
+                        std::unique_lock<std::mutex> lock(ring_mutex);
+                        ring_cv.wait(lock, [this] { return !full.empty() || !reading; });
+                        if (full.empty()) {
+                            return;
+                        }
+                        index = full.front();
+                        full.pop_front();
+                    }
+
+                    Buffer& buffer = ring[index];
+                    operation->checkpoint();
+                    if (g_cancellable_set_error_if_cancelled(operation->cancellable, error) ||
+                        (buffer.length > 0 && !write_buffer(buffer, error))) {
+                        return;
+                    }
+
+                    position.current_num_bytes += buffer.length;
+                    if (operation->progress(position.current_num_bytes, position.total_bytes, position.rate)) {
+                        progress.Send(&position, 1);
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(ring_mutex);
+                        empty.push_back(index);
+                    }
+                    ring_cv.notify_all();
+
+                }
 
-                callback->Call(2, argv);
             }
 
-        private:
-            const char* sourceFile;
-            const char* destFile;
-    };
+            bool write_buffer(const Buffer& buffer, GError** error) {
 
-    NAN_METHOD(cp_stream) {
-        Nan::HandleScope scope;
+                if (output != NULL) {
+                    gsize written = 0;
+                    return g_output_stream_write_all(G_OUTPUT_STREAM(output), buffer.data, buffer.length, &written,
+                                                     operation->cancellable, error);
+                }
 
-        if (info.Length() < 2 || !info[0]->IsString() || !info[1]->IsString() || !info[2]->IsFunction()) {
-            return Nan::ThrowError("Wrong arguments");
-        }
+                size_t written = 0;
+                while (written < buffer.length) {
+                    ssize_t count = write(out_fd, buffer.data + written, buffer.length - written);
+                    if (count < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (count < 0) {
+                        set_errno_error(error, errno, "Error writing to file", destination.c_str());
+                        return false;
+                    }
+                    written += count;
+                }
 
-        Nan::Callback* callback = new Nan::Callback(info[2].As<v8::Function>());
+                if (options.fadvise) {
+                    // start writeback of this buffer and drop the one before it once it is on disk
+                    goffset offset = position.current_num_bytes;
+                    sync_file_range(out_fd, offset, buffer.length, SYNC_FILE_RANGE_WRITE);
+                    if (offset > 0) {
+                        goffset previous = std::max<goffset>(0, offset - (goffset)options.buffer_size);
+                        sync_file_range(out_fd, previous, offset - previous,
+                                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+                        posix_fadvise(out_fd, previous, offset - previous, POSIX_FADV_DONTNEED);
+                    }
+                }
+                return true;
 
-        v8::Local<v8::String> sourceString = Nan::To<v8::String>(info[0]).ToLocalChecked();
-        v8::Local<v8::String> destString = Nan::To<v8::String>(info[1]).ToLocalChecked();
+            }
 
-        v8::Isolate* isolate = info.GetIsolate();
-        v8::String::Utf8Value sourceFile(isolate, sourceString);
-        v8::String::Utf8Value destFile(isolate, destString);
+            std::string source;
+            std::string destination;
+            StreamCopyOptions options;
+            std::shared_ptr<Operation> operation;
+            GFile* src = NULL;
+            GFile* dest = NULL;
+            int in_fd = -1;
+            int out_fd = -1;
+            std::string temp;           // written through out_fd until it replaces target
+            std::string target;
+            bool dest_existed = false;
+            mode_t mode = 0644;
+            GFileInputStream* input = NULL;
+            GFileOutputStream* output = NULL;
+            CopyProgress position;
+
+            std::vector<Buffer> ring;
+            std::deque<size_t> empty;
+            std::deque<size_t> full;
+            std::mutex ring_mutex;
+            std::condition_variable ring_cv;
+            bool reading = true;
+            bool stopped = false;
+            GError* read_error = NULL;
+    };
 
-        printf("Source: %s\n", *sourceFile);
-        printf("Destination: %s\n", *destFile);
+    // Copies a file through a ring of large buffers, cp_stream(source, destination, [options], callback).
+    // Options: buffer_size in bytes (1 to 64 MB, default 4 MB), buffers (2 to 16, default 4) and
+    // fadvise (default true), progress_interval and progress_bytes. callback(err, {current_num_bytes,
+    // bytes_copied, total_bytes, rate, smoothed_rate, eta}, done) is called while copying and once with
+    // done set, returning false cancels. Returns the operation handle.
+    NAN_METHOD(cp_stream) {
+        Nan::HandleScope scope;
 
-        Nan::AsyncQueueWorker(new CopyWorker(callback, *sourceFile, *destFile));
+        if (info.Length() < 3 || !info[0]->IsString() || !info[1]->IsString() || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowError("Wrong arguments. Expected cp_stream(source, destination, [options], callback).");
+        }
 
-        info.GetReturnValue().Set(Nan::Undefined());
+        v8::Local<v8::Value> options = info.Length() > 3 ? info[2] : Nan::Undefined().As<v8::Value>();
+        StreamCopyOptions stream_options;
+        stream_options.buffer_size = std::clamp<gint64>(get_int64_option(options, "buffer_size", stream_options.buffer_size),
+                                                        1024 * 1024, 64 * 1024 * 1024);
+        stream_options.buffers = std::clamp(get_int_option(options, "buffers", stream_options.buffers), 2, 16);
+        stream_options.fadvise = get_bool_option(options, "fadvise", stream_options.fadvise);
+
+        Nan::Utf8String sourceFile(info[0]);
+        Nan::Utf8String destFile(info[1]);
+        Nan::Callback* callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+
+        CopyWorker* worker = new CopyWorker(callback, *sourceFile, *destFile, stream_options);
+        get_progress_options(options, worker->get_operation().meter);
+        v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+        Nan::AsyncQueueWorker(worker);
+        info.GetReturnValue().Set(handle);
     }
 
     NAN_METHOD(cp_write) {
@@ -2573,6 +9324,48 @@ namespace gio {
 
     }
 
+    // Deletes files and folders recursively on background threads,
+    // rm_tree(paths, [options], callback) with options.trash, threads, progress_interval and
+    // progress_bytes. paths is an array of paths or uris, or a single one. See RemoveTreeWorker
+    // for the callback. Returns the operation handle of the delete.
+    NAN_METHOD(rm_tree) {
+
+        Nan::HandleScope scope;
+
+        if (info.Length() < 2 || !info[info.Length() - 1]->IsFunction()) {
+            return Nan::ThrowError("Wrong arguments. Expected rm_tree(paths, [options], callback).");
+        }
+
+        v8::Local<v8::Value> options = info.Length() > 2 ? info[1] : Nan::Undefined().As<v8::Value>();
+        RemoveOptions remove_options;
+        remove_options.trash = get_bool_option(options, "trash", remove_options.trash);
+        remove_options.threads = std::clamp(get_int_option(options, "threads", remove_options.threads), 0, 64);
+
+        std::vector<std::string> paths;
+        if (info[0]->IsArray()) {
+            v8::Local<v8::Array> arr = info[0].As<v8::Array>();
+            for (uint32_t i = 0; i < arr->Length(); i++) {
+                v8::Local<v8::Value> element = Nan::Get(arr, i).ToLocalChecked();
+                if (!element->IsString()) {
+                    return Nan::ThrowTypeError("Expected an array of path strings");
+                }
+                paths.push_back(*Nan::Utf8String(element));
+            }
+        } else if (info[0]->IsString()) {
+            paths.push_back(*Nan::Utf8String(info[0]));
+        } else {
+            return Nan::ThrowTypeError("Expected a path or an array of paths");
+        }
+
+        Nan::Callback* callback = new Nan::Callback(info[info.Length() - 1].As<v8::Function>());
+        RemoveTreeWorker* worker = new RemoveTreeWorker(callback, std::move(paths), remove_options);
+        get_progress_options(options, worker->get_operation().meter);
+        v8::Local<v8::Object> handle = operation_handle(worker->get_operation());
+        Nan::AsyncQueueWorker(worker);
+        info.GetReturnValue().Set(handle);
+
+    }
+
     NAN_METHOD(is_writable) {
 
         Nan:: HandleScope scope;
@@ -2681,23 +9474,47 @@ namespace gio {
         Nan::Export(target, "on_theme_change", on_theme_change);
         Nan::Export(target, "is_dir", is_dir);
         Nan::Export(target, "get_icon", icon);
+        Nan::Export(target, "get_file_icon_data_url", get_file_icon_data_url);
+        Nan::Export(target, "get_icons", get_icons);
+        Nan::Export(target, "icon_cache_clear", icon_cache_clear);
         Nan::Export(target, "set_execute", gio::set_execute);
         Nan::Export(target, "clear_execute", gio::clear_execute);
         Nan::Export(target, "thumbnail", gio::thumbnail);
+        Nan::Export(target, "thumbnails", gio::thumbnails);
+        Nan::Export(target, "thumbnail_path", gio::thumbnail_path);
+        Nan::Export(target, "thumbnail_prioritize", gio::thumbnail_prioritize);
         Nan::Export(target, "open_with", open_with);
         Nan::Export(target, "du", du);
+        Nan::Export(target, "disk_stats", disk_stats);
         Nan::Export(target, "count", count);
         Nan::Export(target, "exists", exists);
         Nan::Export(target, "get_file", gio::get_file);
-        Nan::Export(target, "ls", gio::ls);
+        Nan::Export(target, "ls", ls);
+        Nan::Export(target, "ls_sync", gio::ls_sync);
+        Nan::Export(target, "ls_stream", ls_stream);
+        Nan::Export(target, "walk", walk);
+        Nan::Export(target, "find", find);
+        Nan::Export(target, "index_build", index_build);
+        Nan::Export(target, "index_open", index_open);
+        Nan::Export(target, "index_close", index_close);
+        Nan::Export(target, "index_save", index_save);
+        Nan::Export(target, "index_stats", index_stats);
         Nan::Export(target, "mkdir", gio::mkdir);
         Nan::Export(target, "cp", cp);
         Nan::Export(target, "cp_arr", gio::cp_arr);
         Nan::Export(target, "cp_stream", cp_stream);
         Nan::Export(target, "cp_async", gio::cp_async);
         Nan::Export(target, "cp_cancel", gio::cp_cancel);
+        Nan::Export(target, "op_cancel", operation_cancel);
+        Nan::Export(target, "op_pause", operation_pause);
+        Nan::Export(target, "op_resume", operation_resume);
+        Nan::Export(target, "op_status", operation_status);
+        Nan::Export(target, "operations", operations);
         Nan::Export(target, "mv", gio::mv);
+        Nan::Export(target, "mv_arr", gio::mv_arr);
+        Nan::Export(target, "plan_transfer", gio::plan_transfer);
         Nan::Export(target, "rm", rm);
+        Nan::Export(target, "rm_tree", rm_tree);
         Nan::Export(target, "is_writable", is_writable);
         Nan::Export(target, "monitor", monitor);
         Nan::Export(target, "watch", watch);
@@ -0,0 +1,115 @@
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+// These run against the built addon and are skipped until it is built (npm run postinstall)
+let gio = null;
+try {
+    gio = require('../build/Release/gio.node');
+} catch (err) {
+}
+
+const describe_native = gio ? describe : describe.skip;
+
+// 8x8 grayscale JPEG, the image the decoder falls back to when the Exif data is rejected
+const JPEG_8X8 = Buffer.from('/9j/4AAQSkZJRgABAQAAAQABAAD/2wBDABALDA4MChAODQ4SERATGCgaGBYWGDEjJR0oOjM9PDkzODdASFxOQERXRTc4UG1RV19' +
+    'iZ2hnPk1xeXBkeFxlZ2P/wAALCAAIAAgBAREA/8QAFAABAAAAAAAAAAAAAAAAAAAABP/EABYQAAMAAAAAAAAAAAAAAAAAAAAGQ//aAAgBAQAAPwA6VM//2Q==', 'base64');
+
+// APP2 segments of count bytes in all, the decoder skips them
+function padding(count) {
+    const segments = [];
+    while (count > 0) {
+        const size = Math.min(count, 0xFFFF + 2);
+        const segment = Buffer.alloc(size);
+        segment.writeUInt16BE(0xFFE2, 0);
+        segment.writeUInt16BE(size - 2, 2);
+        segments.push(segment);
+        count -= size;
+    }
+    return Buffer.concat(segments);
+}
+
+// JPEG with an APP1 Exif segment holding tiff (little endian TIFF data) after the
+// given leading segments, followed by the 8x8 image
+function jpeg_with_exif(tiff, leading = Buffer.alloc(0)) {
+    const segment = Buffer.alloc(10);
+    segment.writeUInt16BE(0xFFE1, 0);
+    segment.writeUInt16BE(tiff.length + 8, 2);
+    segment.write('Exif\0\0', 4, 'binary');
+    return Buffer.concat([Buffer.from([0xFF, 0xD8]), leading, segment, tiff, JPEG_8X8.subarray(2)]);
+}
+
+function tiff_header(ifd0_offset) {
+    const header = Buffer.alloc(8);
+    header.write('II', 0, 'binary');
+    header.writeUInt16LE(42, 2);
+    header.writeUInt32LE(ifd0_offset, 4);
+    return header;
+}
+
+// IFD with the given [tag, value] entries followed by the offset of the next IFD
+function ifd(entries, next) {
+    const data = Buffer.alloc(2 + entries.length * 12 + 4);
+    data.writeUInt16LE(entries.length, 0);
+    entries.forEach(([tag, value], i) => {
+        data.writeUInt16LE(tag, 2 + i * 12);
+        data.writeUInt16LE(4, 4 + i * 12);
+        data.writeUInt32LE(1, 6 + i * 12);
+        data.writeUInt32LE(value >>> 0, 10 + i * 12);
+    });
+    data.writeUInt32LE(next >>> 0, 2 + entries.length * 12);
+    return data;
+}
+
+describe_native('gio thumbnail EXIF parsing', () => {
+
+    let dir;
+
+    beforeEach(() => {
+        dir = fs.mkdtempSync(path.join(os.tmpdir(), 'sfm-exif-'));
+    });
+
+    afterEach(() => {
+        fs.rmSync(dir, { recursive: true, force: true });
+    });
+
+    // The Exif data is rejected, so the thumbnail comes from decoding the 8x8 image itself
+    function expect_decoded_thumbnail(data) {
+        const source = path.join(dir, 'image.jpg');
+        const destination = path.join(dir, 'thumbnail.jpg');
+        fs.writeFileSync(source, data);
+        gio.thumbnail(source, destination);
+        expect(fs.readFileSync(destination).subarray(0, 2)).toEqual(Buffer.from([0xFF, 0xD8]));
+    }
+
+    it('rejects an IFD offset that wraps around', () => {
+        expect_decoded_thumbnail(jpeg_with_exif(Buffer.concat([tiff_header(0xFFFFFFFE), Buffer.alloc(16)])));
+    });
+
+    it('rejects an IFD entry count past the segment', () => {
+        const tiff = Buffer.concat([tiff_header(8), Buffer.from([0xFF, 0xFF]), Buffer.alloc(14)]);
+        expect_decoded_thumbnail(jpeg_with_exif(tiff));
+    });
+
+    it('rejects a thumbnail offset and size that wrap around', () => {
+        const ifd1_offset = 8 + 18;
+        const tiff = Buffer.concat([
+            tiff_header(8),
+            ifd([[0x0112, 1]], ifd1_offset),
+            ifd([[0x0201, 0xFFFFFFF0], [0x0202, 0x20]], 0)
+        ]);
+        expect_decoded_thumbnail(jpeg_with_exif(tiff));
+    });
+
+    it('rejects a segment that runs past the bytes scanned for Exif data', () => {
+        // the thumbnail offsets are valid within the segment, which ends past the first 128 KiB
+        const tiff = Buffer.concat([
+            tiff_header(8),
+            ifd([[0x0112, 1]], 26),
+            ifd([[0x0201, 64], [0x0202, 4000]], 0),
+            Buffer.alloc(4096 - 44)
+        ]);
+        expect_decoded_thumbnail(jpeg_with_exif(tiff, padding(128 * 1024 - 512)));
+    });
+
+});
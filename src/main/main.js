@@ -8,6 +8,7 @@ const { execSync } = require('child_process');
 const exec = require('child_process').exec;
 const os = require('os');
 const gio = require('../gio/build/Release/gio.node');
+const { FileColumns } = require('../gio/columns');
 const iconManager = require('./lib/IconManager');
 const { XMLParser } = require('fast-xml-parser');
 
@@ -123,6 +124,24 @@ function normalize_find_options(raw_options = {}) {
     return options;
 }
 
+// Maps the search dialog options to the options of gio.find
+function to_native_find_options(search_options) {
+    const options = {};
+    if (search_options.minSize !== undefined) {
+        options.min_size = search_options.minSize;
+    }
+    if (search_options.maxSize !== undefined) {
+        options.max_size = search_options.maxSize;
+    }
+    if (search_options.dateFrom !== undefined) {
+        options.mtime_from = Math.floor(new Date(search_options.dateFrom).getTime() / 1000);
+    }
+    if (search_options.dateTo !== undefined) {
+        options.mtime_to = Math.floor(new Date(search_options.dateTo).getTime() / 1000);
+    }
+    return options;
+}
+
 
 /**
  * Class to watch for changes in the file system
@@ -549,13 +568,52 @@ ipcMain.on('switch_tab', (e, tab_id) => {
     tab_manager.switchTab(tab_id);
 });
 
+// Search index of the home folder. find answers from it once it has been built,
+// watch keeps it current for the folders that are open. Changes in other folders
+// are only picked up by a rebuild, which runs in the background on start and every
+// hour once the index is older than a day. Searches keep using the old index meanwhile.
+const search_index_root = os.homedir();
+const SEARCH_INDEX_MAX_AGE = 24 * 60 * 60;
+let search_index_building = false;
+
+function refresh_search_index() {
+    const stats = gio.index_stats(search_index_root);
+    if (search_index_building || (stats && Date.now() / 1000 - stats.built < SEARCH_INDEX_MAX_AGE)) {
+        return;
+    }
+    search_index_building = true;
+    gio.index_build(search_index_root, {}, (err) => {
+        search_index_building = false;
+        if (err) {
+            console.log(`Error building search index: ${err}`);
+        }
+    });
+}
+
+gio.index_open(search_index_root);
+app.whenReady().then(() => {
+    refresh_search_index();
+    setInterval(refresh_search_index, 60 * 60 * 1000);
+});
+
+// Writes collected changes into the index file once there are enough of them
+function save_search_index(location) {
+    const stats = gio.index_stats(location);
+    if (stats && stats.needs_save) {
+        gio.index_save(stats.root, (err) => {
+            if (err) {
+                console.log(`Error saving search index: ${err}`);
+            }
+        });
+    }
+}
+
 ipcMain.handle('find', async (e, query, location, options) => {
     const search_query = typeof query === 'string' ? query.trim() : '';
     const search_location = typeof location === 'string' && location.trim() !== ''
         ? location
         : os.homedir();
     const search_options = normalize_find_options(options);
-    const has_search_options = Object.keys(search_options).length > 0;
 
     if (!search_query) {
         return {
@@ -565,43 +623,33 @@ ipcMain.handle('find', async (e, query, location, options) => {
     }
 
     return await new Promise((resolve) => {
-        const find_callback = (err, res) => {
-            // Supports both callback shapes: (results) and (err, results)
-            const callback_error =
-                err &&
-                res === undefined &&
-                typeof err !== 'string' &&
-                !Array.isArray(err)
-                    ? err
-                    : null;
-
-            if (callback_error) {
+        const results = [];
+        // Hits arrive in batches, the search is complete when done is set. index is
+        // {root, built} when the results came from the search index and may miss
+        // changes made since it was built outside the watched folders.
+        const find_callback = (err, batch, done, index) => {
+            if (err) {
                 resolve({
                     error: true,
-                    message: String(callback_error.message || callback_error),
+                    message: String(err.message || err),
                     results: []
                 });
                 return;
             }
 
-            const raw_results = res === undefined ? err : res;
-            resolve({
-                error: false,
-                results: normalize_find_results(raw_results)
-            });
+            results.push(...batch);
+            if (done) {
+                save_search_index(search_location);
+                resolve({
+                    error: false,
+                    results: normalize_find_results(results),
+                    index: index || null
+                });
+            }
         };
 
         try {
-            if (has_search_options) {
-                try {
-                    gio.find(search_query, search_location, search_options, find_callback);
-                } catch (err) {
-                    // Fallback for older gio builds that do not support options.
-                    gio.find(search_query, search_location, find_callback);
-                }
-            } else {
-                gio.find(search_query, search_location, find_callback);
-            }
+            gio.find(search_query, search_location, to_native_find_options(search_options), find_callback);
         } catch (err) {
             resolve({
                 error: true,
@@ -626,7 +674,7 @@ ipcMain.on('overwrite_one', (e, f, operation) => {
             utilities.move_worker.postMessage({ cmd: 'move', move_arr: [f] });
             utilities.move_in_progress = true;
         } else {
-            utilities.paste_worker.postMessage({ cmd: 'paste', copy_arr: [f] });
+            utilities.paste_worker.postMessage({ cmd: 'paste', copy_arr: [f], location: path.dirname(f.destination) });
             utilities.copy_in_progress = true;
         }
     } catch (err) {
@@ -653,7 +701,7 @@ ipcMain.on('overwrite_all', (e, files_arr, operation) => {
         utilities.move_worker.postMessage({ cmd: 'move', move_arr: files_arr });
         utilities.move_in_progress = true;
     } else {
-        utilities.paste_worker.postMessage({ cmd: 'paste', copy_arr: files_arr });
+        utilities.paste_worker.postMessage({ cmd: 'paste', copy_arr: files_arr, location: files_arr.length > 0 ? path.dirname(files_arr[0].destination) : '' });
         utilities.copy_in_progress = true;
     }
 });
@@ -1002,6 +1050,12 @@ class Utilities {
                     this.run_watcher = false;
                     this.copy_in_progress = false;
 
+                    // the worker already reported why the paste failed
+                    if (data.failed) {
+                        this.run_watcher = true;
+                        break;
+                    }
+
                     if (data.cancelled) {
                         win.send('set_msg', 'Copy cancelled.');
                     }
@@ -1062,13 +1116,21 @@ class Utilities {
 
                     this.move_in_progress = false;
 
-                    if (this.is_main && !data.cancelled) {
+                    // the moved from location is refreshed even when every item failed,
+                    // a move across devices may have moved part of a tree
+                    let root_source = data.location;
+                    if (!root_source && data.files_arr.length > 0) {
+                        root_source = path.dirname(data.files_arr[0].source);
+                    }
+
+                    if (this.is_main && !data.cancelled && root_source) {
 
                         // remove old items
-                        win.send('remove_items', data.files_arr);
+                        if (data.files_arr.length > 0) {
+                            win.send('remove_items', data.files_arr);
+                        }
 
                         // get moved from location
-                        let root_source = path.dirname(data.files_arr[0].source);
                         let file = gio.get_file(root_source);
                         file.id = btoa(file.href);
 
@@ -1618,6 +1680,22 @@ class WorkspaceManager {
 
 // Icon IPC //////
 
+// Get the icons of many files with one native lookup per content type,
+// resolves to {icons, items} or null when the native call is not available
+ipcMain.handle('get_icons', async (e, hrefs, size = 32) => {
+
+    if (process.platform !== 'linux' || typeof gio.get_icons !== 'function') {
+        return null;
+    }
+
+    return new Promise((resolve) => {
+        gio.get_icons(hrefs, { size }, (err, result) => {
+            resolve(err ? null : result);
+        });
+    });
+
+})
+
 // Get File Icon
 ipcMain.handle('get_icon', async (e, href) => {
 
@@ -1626,22 +1704,17 @@ ipcMain.handle('get_icon', async (e, href) => {
         return cached_icon;
     }
 
-    if (process.platform === 'linux' && typeof gio.get_file_icon_data_url === 'function') {
-        try {
-            const result = gio.get_file_icon_data_url(href);
-            if (typeof result === 'string' && result.startsWith('data:image/')) {
-                set_cached_file_icon(href, result);
-                return result;
-            }
-            if (result && result.icon_data_url) {
-                set_cached_file_icon(href, result.icon_data_url);
-                return result.icon_data_url;
-            }
-            if (result && result.symbolic_icon_data_url) {
-                set_cached_file_icon(href, result.symbolic_icon_data_url);
-                return result.symbolic_icon_data_url;
-            }
-        } catch (err) {
+    // looked up on the threadpool, the theme lookup and the stat stay off the main process
+    if (process.platform === 'linux' && typeof gio.get_icons === 'function') {
+        const icon = await new Promise((resolve) => {
+            gio.get_icons([href], { size: 32 }, (err, result) => {
+                const key = !err && result ? result.items[0] : null;
+                resolve(key ? result.icons[key] : null);
+            });
+        });
+        if (typeof icon === 'string' && icon.startsWith('data:image/')) {
+            set_cached_file_icon(href, icon);
+            return icon;
         }
     }
 
@@ -2057,14 +2130,18 @@ class FileManager {
             let search = path.basename(directory);
 
             try {
-                await gio.ls(dir, (err, dirents) => {
-                    if (err) {
-                        return;
-                    }
-                    dirents.forEach(item => {
-                        if (item.is_dir && item.name.startsWith(search)) {
-                            autocomplete_arr.push(item.href + '/');
+                await new Promise((resolve) => {
+                    gio.ls(dir, { fields: ['name', 'is_dir'], format: 'columns' }, (err, columns) => {
+                        if (err) {
+                            return resolve();
                         }
+                        const dirents = new FileColumns(columns);
+                        for (let i = 0; i < dirents.length; i++) {
+                            if (dirents.is_dir(i) && dirents.name(i).startsWith(search)) {
+                                autocomplete_arr.push(dirents.href(i) + '/');
+                            }
+                        }
+                        resolve();
                     })
                 })
 
@@ -3609,6 +3686,9 @@ app.on('ready', () => {
 
     iconManager.start_theme_watcher(() => {
         file_icon_cache.clear();
+        if (typeof gio.icon_cache_clear === 'function') {
+            gio.icon_cache_clear();
+        }
         BrowserWindow.getAllWindows().forEach((window) => {
             if (!window.isDestroyed()) {
                 window.webContents.send('icon_theme_changed');
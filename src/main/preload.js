@@ -749,17 +749,23 @@ class Utilities {
             this.icon_request_in_flight < this.max_icon_requests_in_flight
             && this.icon_request_queue.length > 0
         ) {
-            const task = this.icon_request_queue.shift();
+            // queued icons go out in one batch, resolved once per content type
+            const tasks = this.icon_request_queue.splice(0, 256);
             this.icon_request_in_flight += 1;
 
-            ipcRenderer.invoke('get_icon', task.href).then((icon) => {
-                if (typeof task.on_success === 'function') {
-                    task.on_success(icon);
-                }
+            ipcRenderer.invoke('get_icons', tasks.map(task => task.href)).then((result) => {
+                tasks.forEach((task, i) => {
+                    const icon = result ? result.icons[result.items[i]] : null;
+                    if (icon) {
+                        if (typeof task.on_success === 'function') {
+                            task.on_success(icon);
+                        }
+                    } else {
+                        this.request_icon(task);
+                    }
+                });
             }).catch(() => {
-                if (typeof task.on_error === 'function') {
-                    task.on_error();
-                }
+                tasks.forEach(task => this.request_icon(task));
             }).finally(() => {
                 this.icon_request_in_flight -= 1;
                 this.process_icon_request_queue();
@@ -767,6 +773,19 @@ class Utilities {
         }
     }
 
+    // single file lookup for icons the batch could not resolve
+    request_icon(task) {
+        ipcRenderer.invoke('get_icon', task.href).then((icon) => {
+            if (typeof task.on_success === 'function') {
+                task.on_success(icon);
+            }
+        }).catch(() => {
+            if (typeof task.on_error === 'function') {
+                task.on_error();
+            }
+        });
+    }
+
     // init autocomplete
     initAutoComplete() {
 
@@ -6227,6 +6246,10 @@ class FileManager {
             const sorted_matches = utilities.sort(normalized_matches, this.sort_by, this.sort_direction);
 
             results_header.textContent = `${sorted_matches.length} result${sorted_matches.length === 1 ? '' : 's'} in search location.`;
+            if (response?.index?.built) {
+                // folders that were not open since then may have changed
+                results_header.textContent += ` From the search index of ${new Date(response.index.built * 1000).toLocaleString()}.`;
+            }
 
             render_results_view(sorted_matches);
         };
@@ -3,6 +3,9 @@ const { parentPort, isMainThread } = require('worker_threads');
 const gio = require('../gio/build/Release/gio.node');
 const path = require('path');
 
+// Only query what the delete needs, content type sniffing is slow on network mounts
+const DELETE_FIELDS = ['name', 'href', 'is_dir', 'is_symlink'];
+
 class DeleteWorker {
 
     constructor(options = {}) {
@@ -13,6 +16,7 @@ class DeleteWorker {
         this.cancel_requested = false;
         this.scan_recursive = 0;
         this.files_arr = [];
+        this.delete_operation = null;
     }
 
     post_message(payload) {
@@ -35,6 +39,9 @@ class DeleteWorker {
 
     cancel() {
         this.cancel_requested = true;
+        if (this.delete_operation) {
+            this.delete_operation.cancel();
+        }
     }
 
     throw_if_cancelled() {
@@ -61,7 +68,7 @@ class DeleteWorker {
 
         this.files_arr.push(file);
 
-        this.gio.ls(source, (err, dirents) => {
+        this.gio.ls(source, { fields: DELETE_FIELDS }, (err, dirents) => {
             if (err) {
                 return callback(new Error(`Error listing directory: ${err.message || err}`));
             }
@@ -88,11 +95,37 @@ class DeleteWorker {
         });
     }
 
+    // Native traversal, one call for the whole tree instead of an ls per directory
+    walk_files_arr(source, callback) {
+        const list = [];
+        this.gio.walk(source, { fields: DELETE_FIELDS }, (err, dirents, done) => {
+            if (err) {
+                return callback(new Error(`Error listing directory: ${err.message || err}`));
+            }
+            list.push(...dirents);
+            if (done) {
+                return callback(null, this.cancel_requested ? [] : list);
+            }
+            // returning false stops the walk
+            return !this.cancel_requested;
+        });
+    }
+
     async get_files_arr_async(source) {
         this.scan_recursive = 0;
         this.files_arr = [];
 
         return new Promise((resolve, reject) => {
+            if (typeof this.gio.walk === 'function') {
+                this.walk_files_arr(source, (err, entries) => {
+                    if (err) {
+                        reject(err);
+                        return;
+                    }
+                    resolve(entries || []);
+                });
+                return;
+            }
             this.get_files_arr(source, (err, entries) => {
                 if (err) {
                     reject(err);
@@ -146,7 +179,57 @@ class DeleteWorker {
         return entries;
     }
 
-    async run(delete_arr) {
+    // One native call removes every item: directories are unlinked bottom-up on several
+    // threads, so there is no scan and no call per file. options.trash moves items to the trash.
+    async run_native(delete_arr, options = {}) {
+        this.cancel_requested = false;
+        this.deleted_files = 0;
+        this.total_files = delete_arr.length;
+
+        this.send_progress(`Deleting ${delete_arr.length} items`, 0);
+
+        const totals = await new Promise((resolve, reject) => {
+            this.delete_operation = this.gio.rm_tree(delete_arr.map((item) => item.href), { trash: !!options.trash }, (err, totals, done) => {
+                if (err) {
+                    this.delete_operation = null;
+                    reject(new Error(err));
+                    return;
+                }
+                this.deleted_files = totals.files;
+                if (!done) {
+                    this.send_progress(`Deleted ${totals.files} files`, totals.items);
+                    return !this.cancel_requested;
+                }
+                this.delete_operation = null;
+                resolve(totals);
+            });
+        });
+
+        for (const error of totals.error_list) {
+            this.post_message({
+                cmd: 'set_msg',
+                msg: error.message
+            });
+        }
+
+        const deleted = new Set(totals.deleted);
+        const deleted_items = delete_arr.filter((item) => deleted.has(item.href));
+        const cancelled = totals.cancelled || this.cancel_requested;
+
+        this.post_message({
+            cmd: 'delete_done',
+            deleted_items,
+            failed_items: cancelled ? 0 : delete_arr.length - deleted_items.length,
+            cancelled,
+            deleted_files: this.deleted_files
+        });
+    }
+
+    async run(delete_arr, options = {}) {
+        if (typeof this.gio.rm_tree === 'function') {
+            return this.run_native(delete_arr, options);
+        }
+
         const deleted_items = [];
         let failed_items = 0;
         let cancelled = false;
@@ -277,7 +360,7 @@ const delete_worker = new DeleteWorker();
 if (!isMainThread) {
     parentPort.on('message', (data) => {
         if (data.cmd === 'delete') {
-            delete_worker.run(data.delete_arr).catch((err) => {
+            delete_worker.run(data.delete_arr, { trash: data.trash }).catch((err) => {
                 parentPort.postMessage({
                     cmd: 'set_msg',
                     msg: `Error deleting files: ${err.message}`
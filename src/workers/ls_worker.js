@@ -29,11 +29,9 @@ class FileManager {
 
     }
 
-    get_files(location) {
-
-        // populate file_obj with file data
-        let files_arr = [];
+    get_files(location, callback) {
 
+        // gio.ls enumerates on the libuv threadpool so the results arrive asynchronously
         gio.ls(location, (err, dirents) => {
             if (err) {
 
@@ -42,8 +40,11 @@ class FileManager {
                     msg: err
                 }
                 parentPort.postMessage(msg);
-                return;
+                return callback([]);
             }
+
+            // populate file_obj with file data
+            let files_arr = [];
             dirents.forEach(file => {
                 try {
                     let f = file;
@@ -58,11 +59,9 @@ class FileManager {
                 }
 
             });
-        });
-
-
 
-        return files_arr;
+            callback(files_arr);
+        });
 
     }
 
@@ -78,10 +77,12 @@ if (!isMainThread) {
 
             // List files in directory
             case 'ls':
-                parentPort.postMessage({
-                    cmd: 'ls_done',
-                    files_arr: fileManager.get_files(data.location),
-                    add_tab: data.add_tab
+                fileManager.get_files(data.location, (files_arr) => {
+                    parentPort.postMessage({
+                        cmd: 'ls_done',
+                        files_arr: files_arr,
+                        add_tab: data.add_tab
+                    });
                 });
                 break;
 
@@ -97,20 +98,24 @@ if (!isMainThread) {
                     break;
                 }
 
-                try {
-                    const size = Number(gio.du(source)) || 0;
-
+                // Recursive size on the threadpool, unchanged trees come from the du cache
+                gio.du(source, { threads: 4 }, (err, totals, done) => {
+                    if (err) {
+                        parentPort.postMessage({
+                            cmd: 'set_msg',
+                            msg: (err && err.message) ? err.message : String(err)
+                        });
+                        return;
+                    }
+                    if (!done) {
+                        return;
+                    }
                     parentPort.postMessage({
                         cmd: 'folder_size_done',
                         source,
-                        size
+                        size: totals.size
                     });
-                } catch (err) {
-                    parentPort.postMessage({
-                        cmd: 'set_msg',
-                        msg: (err && err.message) ? err.message : String(err)
-                    });
-                }
+                });
 
                 break;
             }
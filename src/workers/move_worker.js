@@ -1,188 +1,60 @@
 const { parentPort, isMainThread } = require('worker_threads');
-const gio = require('../gio/build/Release/gio.node');
-const fs = require('fs');
 const path = require('path');
+const gio = require('../gio/build/Release/gio.node');
 
 class Utilities {
     constructor() {
-        this.move_arr = [];
-        this.cp_recursive = 0;
-        this.cancel_get_files = false;
         this.cancel_requested = false;
+        this.move_operation = null;
     }
 
     cancel() {
         this.cancel_requested = true;
-        this.cancel_get_files = true;
-    }
-
-    get_files_arr(source, destination, callback) {
-        if (this.cancel_requested) {
-            return callback(null, []);
+        if (this.move_operation) {
+            this.move_operation.cancel();
         }
-
-        this.cp_recursive++;
-
-        let file;
-        try {
-            file = gio.get_file(source);
-        } catch (err) {
-            return callback(new Error(`Error getting file: ${err.message}`));
-        }
-
-        file.source = source;
-        file.destination = destination;
-        this.move_arr.push(file);
-
-        gio.ls(source, (err, dirents) => {
-            if (err) {
-                return callback(new Error(`Error listing directory: ${err.message}`));
-            }
-
-            for (const f of dirents) {
-                if (this.cancel_requested) {
-                    break;
-                }
-
-                if (f.filesystem.toLowerCase() === 'ntfs') {
-                    f.name = f.name.replace(/[^a-z0-9]/gi, '_');
-                }
-                f.source = f.href;
-                f.destination = path.join(destination, f.name);
-
-                if (f.is_dir) {
-                    this.get_files_arr(f.source, f.destination, callback);
-                } else {
-                    this.move_arr.push(f);
-                }
-            }
-
-            if (--this.cp_recursive === 0 || this.cancel_get_files) {
-                const move_arr_copy = [...this.move_arr];
-                this.move_arr = [];
-                callback(null, move_arr_copy);
-            }
-        });
     }
 
+    // Items on the same filesystem are renamed in one step by the native engine,
+    // only moves across devices copy the tree and delete the source afterwards
     async move(move_arr) {
         this.cancel_requested = false;
-        this.cancel_get_files = false;
-        this.cp_recursive = 0;
 
-        let files_arr = [];
-        let total_size = 0;
-        let cancelled = false;
-
-        for (const f of move_arr) {
-            if (this.cancel_requested) {
-                cancelled = true;
-                break;
-            }
-
-            if (f.size) {
-                total_size += parseInt(f.size, 10);
-            }
-
-            if (f.is_dir) {
-                const dirents = await new Promise((resolve, reject) => {
-                    this.get_files_arr(f.source, f.destination, (err, entries) => {
-                        if (err) {
-                            reject(err);
-                            return;
-                        }
-                        resolve(entries || []);
-                    });
-                }).catch((err) => {
-                    parentPort.postMessage({
-                        cmd: 'set_msg',
-                        msg: err.message || String(err)
-                    });
-                    return [];
-                });
-
-                files_arr.push(...dirents);
-                for (const ff of dirents) {
-                    if (ff.size && !ff.is_dir) {
-                        total_size += parseInt(ff.size, 10);
-                    }
+        const totals = await new Promise((resolve, reject) => {
+            this.move_operation = gio.mv_arr(move_arr, (err, totals, done) => {
+                if (err) {
+                    this.move_operation = null;
+                    reject(new Error(err));
+                    return;
                 }
-            } else {
-                files_arr.push(f);
-            }
-        }
-
-        files_arr.sort((a, b) => a.source.length - b.source.length);
-
-        let bytes_copied = 0;
-
-        for (const f of files_arr) {
-            if (this.cancel_requested) {
-                cancelled = true;
-                break;
-            }
-
-            if (f.is_dir) {
-                try {
-                    fs.mkdirSync(f.destination, { recursive: true });
-                } catch (err) {
+                if (!done) {
                     parentPort.postMessage({
-                        cmd: 'set_msg',
-                        msg: `Error creating directory ${f.destination}: ${err.message}`
+                        cmd: 'set_progress',
+                        operation: 'move',
+                        can_cancel: true,
+                        status: `Moving ${totals.files} of ${totals.total_files} files`,
+                        max: totals.total_bytes,
+                        value: Math.min(totals.bytes, totals.total_bytes)
                     });
+                    return !this.cancel_requested;
                 }
-                continue;
-            }
-
-            const res = await new Promise((resolve, reject) => {
-                gio.mv(f.source, f.destination, (err, result) => {
-                    if (err) {
-                        reject(err);
-                        return;
-                    }
-                    resolve(result || {});
-                });
-            }).catch((err) => {
-                parentPort.postMessage({
-                    cmd: 'set_msg',
-                    msg: `Error moving file from ${f.source} to ${f.destination}: ${err.message}`
-                });
-                return null;
+                this.move_operation = null;
+                resolve(totals);
             });
+        });
 
-            if (!res) {
-                continue;
-            }
-
-            if (res.bytes_copied) {
-                bytes_copied += parseInt(res.bytes_copied, 10) || 0;
-            } else if (f.size) {
-                bytes_copied += parseInt(f.size, 10) || 0;
-            }
-
+        for (const error of totals.error_list) {
             parentPort.postMessage({
-                cmd: 'set_progress',
-                operation: 'move',
-                can_cancel: true,
-                status: `Moving ${f.name}`,
-                max: total_size,
-                value: Math.min(bytes_copied, total_size)
+                cmd: 'set_msg',
+                msg: error.message
             });
         }
 
-        if (!cancelled) {
-            const dirs = files_arr.filter((f) => f.is_dir);
-            for (const dir of dirs) {
-                try {
-                    fs.rmSync(dir.source, { recursive: true, force: true });
-                } catch (err) {
-                    parentPort.postMessage({
-                        cmd: 'set_msg',
-                        msg: `Error removing directory ${dir.source}: ${err.message}`
-                    });
-                }
-            }
-        }
+        const moved = new Set(totals.moved);
+        const files_arr = move_arr.filter((f) => moved.has(f.source));
+        const cancelled = totals.cancelled || this.cancel_requested;
+        // nothing moved completely, parts of a tree moved across devices may still be gone
+        const failed = !cancelled && files_arr.length === 0;
 
         parentPort.postMessage({
             cmd: 'set_progress',
@@ -195,12 +67,14 @@ class Utilities {
 
         parentPort.postMessage({
             cmd: 'set_msg',
-            msg: cancelled ? 'Move cancelled.' : `Done moving ${files_arr.length} files.`
+            msg: cancelled ? 'Move cancelled.' : failed ? 'Move failed.' : `Done moving ${files_arr.length} files.`
         });
 
         parentPort.postMessage({
             cmd: 'mv_done',
             cancelled,
+            failed,
+            location: move_arr.length > 0 ? path.dirname(move_arr[0].source) : '',
             files_arr: files_arr
         });
     }
@@ -226,7 +100,9 @@ if (!isMainThread) {
                 });
                 parentPort.postMessage({
                     cmd: 'mv_done',
-                    cancelled: true,
+                    cancelled: false,
+                    failed: true,
+                    location: data.move_arr && data.move_arr.length > 0 ? path.dirname(data.move_arr[0].source) : '',
                     files_arr: []
                 });
             });
@@ -4,209 +4,119 @@ const gio = require('../gio/build/Release/gio.node');
 const fs = require('fs');
 const path = require('path');
 
-
 class Utilities {
 
     constructor() {
-        this.files_arr = [];
-        this.cp_recursive = 0;
-        this.cancel_get_files = false;
         this.cancel_requested = false;
+        this.copy_operation = null;
     }
 
     cancel() {
         this.cancel_requested = true;
-        this.cancel_get_files = true;
-    }
-
-    // sanitize file name
-    sanitize_file_name(href) {
-        return href.replace(/\n/g, ' ').replace(/[^a-z0-9]/gi, '_');
-    }
-
-    get_files_arr(source, destination, callback) {
-
-        if (this.cancel_requested) {
-            return callback(null, []);
-        }
-
-        this.cp_recursive++;
-
-        let file;
-        try {
-            file = gio.get_file(source);
-        } catch (err) {
-            return callback(`Error getting file: ${err.message}`);
+        // stop the file that is being copied as well, other transfers keep running
+        if (this.copy_operation) {
+            this.copy_operation.cancel();
         }
-
-        file.source = source;
-        file.destination = destination;
-        this.files_arr.push(file);
-
-        gio.ls(source, (err, dirents) => {
-
-            if (err) {
-                return callback(`Error listing directory: ${err.message}`);
-            }
-            for (let i = 0; i < dirents.length; i++) {
-                if (this.cancel_requested) {
-                    break;
-                }
-                let f = dirents[i];
-
-                if (f.filesystem.toLocaleLowerCase() === 'ntfs') {
-                    // sanitize file name
-                    f.name = f.name.replace(/[^a-z0-9]/gi, '_');
-                }
-                if (f.is_dir) {
-                    this.get_files_arr(f.href, path.format({ dir: destination, base: f.name }), callback);
-                } else {
-                    f.source = f.href;
-                    f.destination = path.format({ dir: destination, base: f.name });
-                    this.files_arr.push(f);
-                }
-            }
-            if (--this.cp_recursive == 0 || this.cancel_get_files) {
-                let file_arr1 = this.files_arr;
-                this.files_arr = [];
-                return callback(null, file_arr1);
-            }
-        });
     }
 
     // paste
-    async poste(copy_arr) {
+    async poste(copy_arr, location) {
 
         this.cancel_requested = false;
-        this.cancel_get_files = false;
-
-        let source = '';
-        let destination = '';
-
-        let files_arr = [];
-
-        // calculate max bytes to copy
-        let max = 0;
-        let size = 0;
-        for (const f of copy_arr) {
 
-            if (this.cancel_requested) {
-                break;
-            }
-
-            // cal size
-            size = parseInt(f.size);
-            if (size && !f.is_dir) {
-                max += parseInt(f.size);
-            }
-            // handle directories
-            if (f.is_dir) {
-                // Expand directory entries before starting copy so progress can track actual work.
-                const dirents = await new Promise((resolve, reject) => {
-                    this.get_files_arr(f.source, f.destination, (err, entries) => {
-                        if (err) {
-                            reject(new Error(err));
-                            return;
-                        }
-                        resolve(entries || []);
-                    });
-                });
-                dirents.forEach((ff) => {
-                    files_arr.push(ff);
-                    const ffSize = parseInt(ff.size);
-                    if (ffSize) {
-                        max += ffSize;
-                    }
-                });
-            } else {
-                files_arr.push(f);
-            }
+        // overwrites only send the items, they go back to the folder they were headed for
+        if (!location && copy_arr.length > 0) {
+            location = path.dirname(copy_arr[0].destination);
         }
 
-        // sort so we create all the directories first
-        files_arr.sort((a, b) => {
-            return a.source.length - b.source.length;
-        });
-
-        let bytes_copied = 0;
-        let cancelled = false;
-        for (const f of files_arr) {
-
-            if (this.cancel_requested) {
-                cancelled = true;
-                break;
-            }
-
-            source = f.source;
-            destination = f.destination;
-            if (f.is_dir) {
-                // fs.mkdirSync(destination, { recursive: true });
-                gio.mkdir(destination);
-
-                // // get size of destination directory
-                // let size = fs.statSync(destination).size;
-                // if (size) {
-                //     bytes_copied += parseInt(size);
-                // }
+        let destination = '';
 
-            } else {
-                // fs.copyFileSync(source, destination);
-                const res = await new Promise((resolve, reject) => {
-                    gio.cp_async(source, destination, (err, result) => {
-                        if (err) {
-                            reject(err);
-                            return;
-                        }
-                        resolve(result || {});
+        // One native scan sizes the whole paste, checks the free space at the destination
+        // and returns the job list for the copy engine
+        const plan = await new Promise((resolve, reject) => {
+            this.copy_operation = gio.plan_transfer(copy_arr, location, (err, totals, done) => {
+                if (err) {
+                    this.copy_operation = null;
+                    reject(new Error(err));
+                    return;
+                }
+                if (!done) {
+                    parentPort.postMessage({
+                        cmd: 'set_progress',
+                        operation: 'copy',
+                        can_cancel: true,
+                        status: `Scanning ${totals.items} of ${totals.total_items} items`,
+                        max: totals.total_items,
+                        value: totals.items
                     });
-                }).catch((err) => {
-                    let remove_card = {
-                        cmd: 'remove_item',
-                        id: f.id
-                    }
-                    parentPort.postMessage(remove_card);
-
-                    let msg = {
-                        cmd: 'set_msg',
-                        msg: err
-                    }
-                    parentPort.postMessage(msg);
-
-                    return null;
-                });
-
-                if (!res) {
-                    continue;
+                    return !this.cancel_requested;
                 }
+                this.copy_operation = null;
+                resolve(totals);
+            });
+        });
 
-                if (res.bytes_copied > 0) {
-                    bytes_copied += parseInt(res.bytes_copied);
-                } else {
-                    // Fall back to file metadata size when backend doesn't report copied bytes.
-                    const fallbackSize = parseInt(f.size);
-                    if (fallbackSize) {
-                        bytes_copied += fallbackSize;
-                    }
-                }
+        for (const error of plan.error_list) {
+            parentPort.postMessage({
+                cmd: 'set_msg',
+                msg: error.message
+            });
+        }
 
-                let set_progress = {
-                    cmd: 'set_progress',
-                    operation: 'copy',
-                    can_cancel: true,
-                    status: `Copying ${f.name}`,
-                    max: max,
-                    value: Math.min(bytes_copied, max)
-                }
-                parentPort.postMessage(set_progress);
+        if (plan.enough_space === false) {
+            parentPort.postMessage({
+                cmd: 'set_msg',
+                msg: `Not enough space in ${location}: ${plan.total_bytes} bytes needed, ${plan.free} bytes free.`
+            });
+            this.cancel_requested = true;
+        }
 
-                let msg = {
-                    cmd: 'set_msg',
-                    msg: `<img src="../renderer/icons/spinner.gif" style="width: 12px; height: 12px" alt="loading" />`
+        let files_arr = plan.cancelled ? [] : plan.jobs;
+        const max = plan.total_bytes;
+
+        // The native engine creates the directories first and copies the files on
+        // several threads per destination device, progress covers the whole batch.
+        // The plan does not follow links, so they are copied as links.
+        const totals = this.cancel_requested ? { error_list: [], cancelled: true } : await new Promise((resolve, reject) => {
+            this.copy_operation = gio.cp_arr(files_arr, { follow_symlinks: false }, (err, totals, done) => {
+                if (err) {
+                    this.copy_operation = null;
+                    reject(new Error(err));
+                    return;
+                }
+                if (!done) {
+                    parentPort.postMessage({
+                        cmd: 'set_progress',
+                        operation: 'copy',
+                        can_cancel: true,
+                        status: `Copying ${totals.files} of ${totals.total_files} files`,
+                        max: max,
+                        value: Math.min(totals.bytes, max)
+                    });
+                    return !this.cancel_requested;
                 }
-                parentPort.postMessage(msg);
+                this.copy_operation = null;
+                resolve(totals);
+            });
+        });
 
+        const ids = new Map(copy_arr.map((f) => [f.source, f.id]));
+        for (const error of totals.error_list) {
+            if (ids.has(error.source)) {
+                parentPort.postMessage({
+                    cmd: 'remove_item',
+                    id: ids.get(error.source)
+                });
             }
+            parentPort.postMessage({
+                cmd: 'set_msg',
+                msg: error.message
+            });
+        }
 
+        const cancelled = totals.cancelled || this.cancel_requested;
+        if (files_arr.length > 0) {
+            destination = files_arr[files_arr.length - 1].destination;
         }
 
         let set_progress = {
@@ -247,7 +157,7 @@ if (!isMainThread) {
         const cmd = data.cmd;
         switch (cmd) {
             case 'paste':
-                utilities.poste(data.copy_arr).catch((err) => {
+                utilities.poste(data.copy_arr, data.location).catch((err) => {
                     parentPort.postMessage({
                         cmd: 'set_msg',
                         msg: err && err.message ? err.message : String(err)
@@ -260,6 +170,12 @@ if (!isMainThread) {
                         value: 0,
                         status: ''
                     });
+                    parentPort.postMessage({
+                        cmd: 'cp_done',
+                        cancelled: false,
+                        failed: true,
+                        destination: ''
+                    });
                 });
                 break;
             case 'cancel':
@@ -7,34 +7,36 @@ parentPort.on('message', (data) => {
 
     switch (data.cmd) {
 
-        case 'get_properties':
-
-            let properties_arr = [];
-            if (data.selected_files_arr.length > 0) {
-                data.selected_files_arr.forEach(file => {
-                    let properties = gio.get_file(file.href);
-                    if (properties && properties.is_dir) {
-                        try {
-                            const counts = gio.count(file.href);
-                            properties.folder_count = counts.folders;
-                            properties.file_count = counts.files;
-                            properties.count = counts.total;
-                        } catch (e) {
-                            // leave counts undefined if not readable
-                        }
+        case 'get_properties': {
+
+            // Recursive counts are scanned in parallel off the worker thread
+            const count_options = { recursive: true, threads: 8 };
+            const get_properties = (file) => new Promise((resolve) => {
+                let properties = gio.get_file(file.href);
+                if (!properties || !properties.is_dir) {
+                    resolve(properties);
+                    return;
+                }
+                gio.count(file.href, count_options, (err, counts) => {
+                    // leave counts undefined if not readable
+                    if (!err) {
+                        properties.folder_count = counts.folders;
+                        properties.file_count = counts.files;
+                        properties.count = counts.total;
                     }
-                    properties_arr.push(properties);
-                })
-            } else {
-                // let properties = gio.get_file(location);
-                // properties_arr.push(properties);
-            }
-            let cmd = {
-                cmd: 'properties',
-                properties_arr: properties_arr
-            }
-            parentPort.postMessage(cmd);
+                    resolve(properties);
+                });
+            });
+
+            Promise.all(data.selected_files_arr.map(get_properties)).then((properties_arr) => {
+                let cmd = {
+                    cmd: 'properties',
+                    properties_arr: properties_arr
+                }
+                parentPort.postMessage(cmd);
+            });
             break;
+        }
     }
 
 })
@@ -20,7 +20,10 @@ function buildMockGio(tree, options = {}) {
                 is_symlink: false
             };
         }),
-        ls: jest.fn((targetPath, callback) => {
+        ls: jest.fn((targetPath, options, callback) => {
+            if (typeof options === 'function') {
+                callback = options;
+            }
             const entries = tree[targetPath];
             const invoke = () => {
                 if (entries instanceof Error) {
@@ -170,3 +173,181 @@ describe('DeleteWorker.count_files SMB timing', () => {
         }));
     });
 });
+
+function buildWalkGio(tree, options = {}) {
+    const gioMock = buildMockGio(tree);
+    const batchSize = options.batchSize || 2;
+
+    // Emulates the native walk: root first, parents before children, delivered in batches
+    gioMock.walk = jest.fn((root, walkOptions, callback) => {
+        const entries = [{ name: root.split('/').pop(), href: root, is_dir: true, is_symlink: false }];
+        const visit = (dir) => {
+            for (const entry of tree[dir] || []) {
+                entries.push(entry);
+                if (entry.is_dir && !entry.is_symlink) {
+                    visit(entry.href);
+                }
+            }
+        };
+        visit(root);
+
+        gioMock.walk_batches = 0;
+        for (let i = 0; i < entries.length; i += batchSize) {
+            gioMock.walk_batches += 1;
+            if (callback(null, entries.slice(i, i + batchSize), false) === false) {
+                break;
+            }
+        }
+        callback(null, [], true);
+    });
+
+    return gioMock;
+}
+
+describe('DeleteWorker native walk', () => {
+    const root = '//server/share/walked';
+    const tree = {
+        [root]: [
+            createDirent('dirA', `${root}/dirA`, true),
+            createDirent('file1.txt', `${root}/file1.txt`, false),
+            createDirent('link-to-dir', `${root}/link-to-dir`, true, true)
+        ],
+        [`${root}/dirA`]: [
+            createDirent('nested.txt', `${root}/dirA/nested.txt`, false),
+            createDirent('dirB', `${root}/dirA/dirB`, true)
+        ],
+        [`${root}/dirA/dirB`]: [
+            createDirent('deep.txt', `${root}/dirA/dirB/deep.txt`, false)
+        ]
+    };
+
+    it('counts files with a single walk instead of listing every directory', async () => {
+        const gioMock = buildWalkGio(tree);
+        const worker = new DeleteWorker({ gio: gioMock, parentPort: { postMessage: jest.fn() } });
+
+        const count = await worker.count_files(root, true);
+
+        expect(count).toBe(4);
+        expect(gioMock.walk).toHaveBeenCalledTimes(1);
+        expect(gioMock.ls).not.toHaveBeenCalled();
+        expect(gioMock.get_file).not.toHaveBeenCalled();
+    });
+
+    it('deletes children before their parents', async () => {
+        const gioMock = buildWalkGio(tree);
+        const worker = new DeleteWorker({ gio: gioMock, parentPort: { postMessage: jest.fn() } });
+
+        await worker.run([{ href: root, is_dir: true }]);
+
+        const removed = gioMock.rm.mock.calls.map((call) => call[0]);
+        expect(removed).toHaveLength(7);
+        expect(removed.indexOf(`${root}/dirA/dirB/deep.txt`)).toBeLessThan(removed.indexOf(`${root}/dirA/dirB`));
+        expect(removed.indexOf(`${root}/dirA`)).toBeLessThan(removed.indexOf(root));
+        expect(removed[removed.length - 1]).toBe(root);
+    });
+
+    it('stops the walk when cancelled', async () => {
+        const gioMock = buildWalkGio(tree, { batchSize: 1 });
+        const worker = new DeleteWorker({ gio: gioMock, parentPort: { postMessage: jest.fn() } });
+
+        worker.cancel();
+        const count = await worker.count_files(root, true);
+
+        expect(count).toBe(0);
+        expect(gioMock.walk_batches).toBe(1);
+    });
+});
+
+function buildRmTreeGio(options = {}) {
+    const gioMock = buildMockGio({});
+    const failed = new Set(options.failed || []);
+
+    // Emulates the native recursive delete: progress per item, then the final totals
+    gioMock.rm_tree = jest.fn((paths, rmOptions, callback) => {
+        const operation = { cancel: jest.fn() };
+        const deleted = [];
+        const error_list = [];
+        let cancelled = false;
+        for (let i = 0; i < paths.length; i++) {
+            if (failed.has(paths[i])) {
+                error_list.push({ source: paths[i], message: `Error deleting ${paths[i]}: Permission denied` });
+            } else {
+                deleted.push(paths[i]);
+            }
+            if (callback(null, { files: deleted.length * 10, items: i + 1, total_items: paths.length, errors: error_list.length }, false) === false) {
+                cancelled = true;
+                break;
+            }
+        }
+        callback(null, { files: deleted.length * 10, items: paths.length, total_items: paths.length, errors: error_list.length, deleted, error_list, cancelled }, true);
+        return operation;
+    });
+
+    return gioMock;
+}
+
+describe('DeleteWorker native rm_tree', () => {
+    const items = [
+        { href: '/tmp/delete-me/node_modules', name: 'node_modules', is_dir: true },
+        { href: '/tmp/delete-me/readme.md', name: 'readme.md', is_dir: false }
+    ];
+
+    it('removes every item with one native call and no scan', async () => {
+        const gioMock = buildRmTreeGio();
+        const parentPortMock = { postMessage: jest.fn() };
+        const worker = new DeleteWorker({ gio: gioMock, parentPort: parentPortMock });
+
+        await worker.run(items);
+
+        expect(gioMock.rm_tree).toHaveBeenCalledTimes(1);
+        expect(gioMock.rm_tree.mock.calls[0][0]).toEqual(items.map((item) => item.href));
+        expect(gioMock.ls).not.toHaveBeenCalled();
+        expect(gioMock.rm).not.toHaveBeenCalled();
+        expect(parentPortMock.postMessage).toHaveBeenCalledWith(expect.objectContaining({
+            cmd: 'delete_done',
+            deleted_items: items,
+            failed_items: 0,
+            cancelled: false,
+            deleted_files: 20
+        }));
+    });
+
+    it('reports items that could not be deleted', async () => {
+        const gioMock = buildRmTreeGio({ failed: [items[0].href] });
+        const parentPortMock = { postMessage: jest.fn() };
+        const worker = new DeleteWorker({ gio: gioMock, parentPort: parentPortMock });
+
+        await worker.run(items);
+
+        expect(parentPortMock.postMessage).toHaveBeenCalledWith({
+            cmd: 'set_msg',
+            msg: `Error deleting ${items[0].href}: Permission denied`
+        });
+        expect(parentPortMock.postMessage).toHaveBeenCalledWith(expect.objectContaining({
+            cmd: 'delete_done',
+            deleted_items: [items[1]],
+            failed_items: 1
+        }));
+    });
+
+    it('passes the trash option and stops when cancelled', async () => {
+        const gioMock = buildRmTreeGio();
+        const parentPortMock = { postMessage: jest.fn() };
+        const worker = new DeleteWorker({ gio: gioMock, parentPort: parentPortMock });
+
+        // cancel once the first progress report arrives
+        parentPortMock.postMessage.mockImplementation((message) => {
+            if (message.cmd === 'set_progress' && message.value > 0) {
+                worker.cancel();
+            }
+        });
+        await worker.run(items, { trash: true });
+
+        expect(gioMock.rm_tree.mock.calls[0][1]).toEqual({ trash: true });
+        expect(parentPortMock.postMessage).toHaveBeenCalledWith(expect.objectContaining({
+            cmd: 'delete_done',
+            deleted_items: [items[0]],
+            cancelled: true
+        }));
+    });
+});